@@ -0,0 +1,399 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Счётчик незавершённых задач группы; JobSystem::wait ждёт, пока он не обнулится.
+// Первое исключение из задач группы сохраняется и выбрасывается из wait
+class TaskGroup {
+public:
+    TaskGroup() : pending(0) {}
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+    std::atomic<int> pending;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    void fail(std::exception_ptr exception) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) error = exception;
+    }
+
+    void rethrow() {
+        std::exception_ptr exception;
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            exception = error;
+            error = nullptr;
+        }
+        if (exception) std::rethrow_exception(exception);
+    }
+};
+
+// Время выполнения одной задачи - для профилирования
+struct TaskTiming {
+    const char* name;
+    int thread;        // 0 - внешние потоки (главный и др.), 1.. - рабочие
+    double startMs;    // от создания планировщика
+    double durationMs;
+};
+
+// Планировщик задач с перехватом работы (work stealing), общий для загрузчиков,
+// генераторов поверхностей и растеризатора - вместо отдельных потоков у каждого.
+//
+// У каждого рабочего потока своя очередь: новые задачи он кладёт в конец и берёт
+// оттуда же (свежие данные ещё в кэше), а свободные потоки забирают задачи с начала
+// чужих очередей. Внешние потоки пользуются общей очередью 0. Поток, ждущий группу
+// (wait), сам выполняет задачи, поэтому вложенные parallelFor не блокируются; когда
+// задач для него нет, он засыпает до завершения группы или появления новых задач.
+// Долгие фоновые задачи (загрузка файлов) идут в отдельную очередь: их берут только
+// рабочие потоки, когда других задач нет, а ожидающий поток - никогда, чтобы кадр не
+// застрял на чужой загрузке. Долгие задачи, которые должны идти параллельно главному
+// потоку (растеризация кадра), идут в очередь только для рабочих потоков: ожидающий
+// поток не выполнит их у себя и не остановит ими свою работу.
+class JobSystem {
+public:
+    // Общий планировщик процесса: hardware_concurrency() - 1 рабочих потоков
+    // плюс вызывающий поток, который помогает им в wait
+    static JobSystem& instance() {
+        static JobSystem jobs;
+        return jobs;
+    }
+
+    explicit JobSystem(int workerCount = 0) : epoch(std::chrono::steady_clock::now()) {
+        if (workerCount <= 0) {
+            int hw = (int)std::thread::hardware_concurrency();
+            workerCount = std::max(1, hw - 1);
+        }
+        for (int i = 0; i <= workerCount; i++) queues.emplace_back(new Queue());
+        for (int i = 1; i <= workerCount; i++) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Рабочие потоки и внешний
+    int threadCount() const { return (int)queues.size(); }
+
+    // name - строковый литерал, по нему группируются замеры времени
+    void run(TaskGroup& group, const char* name, std::function<void()> work) {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        Queue& queue = *queues[currentThread()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back({ std::move(work), &group, name });
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        notify();
+    }
+
+    // Задача только для рабочих потоков; они берут её раньше остальных
+    void runOnWorker(TaskGroup& group, const char* name, std::function<void()> work) {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            workerOnly.push_back({ std::move(work), &group, name });
+            workerOnlyQueued.fetch_add(1, std::memory_order_release);
+        }
+        wake.notify_one();
+    }
+
+    void runBackground(TaskGroup& group, const char* name, std::function<void()> work) {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            background.push_back({ std::move(work), &group, name });
+        }
+        wake.notify_one();
+    }
+
+    // Ожидание группы; пока она не готова, поток выполняет обычные задачи.
+    // Исключение из задачи группы выбрасывается здесь, после завершения всей группы
+    void wait(TaskGroup& group) {
+        drain(group);
+        group.rethrow();
+    }
+
+    // Параллельный цикл по [begin, end): непрерывные блоки не меньше grain элементов,
+    // body(from, to) на блок. Блоков до четырёх на поток - свободные потоки забирают
+    // остаток у занятых. Первый блок выполняет вызывающий поток
+    template <typename Body>
+    void parallelFor(const char* name, int begin, int end, int grain, Body&& body) {
+        int count = end - begin;
+        if (count <= 0) return;
+        grain = std::max(1, grain);
+        int chunks = (int)std::min<long long>((count + (long long)grain - 1) / grain, 4LL * threadCount());
+        if (chunks <= 1) {
+            body(begin, end);
+            return;
+        }
+
+        TaskGroup group;
+        for (int c = chunks - 1; c >= 1; c--) {
+            int from = begin + (int)((long long)count * c / chunks);
+            int to = begin + (int)((long long)count * (c + 1) / chunks);
+            run(group, name, [&body, from, to] { body(from, to); });
+        }
+        // Задачи ссылаются на body и group: до выхода они должны завершиться
+        try {
+            timed(name, currentThread(), [&] { body(begin, begin + (int)((long long)count / chunks)); });
+        } catch (...) {
+            drain(group);
+            throw;
+        }
+        wait(group);
+    }
+
+    // Замеры времени задач; пока профилирование выключено, они не собираются
+    void setProfiling(bool enabled) { profiling.store(enabled, std::memory_order_relaxed); }
+    bool isProfiling() const { return profiling.load(std::memory_order_relaxed); }
+
+    // Накопленные замеры всех потоков; буферы очищаются
+    std::vector<TaskTiming> takeTimings() {
+        std::vector<TaskTiming> result;
+        for (auto& queue : queues) {
+            std::lock_guard<std::mutex> lock(queue->timingMutex);
+            result.insert(result.end(), queue->timings.begin(), queue->timings.end());
+            queue->timings.clear();
+        }
+        return result;
+    }
+
+private:
+    struct Task {
+        std::function<void()> work;
+        TaskGroup* group;
+        const char* name;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::mutex timingMutex;
+        std::vector<TaskTiming> timings;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues; // [0] - внешние потоки, [i] - рабочий i
+    std::vector<std::thread> workers;
+    std::deque<Task> background;                // под sleepMutex
+    std::deque<Task> workerOnly;                // под sleepMutex
+    std::atomic<int> workerOnlyQueued{0};
+    std::atomic<int> queued{0};                 // задач в очередях queues
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    // Потоки, уснувшие в wait: будятся новыми задачами и завершением групп
+    std::condition_variable waiterWake;
+    int sleepingWaiters = 0;                    // под sleepMutex
+    bool stopping = false;
+    std::atomic<bool> profiling{false};
+    std::chrono::steady_clock::time_point epoch;
+
+    // Номер очереди текущего потока в этом планировщике
+    struct ThreadSlot {
+        const JobSystem* owner = nullptr;
+        int index = 0;
+    };
+    static ThreadSlot& threadSlot() {
+        thread_local ThreadSlot slot;
+        return slot;
+    }
+    int currentThread() const {
+        const ThreadSlot& slot = threadSlot();
+        return slot.owner == this ? slot.index : 0;
+    }
+
+    void notify() {
+        // Захват мьютекса: рабочий не уснёт между проверкой условия и ожиданием
+        bool waiters;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            waiters = sleepingWaiters > 0;
+        }
+        wake.notify_one();
+        if (waiters) waiterWake.notify_all();
+    }
+
+    // Ожидание без выброса исключения группы. Несколько пустых попыток поток
+    // уступает процессор, затем спит: кадр, который ждёт растеризацию, не должен
+    // занимать ядро целиком
+    void drain(TaskGroup& group) {
+        int thread = currentThread();
+        int misses = 0;
+        while (!group.done()) {
+            if (runOne(thread, false)) {
+                misses = 0;
+            } else if (++misses < 64) {
+                std::this_thread::yield();
+            } else {
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                sleepingWaiters++;
+                waiterWake.wait(lock, [&] { return group.done() || queued.load() > 0; });
+                sleepingWaiters--;
+                misses = 0;
+            }
+        }
+    }
+
+    // Задача группы завершена; исключение уходит в группу, а не в рабочий поток
+    void complete(TaskGroup& group) {
+        if (group.pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        // После обнуления группа может быть уже уничтожена ожидающим - к ней больше
+        // не обращаемся
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        if (sleepingWaiters > 0) waiterWake.notify_all();
+    }
+
+    template <typename Work>
+    void timed(const char* name, int thread, Work&& work) {
+        if (!profiling.load(std::memory_order_relaxed)) {
+            work();
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        work();
+        auto finish = std::chrono::steady_clock::now();
+        Queue& queue = *queues[thread];
+        std::lock_guard<std::mutex> lock(queue.timingMutex);
+        queue.timings.push_back({ name, thread,
+                                  std::chrono::duration<double, std::milli>(start - epoch).count(),
+                                  std::chrono::duration<double, std::milli>(finish - start).count() });
+    }
+
+    // Рабочим - сначала задачи только для них; затем своя очередь - с конца, чужие -
+    // с начала, фоновая - последней
+    bool takeTask(int thread, bool worker, Task& task) {
+        if (worker && workerOnlyQueued.load(std::memory_order_acquire) > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            if (!workerOnly.empty()) {
+                task = std::move(workerOnly.front());
+                workerOnly.pop_front();
+                workerOnlyQueued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        if (queued.load(std::memory_order_acquire) > 0) {
+            int count = (int)queues.size();
+            for (int k = 0; k < count; k++) {
+                Queue& queue = *queues[(thread + k) % count];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) continue;
+                if (k == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        if (!worker) return false;
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        if (background.empty()) return false;
+        task = std::move(background.front());
+        background.pop_front();
+        return true;
+    }
+
+    bool runOne(int thread, bool worker) {
+        Task task;
+        if (!takeTask(thread, worker, task)) return false;
+        try {
+            timed(task.name, thread, task.work);
+        } catch (...) {
+            task.group->fail(std::current_exception());
+        }
+        complete(*task.group);
+        return true;
+    }
+
+    void workerLoop(int index) {
+        threadSlot() = { this, index };
+        while (true) {
+            if (runOne(index, true)) continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return stopping || queued.load() > 0 || !background.empty() || !workerOnly.empty(); });
+            if (stopping && queued.load() == 0 && background.empty() && workerOnly.empty()) return;
+        }
+    }
+};
+
+// Граф задач с зависимостями: задача запускается, как только выполнены все задачи,
+// от которых она зависит. run() блокирует вызывающий поток до конца графа и сам
+// выполняет задачи, пока ждёт. Граф можно запускать повторно
+class TaskGraph {
+public:
+    // Номер задачи; dependencies - номера уже добавленных задач
+    int add(const char* name, std::function<void()> work, std::initializer_list<int> dependencies = {}) {
+        int index = (int)nodes.size();
+        nodes.emplace_back(new Node());
+        Node& node = *nodes.back();
+        node.name = name;
+        node.work = std::move(work);
+        for (int dependency : dependencies) {
+            nodes[dependency]->successors.push_back(index);
+            node.dependencyCount++;
+        }
+        return index;
+    }
+
+    void run(JobSystem& jobs = JobSystem::instance()) {
+        for (auto& node : nodes) node->remaining.store(node->dependencyCount, std::memory_order_relaxed);
+        TaskGroup group;
+        for (int i = 0; i < (int)nodes.size(); i++) {
+            if (nodes[i]->dependencyCount == 0) submit(jobs, group, i);
+        }
+        jobs.wait(group);
+    }
+
+private:
+    struct Node {
+        const char* name = nullptr;
+        std::function<void()> work;
+        std::vector<int> successors;
+        int dependencyCount = 0;
+        std::atomic<int> remaining{0};
+    };
+    std::vector<std::unique_ptr<Node>> nodes;
+
+    // Последователи ставятся в очередь до того, как задача засчитана группе
+    // выполненной, поэтому wait не вернётся раньше времени
+    void submit(JobSystem& jobs, TaskGroup& group, int index) {
+        Node& node = *nodes[index];
+        jobs.run(group, node.name, [this, &jobs, &group, &node] {
+            node.work();
+            for (int next : node.successors) {
+                if (nodes[next]->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) submit(jobs, group, next);
+            }
+        });
+    }
+};
+
+#endif
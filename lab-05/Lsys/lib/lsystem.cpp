@@ -1,4 +1,7 @@
 #include "lsystem.h"
+#include "job_system.h"
+#include <algorithm>
+#include <array>
 #include <fstream>
 #include <iostream>
 
@@ -29,17 +32,55 @@ bool LSystem::loadFromFile(const std::string& filename) {
 }
 
 std::string LSystem::generate(int iterations) {
+    // Замена для каждого символа; nullptr - символ переносится как есть
+    std::array<const std::string*, 256> replacement{};
+    for (const auto& rule : rules) replacement[(unsigned char)rule.first] = &rule.second;
+
+    // Правила контекстно-свободные, поэтому строка режется на блоки, которые
+    // раскрываются независимо: сначала длины результатов блоков, по ним - смещения,
+    // затем каждый блок пишет свою часть следующей строки
+    const int blockSize = 1 << 16;
     std::string current = axiom;
+    std::string next;
+    std::vector<size_t> offsets;
     for (int i = 0; i < iterations; ++i) {
-        std::string next = "";
-        for (char c : current) {
-            if (rules.count(c)) {
-                next += rules[c];
-            } else {
-                next += c;
+        int blockCount = (int)((current.size() + blockSize - 1) / blockSize);
+        offsets.assign(blockCount + 1, 0);
+        auto blockRange = [&](int block, size_t& from, size_t& to) {
+            from = (size_t)block * blockSize;
+            to = std::min(current.size(), from + blockSize);
+        };
+        JobSystem& jobs = JobSystem::instance();
+        jobs.parallelFor("lsystem measure", 0, blockCount, 1, [&](int fromBlock, int toBlock) {
+            for (int block = fromBlock; block < toBlock; block++) {
+                size_t from, to, length = 0;
+                blockRange(block, from, to);
+                for (size_t k = from; k < to; k++) {
+                    const std::string* rule = replacement[(unsigned char)current[k]];
+                    length += rule ? rule->size() : 1;
+                }
+                offsets[block + 1] = length;
             }
-        }
-        current = next;
+        });
+        for (int block = 0; block < blockCount; block++) offsets[block + 1] += offsets[block];
+
+        next.resize(offsets[blockCount]);
+        jobs.parallelFor("lsystem expand", 0, blockCount, 1, [&](int fromBlock, int toBlock) {
+            for (int block = fromBlock; block < toBlock; block++) {
+                size_t from, to;
+                blockRange(block, from, to);
+                char* out = &next[0] + offsets[block];
+                for (size_t k = from; k < to; k++) {
+                    const std::string* rule = replacement[(unsigned char)current[k]];
+                    if (rule) {
+                        out = std::copy(rule->begin(), rule->end(), out);
+                    } else {
+                        *out++ = current[k];
+                    }
+                }
+            }
+        });
+        current.swap(next);
     }
     return current;
 }
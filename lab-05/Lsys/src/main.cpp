@@ -4,7 +4,6 @@
 #include <iostream>
 #include <cmath>
 #include <random>
-#include <functional>
 #include <random>
 #include <algorithm>
 
@@ -19,18 +18,22 @@ struct TurtleState {
     float line_length;
 };
 
-void drawThickLine(sf::RenderWindow& window, sf::Vector2f p1, sf::Vector2f p2, float thickness, sf::Color color) {
+// Толстый отрезок - прямоугольник из двух треугольников в общем массиве вершин:
+// вся картинка рисуется одним вызовом draw. Прямоугольник тот же, что у
+// повёрнутого sf::RectangleShape: ширина не меньше пикселя, ось - по центру толщины
+void appendThickLine(sf::VertexArray& vertices, sf::Vector2f p1, sf::Vector2f p2, float thickness, sf::Color color) {
     if (p1 == p2) return;
     
     sf::Vector2f direction = p2 - p1;
     float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+    sf::Vector2f normal(-direction.y / length, direction.x / length);
     
-    sf::RectangleShape line(sf::Vector2f(length, std::max(1.0f, thickness)));
-    line.setOrigin(0, thickness / 2.f);
-    line.setPosition(p1);
-    line.setFillColor(color);
-    line.setRotation(atan2(direction.y, direction.x) * 180 / PI);
-    window.draw(line);
+    sf::Vector2f bottom = normal * (-thickness / 2.f);
+    sf::Vector2f top = normal * (std::max(1.0f, thickness) - thickness / 2.f);
+    sf::Vector2f corners[4] = { p1 + bottom, p2 + bottom, p2 + top, p1 + top };
+    for (int i : { 0, 1, 2, 0, 2, 3 }) {
+        vertices.append(sf::Vertex(corners[i], color));
+    }
 }
 
 sf::Color lerpColor(const sf::Color& a, const sf::Color& b, float t) {
@@ -127,11 +130,12 @@ int main() {
     sf::Color brown(139, 69, 19);
     sf::Color green(0, 128, 0);
 
-    struct DrawCall {
+    struct Segment {
+        sf::Vector2f start, end;
         float thickness;
-        std::function<void(sf::RenderWindow&)> call;
+        sf::Color color;
     };
-    std::vector<DrawCall> drawCalls;
+    std::vector<Segment> segments;
 
     TurtleState currentState = {{0, 0}, lsys.getInitialAngle(), INITIAL_THICKNESS, isTree ? brown : sf::Color::White, 0, LINE_LENGTH};
     std::stack<TurtleState> stateStack;
@@ -157,9 +161,7 @@ int main() {
                 color = lerpColor(brown, green, t);
             }
             
-            drawCalls.push_back({thickness, [=](sf::RenderWindow& win) {
-                drawThickLine(win, startPos, endPos, thickness, color);
-            }});
+            segments.push_back({startPos, endPos, thickness, color});
 
         } else if (c == '+') {
             currentState.angle += baseAngle;
@@ -180,26 +182,36 @@ int main() {
         }
     }
 
-    std::sort(drawCalls.begin(), drawCalls.end(),
-            [](const DrawCall& a, const DrawCall& b) {
+    std::sort(segments.begin(), segments.end(),
+            [](const Segment& a, const Segment& b) {
                 return a.thickness > b.thickness;
             });
 
+    sf::VertexArray vertices(sf::Triangles);
+    for (const auto& segment : segments) {
+        appendThickLine(vertices, segment.start, segment.end, segment.thickness, segment.color);
+    }
+
     // --- ГЛАВНЫЙ ЦИКЛ ОТРИСОВКИ ---
+    // Картинка не меняется, поэтому перерисовка только по событиям окна (изменение
+    // размера, возврат фокуса); между ними поток спит в waitEvent
+    bool frameDirty = true;
     while (window.isOpen()) {
+        if (frameDirty) {
+            window.clear(sf::Color::Black);
+            window.draw(vertices);
+            window.display();
+            frameDirty = false;
+        }
+
         sf::Event event;
-        while (window.pollEvent(event)) {
+        if (!window.waitEvent(event)) continue;
+        do {
             if (event.type == sf::Event::Closed)
                 window.close();
-        }
-
-        window.clear(sf::Color::Black);
-
-        for (const auto& dc : drawCalls) {
-            dc.call(window);
-        }
-
-        window.display();
+            if (event.type == sf::Event::Resized || event.type == sf::Event::GainedFocus)
+                frameDirty = true;
+        } while (window.pollEvent(event));
     }
 
 
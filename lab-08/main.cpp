@@ -93,13 +93,23 @@ int main() {
     printInstructions();
     Point3D viewDirection(0, 0, 1);
 
+    // Всё в сцене меняется только по событиям, поэтому кадр перерисовывается лишь
+    // после клавиш и событий окна; между ними поток спит в waitEvent, а на экране
+    // остаётся последний кадр
+    bool frameDirty = true;
+
     while (window.isOpen()) {
         sf::Event event;
-        while (window.pollEvent(event)) {
+        for (bool hasEvent = frameDirty ? window.pollEvent(event) : window.waitEvent(event); hasEvent;
+             hasEvent = window.pollEvent(event)) {
             if (event.type == sf::Event::Closed) {
                 window.close();
             }
+            if (event.type == sf::Event::Resized || event.type == sf::Event::GainedFocus) {
+                frameDirty = true;
+            }
             if (event.type == sf::Event::KeyPressed) {
+                frameDirty = true;
                 Matrix4x4 transformation;
                 transformation.identity();
 
@@ -262,6 +272,9 @@ int main() {
             }
         }
 
+        if (!frameDirty || !window.isOpen()) continue;
+        frameDirty = false;
+
         window.clear(sf::Color::Black);
 
         Matrix4x4 viewMatrix, projMatrix;
@@ -0,0 +1,100 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include "job_system.h"
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+// Фоновая загрузка ресурсов.
+// Разбор файлов и декодирование выполняются фоновыми задачами общего планировщика
+// (job_system.h), готовый результат попадает в очередь завершённых задач. Главный
+// поток раз в кадр вызывает processCompleted() и только там подменяет данные,
+// которыми пользуется отрисовка.
+class AssetLoader {
+public:
+    AssetLoader() = default;
+
+    // Ещё не начатые загрузки отменяются, начатые дожидаются завершения
+    ~AssetLoader() {
+        stopping = true;
+        JobSystem::instance().wait(jobs);
+    }
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // work выполняется в рабочем потоке, onReady - в главном (внутри processCompleted).
+    // Если work выбросил исключение, вместо onReady там же вызывается onFailed
+    template <typename T>
+    void load(std::function<T()> work, std::function<void(T&)> onReady, std::function<void()> onFailed = nullptr) {
+        pending++;
+        JobSystem::instance().runBackground(jobs, "asset", [this, work, onReady, onFailed] {
+            if (stopping) {
+                pending--;
+                return;
+            }
+            std::shared_ptr<T> result;
+            try {
+                result = std::make_shared<T>(work());
+            } catch (const std::exception& e) {
+                std::cerr << "Ошибка фоновой загрузки: " << e.what() << std::endl;
+                failed(onFailed);
+                return;
+            } catch (...) {
+                std::cerr << "Ошибка фоновой загрузки" << std::endl;
+                failed(onFailed);
+                return;
+            }
+            std::lock_guard<std::mutex> lock(completedMutex);
+            completed.push_back([result, onReady] { onReady(*result); });
+        });
+    }
+
+    // Выполняет обработчики готовых загрузок; maxCount < 0 - все накопившиеся.
+    // Ограничение числа за кадр не даёт нескольким выгрузкам попасть в один кадр
+    int processCompleted(int maxCount = -1) {
+        int processed = 0;
+        while (maxCount < 0 || processed < maxCount) {
+            std::function<void()> callback;
+            {
+                std::lock_guard<std::mutex> lock(completedMutex);
+                if (completed.empty()) break;
+                callback = std::move(completed.front());
+                completed.pop_front();
+            }
+            callback();
+            pending--;
+            processed++;
+        }
+        return processed;
+    }
+
+    // Есть ли загрузки, результат которых ещё не обработан главным потоком
+    bool isBusy() const {
+        return pending > 0;
+    }
+
+private:
+    TaskGroup jobs;
+
+    void failed(const std::function<void()>& onFailed) {
+        if (!onFailed) {
+            pending--;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(completedMutex);
+        completed.push_back(onFailed);
+    }
+
+    std::deque<std::function<void()>> completed;
+    std::mutex completedMutex;
+    std::atomic<int> pending{0};
+    std::atomic<bool> stopping{false};
+};
+
+#endif
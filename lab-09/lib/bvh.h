@@ -0,0 +1,807 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Иерархия ограничивающих объёмов (BVH) для трассировки лучей и выбора мышью.
+//
+// MeshBvh - дерево над треугольниками одной сетки (грани-многоугольники режутся веером),
+// SceneBvh - дерево над экземплярами MeshBvh со своими матрицами. При смене матриц
+// объектов верхнее дерево не перестраивается, а только пересчитывает рамки (refit);
+// так же MeshBvh::refit подхватывает сдвинутые вершины сетки с той же связностью.
+
+struct Ray {
+    Point3D origin;
+    Point3D direction; // не обязательно единичной длины, t - в длинах direction
+    double tMin = 0.0;
+    double tMax = std::numeric_limits<double>::infinity();
+};
+
+struct RayHit {
+    double t = std::numeric_limits<double>::infinity();
+    int face = -1;     // грань сетки
+    int instance = -1; // объект SceneBvh
+    int triangle = -1; // треугольник веера грани: её вершины 0, triangle + 1, triangle + 2
+    double u = 0, v = 0; // барицентрические координаты в этом треугольнике
+};
+
+// Пакет из четырёх лучей (обычно соседние пиксели 2x2) в раскладке SoA: рамки и
+// треугольники проверяются циклами сразу по четырём дорожкам, которые компилятор
+// разворачивает в векторные инструкции. Неактивная дорожка не попадает никуда
+struct RayPacket {
+    static const int size = 4;
+    // Неактивные дорожки тоже читаются циклами по пакету - поэтому нули, а не мусор
+    double ox[size] = {}, oy[size] = {}, oz[size] = {};
+    double dx[size] = {}, dy[size] = {}, dz[size] = {};
+    double tMin[size] = {}, tMax[size] = {};
+    bool active[size] = { false, false, false, false };
+
+    void set(int lane, const Ray& ray) {
+        ox[lane] = ray.origin.x;
+        oy[lane] = ray.origin.y;
+        oz[lane] = ray.origin.z;
+        dx[lane] = ray.direction.x;
+        dy[lane] = ray.direction.y;
+        dz[lane] = ray.direction.z;
+        tMin[lane] = ray.tMin;
+        tMax[lane] = ray.tMax;
+        active[lane] = true;
+    }
+
+    Ray ray(int lane) const {
+        Ray ray;
+        ray.origin = Point3D(ox[lane], oy[lane], oz[lane]);
+        ray.direction = Point3D(dx[lane], dy[lane], dz[lane], 0);
+        ray.tMin = tMin[lane];
+        ray.tMax = tMax[lane];
+        return ray;
+    }
+};
+
+struct Aabb {
+    double lo[3] = { std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+                     std::numeric_limits<double>::infinity() };
+    double hi[3] = { -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+                     -std::numeric_limits<double>::infinity() };
+
+    void expand(const Point3D& p) {
+        double c[3] = { p.x, p.y, p.z };
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], c[k]);
+            hi[k] = std::max(hi[k], c[k]);
+        }
+    }
+    void expand(const Aabb& box) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], box.lo[k]);
+            hi[k] = std::max(hi[k], box.hi[k]);
+        }
+    }
+    bool empty() const { return lo[0] > hi[0]; }
+    double center(int axis) const { return 0.5 * (lo[axis] + hi[axis]); }
+    double area() const {
+        if (empty()) return 0.0;
+        double dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+        return 2.0 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // Пересечение с лучом (метод пластин); invDir - покомпонентно 1 / direction
+    bool hit(const Ray& ray, const double invDir[3], double tMax, double& tEnter) const {
+        double origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+        double t0 = ray.tMin, t1 = tMax;
+        for (int k = 0; k < 3; k++) {
+            double tNear = (lo[k] - origin[k]) * invDir[k];
+            double tFar = (hi[k] - origin[k]) * invDir[k];
+            if (tNear > tFar) std::swap(tNear, tFar);
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+            if (t0 > t1) return false;
+        }
+        tEnter = t0;
+        return true;
+    }
+
+    // То же для пакета: битовая маска дорожек, луч которых пересекает рамку
+    int hit(const RayPacket& packet, const double invX[], const double invY[], const double invZ[],
+            const double tMax[]) const {
+        int mask = 0;
+        for (int l = 0; l < RayPacket::size; l++) {
+            double x0 = (lo[0] - packet.ox[l]) * invX[l], x1 = (hi[0] - packet.ox[l]) * invX[l];
+            double y0 = (lo[1] - packet.oy[l]) * invY[l], y1 = (hi[1] - packet.oy[l]) * invY[l];
+            double z0 = (lo[2] - packet.oz[l]) * invZ[l], z1 = (hi[2] - packet.oz[l]) * invZ[l];
+            double t0 = std::max({ std::min(x0, x1), std::min(y0, y1), std::min(z0, z1), packet.tMin[l] });
+            double t1 = std::min({ std::max(x0, x1), std::max(y0, y1), std::max(z0, z1), tMax[l] });
+            mask |= (t0 <= t1) << l;
+        }
+        return mask;
+    }
+};
+
+// Дерево над произвольными примитивами, заданными рамками. Построение - разбиение по
+// площади поверхности (SAH) по 16 корзинам на каждой оси; верхние уровни делятся
+// последовательно (с параллельным заполнением корзин), нижние поддеревья строятся
+// параллельно и затем дописываются в общий массив узлов. Глубже sahDepth узлы делятся
+// пополам по медиане: глубина дерева не превышает sahDepth + 31 и стек обхода
+// фиксированного размера не переполняется на вырожденных данных.
+class BvhTree {
+public:
+    static const int sahDepth = 24;
+    static const int stackSize = 64;
+
+    // Внутренний узел: count == 0, дети - first и first + 1. Лист: order[first .. first + count)
+    struct Node {
+        Aabb box;
+        int first = 0;
+        int count = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> order;
+
+    void build(const std::vector<Aabb>& boxes, int maxLeafSize = 4) {
+        nodes.clear();
+        order.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) order[i] = (int)i;
+        centroids.resize(boxes.size() * 3);
+        for (size_t i = 0; i < boxes.size(); i++) {
+            for (int k = 0; k < 3; k++) centroids[3 * i + k] = boxes[i].center(k);
+        }
+        leafSize = std::max(1, maxLeafSize);
+        nodes.emplace_back();
+        if (boxes.empty()) return;
+
+        // Сверху дерево делится в один поток, пока не наберётся достаточно поддеревьев
+        struct Task {
+            int node, begin, end, depth;
+        };
+        int hw = JobSystem::instance().threadCount();
+        size_t parallelSize = std::max<size_t>(4096, boxes.size() / (size_t)(8 * hw));
+        std::vector<Task> stack{ { 0, 0, (int)boxes.size(), 0 } }, subtrees;
+        while (!stack.empty()) {
+            Task task = stack.back();
+            stack.pop_back();
+            if ((size_t)(task.end - task.begin) <= parallelSize) {
+                subtrees.push_back(task);
+                continue;
+            }
+            int mid = split(boxes, nodes[task.node], task.begin, task.end, task.depth);
+            if (mid < 0) continue;
+            int left = (int)nodes.size();
+            nodes.emplace_back();
+            nodes.emplace_back();
+            nodes[task.node].first = left;
+            nodes[task.node].count = 0;
+            stack.push_back({ left, task.begin, mid, task.depth + 1 });
+            stack.push_back({ left + 1, mid, task.end, task.depth + 1 });
+        }
+
+        std::vector<std::vector<Node>> local(subtrees.size());
+        parallelFor("bvh", 0, (int)subtrees.size(), 1, [&](int from, int to) {
+            for (int s = from; s < to; s++) {
+                buildSubtree(boxes, local[s], subtrees[s].begin, subtrees[s].end, subtrees[s].depth);
+            }
+        });
+
+        // Корень поддерева встаёт на зарезервированное место, остальные узлы - в конец
+        for (size_t s = 0; s < subtrees.size(); s++) {
+            int base = (int)nodes.size() - 1;
+            for (size_t i = 1; i < local[s].size(); i++) {
+                Node node = local[s][i];
+                if (node.count == 0) node.first += base;
+                nodes.push_back(node);
+            }
+            Node root = local[s][0];
+            if (root.count == 0) root.first += base;
+            nodes[subtrees[s].node] = root;
+        }
+        centroids.clear();
+        centroids.shrink_to_fit();
+    }
+
+    // Пересчёт рамок снизу вверх при той же структуре (дети всегда правее родителя)
+    void refit(const std::vector<Aabb>& boxes) {
+        for (int n = (int)nodes.size() - 1; n >= 0; n--) {
+            Node& node = nodes[n];
+            node.box = Aabb();
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++) node.box.expand(boxes[order[i]]);
+            } else if (!nodes.empty() && node.first > 0) {
+                node.box.expand(nodes[node.first].box);
+                node.box.expand(nodes[node.first + 1].box);
+            }
+        }
+    }
+
+    // Обход от ближнего ребёнка к дальнему. intersectLeaf(first, count, tMax) обновляет tMax
+    // и возвращает true, если обход можно прекратить (ответ на запрос «есть ли попадание»)
+    template <typename LeafFunc>
+    void traverse(const Ray& ray, double& tMax, LeafFunc&& intersectLeaf) const {
+        if (nodes.empty() || nodes[0].box.empty()) return;
+        double invDir[3] = { 1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z };
+        int stack[stackSize];
+        int top = 0;
+        double tEnter;
+        if (!nodes[0].box.hit(ray, invDir, tMax, tEnter)) return;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (node.count > 0) {
+                if (intersectLeaf(node.first, node.count, tMax)) return;
+                continue;
+            }
+            double tLeft, tRight;
+            bool hitLeft = nodes[node.first].box.hit(ray, invDir, tMax, tLeft);
+            bool hitRight = nodes[node.first + 1].box.hit(ray, invDir, tMax, tRight);
+            if (hitLeft && hitRight) {
+                // Дальний ребёнок кладётся в стек первым
+                bool leftFirst = tLeft <= tRight;
+                stack[top++] = leftFirst ? node.first + 1 : node.first;
+                stack[top++] = leftFirst ? node.first : node.first + 1;
+            } else if (hitLeft) {
+                stack[top++] = node.first;
+            } else if (hitRight) {
+                stack[top++] = node.first + 1;
+            }
+        }
+    }
+
+    // Обход пакетом: узел проверяется сразу для всех дорожек и посещается, если его
+    // задевает хоть один луч. intersectLeaf(first, count, tMax, mask) уменьшает tMax
+    // попавших дорожек (tMax = -inf выключает дорожку) и может прервать обход
+    template <typename LeafFunc>
+    void traversePacket(const RayPacket& packet, double tMax[], LeafFunc&& intersectLeaf) const {
+        if (nodes.empty() || nodes[0].box.empty()) return;
+        double invX[RayPacket::size], invY[RayPacket::size], invZ[RayPacket::size];
+        int lead = -1;
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (!packet.active[l]) {
+                invX[l] = invY[l] = invZ[l] = 0;
+                tMax[l] = -std::numeric_limits<double>::infinity();
+                continue;
+            }
+            invX[l] = 1.0 / packet.dx[l];
+            invY[l] = 1.0 / packet.dy[l];
+            invZ[l] = 1.0 / packet.dz[l];
+            if (lead < 0) lead = l;
+        }
+        if (lead < 0) return;
+
+        int stack[stackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            int mask = node.box.hit(packet, invX, invY, invZ, tMax);
+            if (mask == 0) continue;
+            if (node.count > 0) {
+                if (intersectLeaf(node.first, node.count, tMax, mask)) return;
+                continue;
+            }
+            // Порядок детей - по направлению первого активного луча
+            const Aabb& left = nodes[node.first].box;
+            const Aabb& right = nodes[node.first + 1].box;
+            double along = (right.center(0) - left.center(0)) * packet.dx[lead] +
+                           (right.center(1) - left.center(1)) * packet.dy[lead] +
+                           (right.center(2) - left.center(2)) * packet.dz[lead];
+            bool leftFirst = along >= 0;
+            stack[top++] = leftFirst ? node.first + 1 : node.first;
+            stack[top++] = leftFirst ? node.first : node.first + 1;
+        }
+    }
+
+private:
+    static const int binCount = 16;
+
+    struct Bin {
+        Aabb box;
+        int count = 0;
+    };
+
+    struct Binning {
+        Aabb box, centroidBox;
+        Bin bins[3][binCount];
+    };
+
+    std::vector<double> centroids;
+    int leafSize = 4;
+
+    void fillBins(const std::vector<Aabb>& boxes, int begin, int end, const Aabb& centroidBox, Binning& binning) const {
+        for (int i = begin; i < end; i++) {
+            int prim = order[i];
+            for (int k = 0; k < 3; k++) {
+                double extent = centroidBox.hi[k] - centroidBox.lo[k];
+                if (extent <= 0) continue;
+                int b = (int)((centroids[3 * prim + k] - centroidBox.lo[k]) / extent * binCount);
+                b = std::min(binCount - 1, std::max(0, b));
+                binning.bins[k][b].box.expand(boxes[prim]);
+                binning.bins[k][b].count++;
+            }
+        }
+    }
+
+    // Делит order[begin, end) по лучшей плоскости SAH и заполняет рамку узла.
+    // Возвращает границу разбиения или -1, если узел становится листом
+    int split(const std::vector<Aabb>& boxes, Node& node, int begin, int end, int depth) {
+        int count = end - begin;
+        const int chunk = 1 << 15;
+        int chunks = (count + chunk - 1) / chunk;
+
+        // Рамки узла и центров; для больших узлов - параллельно по кускам
+        // Мелкие узлы (их большинство) обходятся без выделения памяти
+        Binning single;
+        std::vector<Binning> several(chunks > 1 ? chunks : 0);
+        Binning* partial = chunks > 1 ? several.data() : &single;
+        parallelFor("bvh", 0, chunks, 1, [&](int from, int to) {
+            for (int c = from; c < to; c++) {
+                for (int i = begin + c * chunk; i < std::min(end, begin + (c + 1) * chunk); i++) {
+                    int prim = order[i];
+                    partial[c].box.expand(boxes[prim]);
+                    partial[c].centroidBox.expand(Point3D(centroids[3 * prim], centroids[3 * prim + 1], centroids[3 * prim + 2]));
+                }
+            }
+        });
+        Aabb box, centroidBox;
+        for (int c = 0; c < chunks; c++) {
+            const Binning& p = partial[c];
+            box.expand(p.box);
+            centroidBox.expand(p.centroidBox);
+        }
+        node.box = box;
+        node.first = begin;
+        node.count = count;
+        if (count <= leafSize) return -1;
+        if (depth >= sahDepth) return medianSplit(begin, end, centroidBox);
+
+        parallelFor("bvh", 0, chunks, 1, [&](int from, int to) {
+            for (int c = from; c < to; c++) {
+                fillBins(boxes, begin + c * chunk, std::min(end, begin + (c + 1) * chunk), centroidBox, partial[c]);
+            }
+        });
+        Binning binning;
+        for (int c = 0; c < chunks; c++) {
+            const Binning& p = partial[c];
+            for (int k = 0; k < 3; k++) {
+                for (int b = 0; b < binCount; b++) {
+                    binning.bins[k][b].box.expand(p.bins[k][b].box);
+                    binning.bins[k][b].count += p.bins[k][b].count;
+                }
+            }
+        }
+
+        // Стоимость: площадь половины, умноженная на число примитивов в ней
+        double bestCost = std::numeric_limits<double>::infinity();
+        int bestAxis = -1, bestBin = 0;
+        for (int k = 0; k < 3; k++) {
+            if (centroidBox.hi[k] - centroidBox.lo[k] <= 0) continue;
+            double rightArea[binCount];
+            int rightCount[binCount];
+            Aabb accumulated;
+            int accumulatedCount = 0;
+            for (int b = binCount - 1; b > 0; b--) {
+                accumulated.expand(binning.bins[k][b].box);
+                accumulatedCount += binning.bins[k][b].count;
+                rightArea[b] = accumulated.area();
+                rightCount[b] = accumulatedCount;
+            }
+            accumulated = Aabb();
+            accumulatedCount = 0;
+            for (int b = 1; b < binCount; b++) {
+                accumulated.expand(binning.bins[k][b - 1].box);
+                accumulatedCount += binning.bins[k][b - 1].count;
+                if (accumulatedCount == 0 || rightCount[b] == 0) continue;
+                double cost = accumulated.area() * accumulatedCount + rightArea[b] * rightCount[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = k;
+                    bestBin = b;
+                }
+            }
+        }
+        // Все центры совпали или разбиение не выгоднее листа небольшого размера
+        if (bestAxis < 0) {
+            if (count <= 4 * leafSize) return -1;
+            int mid = begin + count / 2;
+            return mid;
+        }
+        if (bestCost >= box.area() * count && count <= 4 * leafSize) return -1;
+
+        double extent = centroidBox.hi[bestAxis] - centroidBox.lo[bestAxis];
+        int* middle = std::partition(order.data() + begin, order.data() + end, [&](int prim) {
+            int b = (int)((centroids[3 * prim + bestAxis] - centroidBox.lo[bestAxis]) / extent * binCount);
+            return std::min(binCount - 1, std::max(0, b)) < bestBin;
+        });
+        return (int)(middle - order.data());
+    }
+
+    // Деление пополам по медиане центров вдоль самой длинной оси
+    int medianSplit(int begin, int end, const Aabb& centroidBox) {
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+            if (centroidBox.hi[k] - centroidBox.lo[k] > centroidBox.hi[axis] - centroidBox.lo[axis]) axis = k;
+        }
+        int mid = begin + (end - begin) / 2;
+        std::nth_element(order.data() + begin, order.data() + mid, order.data() + end, [&](int a, int b) {
+            return centroids[3 * a + axis] < centroids[3 * b + axis];
+        });
+        return mid;
+    }
+
+    void buildSubtree(const std::vector<Aabb>& boxes, std::vector<Node>& out, int begin, int end, int depth) {
+        struct Task {
+            int node, begin, end, depth;
+        };
+        out.emplace_back();
+        std::vector<Task> stack{ { 0, begin, end, depth } };
+        while (!stack.empty()) {
+            Task task = stack.back();
+            stack.pop_back();
+            Node node;
+            int mid = split(boxes, node, task.begin, task.end, task.depth);
+            if (mid >= 0) {
+                node.first = (int)out.size();
+                node.count = 0;
+                out.emplace_back();
+                out.emplace_back();
+                stack.push_back({ node.first, task.begin, mid, task.depth + 1 });
+                stack.push_back({ node.first + 1, mid, task.end, task.depth + 1 });
+            }
+            out[task.node] = node;
+        }
+    }
+};
+
+// Дерево над треугольниками одной сетки
+class MeshBvh {
+public:
+    MeshBvh() = default;
+
+    explicit MeshBvh(const Mesh& mesh, int maxLeafSize = 4) {
+        std::vector<int> corners;
+        std::vector<int> faces;
+        std::vector<int> fans;
+        for (int f = 0; f < mesh.faceCount(); f++) {
+            const int* face = mesh.faceIndices(f);
+            for (int i = 1; i + 1 < mesh.faceSize(f); i++) {
+                corners.insert(corners.end(), { face[0], face[i], face[i + 1] });
+                faces.push_back(f);
+                fans.push_back(i - 1);
+            }
+        }
+        int count = (int)faces.size();
+        std::vector<Aabb> boxes(count);
+        parallelFor("bvh", 0, count, 8192, [&](int from, int to) {
+            for (int t = from; t < to; t++) {
+                for (int k = 0; k < 3; k++) boxes[t].expand(mesh.positions[corners[3 * t + k]]);
+            }
+        });
+        tree.build(boxes, maxLeafSize);
+
+        // Треугольники переставляются в порядок листьев: лист читает их подряд
+        triangles.resize(count);
+        parallelFor("bvh", 0, count, 8192, [&](int from, int to) {
+            for (int i = from; i < to; i++) {
+                int t = tree.order[i];
+                Triangle& triangle = triangles[i];
+                for (int k = 0; k < 3; k++) triangle.vertices[k] = corners[3 * t + k];
+                triangle.face = faces[t];
+                triangle.fan = fans[t];
+            }
+        });
+        for (int i = 0; i < count; i++) tree.order[i] = i;
+        updateTriangles(mesh);
+    }
+
+    // Вершины сдвинулись, связность та же: пересчитываются только рамки
+    void refit(const Mesh& mesh) {
+        updateTriangles(mesh);
+        std::vector<Aabb> boxes(triangles.size());
+        parallelFor("bvh", 0, (int)triangles.size(), 8192, [&](int from, int to) {
+            for (int i = from; i < to; i++) {
+                for (int k = 0; k < 3; k++) boxes[i].expand(mesh.positions[triangles[i].vertices[k]]);
+            }
+        });
+        tree.refit(boxes);
+    }
+
+    int triangleCount() const { return (int)triangles.size(); }
+    Aabb bounds() const { return tree.nodes.empty() ? Aabb() : tree.nodes[0].box; }
+
+    // Ближайшее пересечение
+    bool intersect(const Ray& ray, RayHit& hit) const {
+        double tMax = std::min(ray.tMax, hit.t);
+        bool found = false;
+        tree.traverse(ray, tMax, [&](int first, int count, double& t) {
+            for (int i = first; i < first + count; i++) {
+                double tHit, u, v;
+                if (intersectTriangle(triangles[i], ray, t, tHit, u, v)) {
+                    t = tHit;
+                    hit.t = tHit;
+                    hit.face = triangles[i].face;
+                    hit.triangle = triangles[i].fan;
+                    hit.u = u;
+                    hit.v = v;
+                    found = true;
+                }
+            }
+            return false;
+        });
+        return found;
+    }
+
+    // Есть ли хоть одно пересечение на [tMin, tMax] (для теней)
+    bool occluded(const Ray& ray) const {
+        double tMax = ray.tMax;
+        bool found = false;
+        tree.traverse(ray, tMax, [&](int first, int count, double& t) {
+            for (int i = first; i < first + count; i++) {
+                double tHit, u, v;
+                if (intersectTriangle(triangles[i], ray, t, tHit, u, v)) {
+                    found = true;
+                    return true;
+                }
+            }
+            return false;
+        });
+        return found;
+    }
+
+    // Ближайшие пересечения для пакета; hits[l].t на входе ограничивает дальность
+    void intersect(const RayPacket& packet, RayHit hits[]) const {
+        double tMax[RayPacket::size];
+        for (int l = 0; l < RayPacket::size; l++) tMax[l] = std::min(packet.tMax[l], hits[l].t);
+        tree.traversePacket(packet, tMax, [&](int first, int count, double* t, int mask) {
+            for (int i = first; i < first + count; i++) {
+                double tHit[RayPacket::size], u[RayPacket::size], v[RayPacket::size];
+                int hitMask = intersectTriangle(triangles[i], packet, t, tHit, u, v) & mask;
+                for (int l = 0; l < RayPacket::size; l++) {
+                    if (!(hitMask >> l & 1)) continue;
+                    t[l] = tHit[l];
+                    hits[l].t = tHit[l];
+                    hits[l].face = triangles[i].face;
+                    hits[l].triangle = triangles[i].fan;
+                    hits[l].u = u[l];
+                    hits[l].v = v[l];
+                }
+            }
+            return false;
+        });
+    }
+
+    // occluded[l] = true, если на луче дорожки l есть хоть одно пересечение
+    void occluded(const RayPacket& packet, bool occluded[]) const {
+        double tMax[RayPacket::size];
+        int pending = 0;
+        for (int l = 0; l < RayPacket::size; l++) {
+            tMax[l] = packet.tMax[l];
+            if (packet.active[l] && !occluded[l]) pending |= 1 << l;
+            else tMax[l] = -std::numeric_limits<double>::infinity();
+        }
+        if (pending == 0) return;
+        tree.traversePacket(packet, tMax, [&](int first, int count, double* t, int mask) {
+            for (int i = first; i < first + count; i++) {
+                double tHit[RayPacket::size], u[RayPacket::size], v[RayPacket::size];
+                int hitMask = intersectTriangle(triangles[i], packet, t, tHit, u, v) & mask & pending;
+                for (int l = 0; l < RayPacket::size; l++) {
+                    if (!(hitMask >> l & 1)) continue;
+                    occluded[l] = true;
+                    t[l] = -std::numeric_limits<double>::infinity();
+                    pending &= ~(1 << l);
+                }
+                if (pending == 0) return true;
+            }
+            return false;
+        });
+    }
+
+private:
+    struct Triangle {
+        Point3D v0, e1, e2;
+        int vertices[3];
+        int face;
+        int fan;
+    };
+
+    BvhTree tree;
+    std::vector<Triangle> triangles;
+
+    void updateTriangles(const Mesh& mesh) {
+        parallelFor("bvh", 0, (int)triangles.size(), 8192, [&](int from, int to) {
+            for (int i = from; i < to; i++) {
+                Triangle& triangle = triangles[i];
+                triangle.v0 = mesh.positions[triangle.vertices[0]];
+                triangle.e1 = mesh.positions[triangle.vertices[1]] - triangle.v0;
+                triangle.e2 = mesh.positions[triangle.vertices[2]] - triangle.v0;
+            }
+        });
+    }
+
+    // Пересечение Мёллера-Трумбора, обе стороны треугольника
+    static bool intersectTriangle(const Triangle& triangle, const Ray& ray, double tMax,
+                                  double& t, double& u, double& v) {
+        Point3D p = ray.direction.cross(triangle.e2);
+        double det = triangle.e1.dot(p);
+        if (std::abs(det) < 1e-14) return false;
+        double invDet = 1.0 / det;
+        Point3D s = ray.origin - triangle.v0;
+        u = s.dot(p) * invDet;
+        if (u < 0 || u > 1) return false;
+        Point3D q = s.cross(triangle.e1);
+        v = ray.direction.dot(q) * invDet;
+        if (v < 0 || u + v > 1) return false;
+        t = triangle.e2.dot(q) * invDet;
+        return t >= ray.tMin && t < tMax;
+    }
+
+    // Мёллер-Трумбор сразу для четырёх лучей; возвращает маску попаданий
+    static int intersectTriangle(const Triangle& triangle, const RayPacket& packet, const double tMax[],
+                                 double t[], double u[], double v[]) {
+        const double e1x = triangle.e1.x, e1y = triangle.e1.y, e1z = triangle.e1.z;
+        const double e2x = triangle.e2.x, e2y = triangle.e2.y, e2z = triangle.e2.z;
+        int mask = 0;
+        for (int l = 0; l < RayPacket::size; l++) {
+            double px = packet.dy[l] * e2z - packet.dz[l] * e2y;
+            double py = packet.dz[l] * e2x - packet.dx[l] * e2z;
+            double pz = packet.dx[l] * e2y - packet.dy[l] * e2x;
+            double det = e1x * px + e1y * py + e1z * pz;
+            double invDet = 1.0 / det;
+            double sx = packet.ox[l] - triangle.v0.x, sy = packet.oy[l] - triangle.v0.y, sz = packet.oz[l] - triangle.v0.z;
+            u[l] = (sx * px + sy * py + sz * pz) * invDet;
+            double qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+            v[l] = (packet.dx[l] * qx + packet.dy[l] * qy + packet.dz[l] * qz) * invDet;
+            t[l] = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+            bool hit = std::abs(det) >= 1e-14 && u[l] >= 0 && v[l] >= 0 && u[l] + v[l] <= 1 &&
+                       t[l] >= packet.tMin[l] && t[l] < tMax[l];
+            mask |= hit << l;
+        }
+        return mask;
+    }
+};
+
+// Дерево над объектами сцены (экземплярами MeshBvh со своими матрицами)
+class SceneBvh {
+public:
+    int addInstance(const MeshBvh* mesh, const Matrix4x4& transform) {
+        instances.push_back({ mesh, transform, transform.inverse() });
+        return (int)instances.size() - 1;
+    }
+
+    void setTransform(int instance, const Matrix4x4& transform) {
+        instances[instance].transform = transform;
+        instances[instance].inverse = transform.inverse();
+    }
+
+    int instanceCount() const { return (int)instances.size(); }
+
+    void build() { tree.build(worldBoxes(), 1); }
+    // После setTransform: структура дерева та же, пересчитываются рамки
+    void refit() { tree.refit(worldBoxes()); }
+
+    bool intersect(const Ray& ray, RayHit& hit) const {
+        double tMax = std::min(ray.tMax, hit.t);
+        bool found = false;
+        tree.traverse(ray, tMax, [&](int first, int count, double& t) {
+            for (int i = first; i < first + count; i++) {
+                int id = tree.order[i];
+                Ray local = toObject(ray, id);
+                local.tMax = t;
+                RayHit localHit;
+                if (instances[id].mesh->intersect(local, localHit)) {
+                    t = localHit.t;
+                    hit = localHit;
+                    hit.instance = id;
+                    found = true;
+                }
+            }
+            return false;
+        });
+        return found;
+    }
+
+    bool occluded(const Ray& ray) const {
+        double tMax = ray.tMax;
+        bool found = false;
+        tree.traverse(ray, tMax, [&](int first, int count, double& t) {
+            for (int i = first; i < first + count; i++) {
+                Ray local = toObject(ray, tree.order[i]);
+                local.tMax = t;
+                if (instances[tree.order[i]].mesh->occluded(local)) {
+                    found = true;
+                    return true;
+                }
+            }
+            return false;
+        });
+        return found;
+    }
+
+    void intersect(const RayPacket& packet, RayHit hits[]) const {
+        double tMax[RayPacket::size];
+        for (int l = 0; l < RayPacket::size; l++) tMax[l] = std::min(packet.tMax[l], hits[l].t);
+        tree.traversePacket(packet, tMax, [&](int first, int count, double* t, int mask) {
+            for (int i = first; i < first + count; i++) {
+                int id = tree.order[i];
+                RayPacket local = toObject(packet, id);
+                RayHit localHits[RayPacket::size];
+                for (int l = 0; l < RayPacket::size; l++) {
+                    local.active[l] = packet.active[l] && (mask >> l & 1);
+                    localHits[l].t = t[l];
+                }
+                instances[id].mesh->intersect(local, localHits);
+                for (int l = 0; l < RayPacket::size; l++) {
+                    if (!local.active[l] || localHits[l].face < 0) continue;
+                    t[l] = localHits[l].t;
+                    hits[l] = localHits[l];
+                    hits[l].instance = id;
+                }
+            }
+            return false;
+        });
+    }
+
+    void occluded(const RayPacket& packet, bool occluded[]) const {
+        double tMax[RayPacket::size];
+        for (int l = 0; l < RayPacket::size; l++) tMax[l] = packet.tMax[l];
+        tree.traversePacket(packet, tMax, [&](int first, int count, double* t, int mask) {
+            bool all = true;
+            for (int i = first; i < first + count; i++) {
+                RayPacket local = toObject(packet, tree.order[i]);
+                for (int l = 0; l < RayPacket::size; l++) local.active[l] = packet.active[l] && (mask >> l & 1);
+                instances[tree.order[i]].mesh->occluded(local, occluded);
+            }
+            for (int l = 0; l < RayPacket::size; l++) {
+                if (occluded[l]) t[l] = -std::numeric_limits<double>::infinity();
+                else if (packet.active[l]) all = false;
+            }
+            return all;
+        });
+    }
+
+private:
+    struct Instance {
+        const MeshBvh* mesh;
+        Matrix4x4 transform;
+        Matrix4x4 inverse;
+    };
+
+    std::vector<Instance> instances;
+    BvhTree tree;
+
+    // Луч в системе координат объекта: t у аффинных матриц сохраняется
+    Ray toObject(const Ray& ray, int id) const {
+        const Matrix4x4& inverse = instances[id].inverse;
+        Ray local = ray;
+        local.origin = inverse.transform(ray.origin);
+        local.direction = inverse.transform(Point3D(ray.direction.x, ray.direction.y, ray.direction.z, 0));
+        return local;
+    }
+
+    RayPacket toObject(const RayPacket& packet, int id) const {
+        RayPacket local = packet;
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (packet.active[l]) local.set(l, toObject(packet.ray(l), id));
+        }
+        return local;
+    }
+
+    std::vector<Aabb> worldBoxes() const {
+        std::vector<Aabb> boxes(instances.size());
+        for (size_t i = 0; i < instances.size(); i++) {
+            Aabb local = instances[i].mesh->bounds();
+            if (local.empty()) continue;
+            for (int c = 0; c < 8; c++) {
+                Point3D corner(c & 1 ? local.hi[0] : local.lo[0], c & 2 ? local.hi[1] : local.lo[1],
+                               c & 4 ? local.hi[2] : local.lo[2]);
+                boxes[i].expand(instances[i].transform.transform(corner));
+            }
+        }
+        return boxes;
+    }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include "mesh_clusters.h"
+#include "zbuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Команда отрисовки: сетка (или её кластер), номер материала и матрица модели
+struct DrawCommand {
+    const Mesh* mesh;
+    const MeshCluster* cluster;
+    int material;
+    Matrix4x4 model;
+};
+
+// Порядок элементов по возрастанию 32-битных ключей: поразрядная сортировка (LSD)
+// по байтам. Устойчива - равные ключи остаются в исходном порядке. Проход, в котором
+// у всех ключей один и тот же байт, пропускается
+inline void radixSortOrder(const std::vector<uint32_t>& keys, std::vector<int>& order, std::vector<int>& scratch) {
+    int count = (int)keys.size();
+    order.resize(count);
+    scratch.resize(count);
+    for (int i = 0; i < count; i++) order[i] = i;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int histogram[257] = {};
+        for (int i = 0; i < count; i++) histogram[((keys[i] >> shift) & 0xFF) + 1]++;
+        if (count == 0 || histogram[((keys[0] >> shift) & 0xFF) + 1] == count) continue;
+        for (int b = 0; b < 256; b++) histogram[b + 1] += histogram[b];
+        for (int i = 0; i < count; i++) scratch[histogram[(keys[order[i]] >> shift) & 0xFF]++] = order[i];
+        order.swap(scratch);
+    }
+}
+
+// Буфер команд кадра. Вместо немедленной отрисовки каждого треугольника кадр
+// сначала записывается целиком (drawMesh), затем команды сортируются по состоянию
+// (режим закраски, текстура) и внутри одного состояния - по глубине от ближних
+// к дальним: ближняя геометрия раньше заполняет z-буфер, и закрытые пиксели дальней
+// не закрашиваются. Подряд идущие команды с одинаковым состоянием - одна партия:
+// состояние растеризатора переключается один раз на партию.
+class CommandBuffer {
+public:
+    // Начало кадра: команды предыдущего кадра отбрасываются, память остаётся
+    void reset() {
+        commands.clear();
+        materials.clear();
+        sorted = false;
+    }
+
+    // Сетка должна жить до конца кадра. Если для неё построены кластеры
+    // (buildMeshClusters), каждый кластер - отдельная команда со своей глубиной
+    void drawMesh(const Mesh& mesh, const Material& material, const Matrix4x4& transform,
+                  const std::vector<MeshCluster>* clusters = nullptr) {
+        materials.push_back(material);
+        int index = (int)materials.size() - 1;
+        if (clusters && !clusters->empty()) {
+            for (const MeshCluster& cluster : *clusters) commands.push_back({ &mesh, &cluster, index, transform });
+        } else {
+            commands.push_back({ &mesh, nullptr, index, transform });
+        }
+        sorted = false;
+    }
+
+    size_t size() const { return commands.size(); }
+
+    // Число партий (смен состояния) после сортировки - для статистики
+    int batchCount() const {
+        int batches = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            if (i == 0 || stateOf(keys[order[i]]) != stateOf(keys[order[i - 1]])) batches++;
+        }
+        return batches;
+    }
+
+    // Предварительный проход: только глубина, с тем же отсечением граней, что при отрисовке
+    void executeDepth(ZBuffer& zbuffer, const Matrix4x4& view, const Matrix4x4& projection) {
+        sort(view);
+        Matrix4x4 viewProjection = projection * view;
+        for (int i : order) {
+            const DrawCommand& command = commands[i];
+            zbuffer.drawMeshDepth(*command.mesh, viewProjection * command.model,
+                                  materials[command.material].cullsBackFaces(*command.mesh), command.cluster);
+        }
+    }
+
+    void execute(ZBuffer& zbuffer, const Matrix4x4& view, const Matrix4x4& projection, const Light& light) {
+        sort(view);
+        Matrix4x4 viewProjection = projection * view;
+        for (size_t i = 0; i < order.size(); i++) {
+            const DrawCommand& command = commands[order[i]];
+            const Material& material = materials[command.material];
+            if (i == 0 || stateOf(keys[order[i]]) != stateOf(keys[order[i - 1]])) zbuffer.setTexture(material.texture);
+            zbuffer.drawMesh(*command.mesh, material, command.model, viewProjection, light, command.cluster);
+        }
+    }
+
+private:
+    std::vector<DrawCommand> commands;
+    std::vector<Material> materials;
+    std::vector<const Texture*> textureSlots;
+    std::vector<double> depths;
+    std::vector<uint32_t> keys;
+    std::vector<int> order, scratch;
+    bool sorted = false;
+
+    // Ключ: старшие 16 бит - состояние (режим закраски, номер текстуры в кадре),
+    // младшие 16 - глубина, квантованная по диапазону глубин кадра
+    static uint32_t stateOf(uint32_t key) { return key >> 16; }
+
+    // Глубина ближней точки ограничивающей сферы в системе камеры (камера смотрит вдоль -z)
+    static double nearestDepth(const DrawCommand& command, const Matrix4x4& view) {
+        Point3D center;
+        double radius;
+        if (command.cluster) {
+            center = command.cluster->center;
+            radius = command.cluster->radius;
+        } else {
+            fitBoundingSphere(*command.mesh, nullptr, center, radius);
+        }
+        Matrix4x4 modelView = view * command.model;
+        double scale = 0;
+        for (int c = 0; c < 3; c++) {
+            double x = modelView.m[0][c], y = modelView.m[1][c], z = modelView.m[2][c];
+            scale = std::max(scale, std::sqrt(x * x + y * y + z * z));
+        }
+        return -modelView.transform(center).z - radius * scale;
+    }
+
+    void sort(const Matrix4x4& view) {
+        if (sorted) return;
+        int count = (int)commands.size();
+        depths.resize(count);
+        double minDepth = 0, maxDepth = 0;
+        for (int i = 0; i < count; i++) {
+            depths[i] = nearestDepth(commands[i], view);
+            minDepth = i == 0 ? depths[i] : std::min(minDepth, depths[i]);
+            maxDepth = i == 0 ? depths[i] : std::max(maxDepth, depths[i]);
+        }
+        double scale = maxDepth > minDepth ? 65535.0 / (maxDepth - minDepth) : 0.0;
+
+        textureSlots.clear();
+        keys.resize(count);
+        for (int i = 0; i < count; i++) {
+            const Material& material = materials[commands[i].material];
+            Material::Shading shading = material.shadingFor(*commands[i].mesh);
+            uint32_t state = (uint32_t)shading << 14;
+            if (shading == Material::TEXTURED) {
+                auto slot = std::find(textureSlots.begin(), textureSlots.end(), material.texture);
+                if (slot == textureSlots.end()) slot = textureSlots.insert(slot, material.texture);
+                state |= (uint32_t)std::min<ptrdiff_t>(slot - textureSlots.begin(), 0x3FFF);
+            }
+            keys[i] = (state << 16) | (uint32_t)((depths[i] - minDepth) * scale);
+        }
+        radixSortOrder(keys, order, scratch);
+        sorted = true;
+    }
+};
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "math_3d.h"
+#include "geometry.h"
+#include "mesh_clusters.h"
+#include "zbuffer.h"
+#include "shadow_map.h"
+#include "light_grid.h"
+#include "command_buffer.h"
+#include "job_system.h"
+
+// Объект кадра. Сетка и кластеры удерживаются владением: главный поток может
+// заменить свои (сменить модель, выгрузить чанк ландшафта), пока кадр растеризуется.
+// Текстура материала - обычный указатель, её подмена требует FramePipeline::finish()
+struct FrameObject {
+    std::shared_ptr<const Mesh> mesh;
+    std::shared_ptr<const std::vector<MeshCluster>> clusters; // nullptr - сетка целиком
+    Material material;
+    Matrix4x4 model;
+    bool castsShadow = true;
+};
+
+// Всё, что нужно для растеризации кадра z-буфером, - копия на момент подготовки кадра
+struct FrameDescription {
+    std::vector<FrameObject> objects;
+    Matrix4x4 view, projection;
+    Light light;
+    std::vector<Light> localLights; // непусто - освещение по плиткам (Forward+)
+    bool shadows = false;
+    int geometryVersion = 0;        // для кэша карты теней
+    bool showDepth = false;         // вместо кадра - визуализация z-буфера
+    // Номера объектов, у которых с прошлого кадра сменилась только матрица, - всё
+    // остальное описание то же. Непусто - кадр можно дорисовать поверх прошлого
+    // только в экранных рамках этих объектов (старых и новых)
+    std::vector<int> movedObjects;
+};
+
+// Конвейер кадров z-буфера. Пока главный поток выгружает в текстуру и показывает
+// кадр N, кадр N + 1 растеризуется задачей планировщика во второй буфер кадра,
+// а главный поток тем временем обрабатывает ввод и готовит описание кадра N + 2.
+// Кадр появляется на экране на один кадр позже, зато время кадра определяется
+// самой долгой стадией, а не суммой стадий.
+//
+// Буфер команд, карта теней и сетка источников принадлежат конвейеру: в работе
+// всегда не больше одного кадра, поэтому они общие для обоих буферов.
+//
+// Если в кадре сдвинулись только отдельные объекты (movedObjects), буфер не
+// очищается целиком: перерисовываются плитки под старой и новой рамкой объекта,
+// и только объектами, задевающими эти плитки. Буфер хранит кадр двухкадровой
+// давности, поэтому к плиткам добавляются и плитки прошлого кадра. С тенями
+// и локальными источниками кадр всегда рисуется целиком: тень сдвинутого объекта
+// и списки источников плиток зависят от всего кадра
+class FramePipeline {
+public:
+    static const int dirtyTileSize = 16;
+
+    FramePipeline(int width, int height)
+        : width(width), height(height), slots{ Slot(width, height), Slot(width, height) },
+          shadowMap(512), lightGrid(width, height) {}
+
+    ~FramePipeline() { finish(); }
+
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+
+    // Запускает растеризацию кадра и возвращает последнее готовое изображение -
+    // предыдущего кадра. Если готового нет (первый кадр, после finish), кадр рисуется
+    // сразу и возвращается он сам. Изображение действительно до следующего advance
+    const sf::Image& advance(FrameDescription frame) {
+        if (inFlight) {
+            wait();
+            ready = rendering;
+        }
+        rendering = ready < 0 ? 0 : 1 - ready;
+        Slot& slot = slots[rendering];
+        slot.frame = std::move(frame);
+        inFlight = true;
+        // Только рабочим потокам: главный поток, ожидая что-то своё (parallelFor
+        // в обработке ввода), не должен растеризовать кадр у себя
+        JobSystem::instance().runOnWorker(group, "frame", [this, &slot] { render(slot); });
+        if (ready < 0) {
+            wait();
+            ready = rendering;
+        }
+        return slots[ready].image();
+    }
+
+    // Запущенный кадр, который ещё не возвращался: его покажет следующий advance или latest
+    bool hasPendingFrame() const { return inFlight; }
+
+    // Изображение последнего запущенного кадра без запуска нового - когда кадры
+    // рисуются по требованию и следующего может не быть
+    const sf::Image& latest() {
+        if (inFlight) {
+            wait();
+            ready = rendering;
+        }
+        return slots[ready < 0 ? rendering : ready].image();
+    }
+
+    // Дожидается кадра в работе и отбрасывает готовые изображения; после этого
+    // главный поток может менять данные, на которые кадр ссылается без владения
+    // (текстуры), и настройки буферов. Следующий advance рисует кадр сразу
+    void finish() {
+        wait();
+        ready = -1;
+    }
+
+    int getSampleCount() const { return slots[0].zbuffer.getSampleCount(); }
+
+    void setSampleCount(int count) {
+        finish();
+        for (Slot& slot : slots) {
+            slot.zbuffer.setSampleCount(count);
+            slot.content = -1;
+        }
+    }
+
+private:
+    struct Slot {
+        ZBuffer zbuffer;
+        FrameDescription frame;
+        sf::Image depthImage;
+        bool showDepth = false;
+        long long content = -1; // номер кадра в буфере, -1 - нет
+
+        Slot(int width, int height) : zbuffer(width, height) {}
+
+        const sf::Image& image() { return showDepth ? depthImage : zbuffer.getFrameBuffer(); }
+    };
+
+    int width, height;
+    Slot slots[2];
+    int rendering = 0;   // буфер последнего запущенного кадра
+    int ready = -1;      // буфер последнего готового кадра, -1 - нет
+    bool inFlight = false;
+    TaskGroup group;
+
+    // Карта теней перерисовывается, только когда сдвинулись источник или объекты;
+    // geometryVersion меняется при смене модели и при анимации вершин
+    ShadowMap shadowMap;
+    LightGrid lightGrid;
+    CommandBuffer commandBuffer;
+
+    // Для частичной перерисовки: номер последнего кадра, матрицы его объектов
+    // и изменённые им прямоугольники (если он отличался от своего предыдущего
+    // только сдвинутыми объектами)
+    long long frameCounter = 0;
+    std::vector<Matrix4x4> previousModels;
+    std::vector<ScreenRect> previousRects;
+    bool previousPatchable = false;
+    // Рамки сеток в координатах модели; сетки удерживаются только, пока идут
+    // частичные кадры
+    struct MeshBounds {
+        std::shared_ptr<const Mesh> mesh;
+        Point3D min, max;
+    };
+    std::vector<MeshBounds> boundsCache;
+
+    // Ожидающий поток помогает планировщику с задачами, которые порождает кадр
+    void wait() {
+        inFlight = false;
+        JobSystem::instance().wait(group);
+    }
+
+    const MeshBounds& boundsOf(const std::shared_ptr<const Mesh>& mesh) {
+        for (const MeshBounds& bounds : boundsCache) {
+            if (bounds.mesh == mesh) return bounds;
+        }
+        MeshBounds bounds;
+        bounds.mesh = mesh;
+        if (mesh->vertexCount() > 0) bounds.min = bounds.max = mesh->positions[0];
+        for (const Point3D& p : mesh->positions) {
+            bounds.min = Point3D(std::min(bounds.min.x, p.x), std::min(bounds.min.y, p.y), std::min(bounds.min.z, p.z));
+            bounds.max = Point3D(std::max(bounds.max.x, p.x), std::max(bounds.max.y, p.y), std::max(bounds.max.z, p.z));
+        }
+        boundsCache.push_back(bounds);
+        return boundsCache.back();
+    }
+
+    // Плитки экрана под сеткой: углы её рамки проецируются так же, как вершины
+    // в ZBuffer, с пикселем запаса на округление. Угол за камерой - весь экран
+    ScreenRect screenTiles(const std::shared_ptr<const Mesh>& mesh, const Matrix4x4& model,
+                           const Matrix4x4& viewProjection) {
+        const MeshBounds& bounds = boundsOf(mesh);
+        Matrix4x4 mvp = viewProjection * model;
+        double minX = 0, maxX = 0, minY = 0, maxY = 0;
+        for (int corner = 0; corner < 8; corner++) {
+            Point3D p((corner & 1) ? bounds.max.x : bounds.min.x, (corner & 2) ? bounds.max.y : bounds.min.y,
+                      (corner & 4) ? bounds.max.z : bounds.min.z);
+            double w = mvp.m[3][0] * p.x + mvp.m[3][1] * p.y + mvp.m[3][2] * p.z + mvp.m[3][3];
+            if (w <= 1e-9) return { 0, 0, width, height };
+            Point3D v = mvp.transform(p);
+            double x = (v.x + 1.0) * width / 2.0, y = (-v.y + 1.0) * height / 2.0;
+            minX = corner == 0 ? x : std::min(minX, x);
+            maxX = corner == 0 ? x : std::max(maxX, x);
+            minY = corner == 0 ? y : std::min(minY, y);
+            maxY = corner == 0 ? y : std::max(maxY, y);
+        }
+        // Ограничение до перевода в int: точка у плоскости камеры уходит очень далеко
+        auto clampX = [&](double x) { return (int)std::max(-1.0, std::min((double)width + 1, std::floor(x))); };
+        auto clampY = [&](double y) { return (int)std::max(-1.0, std::min((double)height + 1, std::floor(y))); };
+        ScreenRect rect = ScreenRect{ clampX(minX) - 1, clampY(minY) - 1, clampX(maxX) + 2, clampY(maxY) + 2 }
+                              .clipped(width, height);
+        if (rect.empty()) return rect;
+        rect.x0 = rect.x0 / dirtyTileSize * dirtyTileSize;
+        rect.y0 = rect.y0 / dirtyTileSize * dirtyTileSize;
+        rect.x1 = (rect.x1 + dirtyTileSize - 1) / dirtyTileSize * dirtyTileSize;
+        rect.y1 = (rect.y1 + dirtyTileSize - 1) / dirtyTileSize * dirtyTileSize;
+        return rect.clipped(width, height);
+    }
+
+    // Прямоугольники, в которых кадр отличается от предыдущего; false - кадр
+    // нельзя получить из предыдущего частичной перерисовкой
+    bool changedRects(const FrameDescription& frame, std::vector<ScreenRect>& rects) {
+        rects.clear();
+        if (frame.movedObjects.empty() || frame.shadows || !frame.localLights.empty() || frame.showDepth ||
+            frame.objects.size() != previousModels.size()) {
+            return false;
+        }
+        Matrix4x4 viewProjection = frame.projection * frame.view;
+        for (int i : frame.movedObjects) {
+            if (i < 0 || i >= (int)frame.objects.size()) return false;
+            const FrameObject& object = frame.objects[i];
+            rects.push_back(screenTiles(object.mesh, previousModels[i], viewProjection));
+            rects.push_back(screenTiles(object.mesh, object.model, viewProjection));
+        }
+        return true;
+    }
+
+    // Выполняется задачей планировщика; сведение HDR в RGBA8 - тоже здесь
+    void render(Slot& slot) {
+        const FrameDescription& frame = slot.frame;
+        ZBuffer& zbuffer = slot.zbuffer;
+        long long index = ++frameCounter;
+
+        // Буфер хранит кадр index - 1 или index - 2; во втором случае нужны и плитки,
+        // изменённые кадром index - 1
+        std::vector<ScreenRect> changed;
+        bool patchable = changedRects(frame, changed);
+        std::vector<ScreenRect> rects = changed;
+        bool partial = patchable && (slot.content == index - 1 || (slot.content == index - 2 && previousPatchable));
+        if (partial && slot.content == index - 2) rects.insert(rects.end(), previousRects.begin(), previousRects.end());
+        long long dirtyArea = 0;
+        for (const ScreenRect& rect : rects) dirtyArea += rect.area();
+        partial = partial && dirtyArea * 2 < (long long)width * height;
+
+        previousRects = std::move(changed);
+        previousPatchable = patchable;
+        previousModels.clear();
+        for (const FrameObject& object : frame.objects) previousModels.push_back(object.model);
+        if (!patchable) boundsCache.clear();
+        slot.content = index;
+
+        if (partial) {
+            renderTiles(zbuffer, frame, rects);
+        } else {
+            renderFull(zbuffer, frame);
+        }
+
+        slot.showDepth = frame.showDepth;
+        if (slot.showDepth) {
+            slot.depthImage = zbuffer.getZBufferVisualization();
+        } else {
+            zbuffer.getFrameBuffer();
+        }
+
+        // Сетки кадра больше не нужны: главный поток может снова писать в них на месте
+        // (анимация, уточнение кластеров), если других владельцев не осталось
+        commandBuffer.reset();
+        zbuffer.setLightGrid(nullptr);
+        slot.frame = FrameDescription();
+    }
+
+    // Частичная перерисовка: сначала очищаются все прямоугольники, затем каждый
+    // дорисовывается объектами, рамка которых его задевает. Пиксели на пересечении
+    // прямоугольников рисуются дважды с той же глубиной - второй раз тест не проходит
+    void renderTiles(ZBuffer& zbuffer, const FrameDescription& frame, const std::vector<ScreenRect>& rects) {
+        for (const ScreenRect& rect : rects) zbuffer.clearRect(rect);
+        zbuffer.setShadowMap(nullptr);
+        zbuffer.setLightGrid(nullptr);
+
+        Matrix4x4 viewProjection = frame.projection * frame.view;
+        std::vector<ScreenRect> objectTiles;
+        for (const FrameObject& object : frame.objects) {
+            objectTiles.push_back(screenTiles(object.mesh, object.model, viewProjection));
+        }
+        for (const ScreenRect& rect : rects) {
+            if (rect.empty()) continue;
+            zbuffer.setClipRect(rect);
+            commandBuffer.reset();
+            for (size_t i = 0; i < frame.objects.size(); i++) {
+                if (!objectTiles[i].intersects(rect)) continue;
+                const FrameObject& object = frame.objects[i];
+                commandBuffer.drawMesh(*object.mesh, object.material, object.model, object.clusters.get());
+            }
+            commandBuffer.execute(zbuffer, frame.view, frame.projection, frame.light);
+        }
+        zbuffer.resetClipRect();
+    }
+
+    void renderFull(ZBuffer& zbuffer, const FrameDescription& frame) {
+        zbuffer.clear();
+
+        if (frame.shadows) {
+            std::vector<ShadowCaster> casters;
+            for (const FrameObject& object : frame.objects) {
+                if (object.castsShadow) casters.push_back({ object.mesh.get(), object.model });
+            }
+            shadowMap.update(frame.light.position, casters, frame.geometryVersion);
+        }
+        zbuffer.setShadowMap(frame.shadows ? &shadowMap : nullptr);
+
+        // Кадр сначала записывается в буфер команд, затем отрисовывается отсортированным
+        // по состоянию и глубине
+        commandBuffer.reset();
+        for (const FrameObject& object : frame.objects) {
+            commandBuffer.drawMesh(*object.mesh, object.material, object.model, object.clusters.get());
+        }
+
+        // Forward+: сначала только глубина, по ней - списки источников для плиток экрана,
+        // затем освещение только видимых пикселей и только источниками их плитки
+        bool tiledLighting = !frame.localLights.empty();
+        if (tiledLighting) {
+            commandBuffer.executeDepth(zbuffer, frame.view, frame.projection);
+            zbuffer.finishDepthPrepass();
+            lightGrid.build(zbuffer.getDepthBuffer(), zbuffer.getSampleCount(), frame.localLights,
+                            frame.view, frame.projection);
+        }
+        zbuffer.setLightGrid(tiledLighting ? &lightGrid : nullptr);
+
+        commandBuffer.execute(zbuffer, frame.view, frame.projection, frame.light);
+    }
+};
+
+#endif
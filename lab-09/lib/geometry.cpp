@@ -1,9 +1,20 @@
 #include "geometry.h"
+#include <unordered_map>
+#include <functional>
 
 void Polygon::transform(const Matrix4x4& matrix) {
+    transform(matrix, normals.empty() ? matrix : matrix.normalMatrix());
+}
+
+void Polygon::transform(const Matrix4x4& matrix, const Matrix4x4& normalMatrix) {
     for (auto& point : points) {
         point = matrix.transform(point);
     }
+    // Нормали - направления (w = 0): обратная транспонированная матрица сохраняет
+    // их перпендикулярными граням и при неравномерном масштабе
+    for (auto& normal : normals) {
+        normal = normalMatrix.transform(Point3D(normal.x, normal.y, normal.z, 0)).normalize();
+    }
     // Текстурные координаты не трансформируются
 }
 
@@ -15,8 +26,9 @@ Point3D Polygon::getNormal() const {
 }
 
 void Polyhedron::transform(const Matrix4x4& matrix) {
+    Matrix4x4 normalMatrix = matrix.normalMatrix();
     for (auto& polygon : polygons) {
-        polygon.transform(matrix);
+        polygon.transform(matrix, normalMatrix);
     }
 }
 
@@ -35,6 +47,14 @@ Point3D Polyhedron::getCenter() const {
     return center;
 }
 
+bool Polyhedron::hasVertexNormals() const {
+    if (polygons.empty()) return false;
+    for (const auto& polygon : polygons) {
+        if (!polygon.hasVertexNormals()) return false;
+    }
+    return true;
+}
+
 std::map<Point3D, Point3D> calculateSmoothNormals(const Polyhedron& poly) {
     std::map<Point3D, Point3D> normalsMap;
     
@@ -50,4 +70,129 @@ std::map<Point3D, Point3D> calculateSmoothNormals(const Polyhedron& poly) {
     }
     
     return normalsMap;
-}
\ No newline at end of file
+}
+
+void Mesh::addFace(std::initializer_list<int> face) {
+    indices.insert(indices.end(), face.begin(), face.end());
+    faceOffsets.push_back((int)indices.size());
+}
+
+void Mesh::transform(const Matrix4x4& matrix) {
+    for (auto& position : positions) {
+        position = matrix.transform(position);
+    }
+    if (normals.empty()) return;
+    Matrix4x4 normalMatrix = matrix.normalMatrix();
+    for (auto& normal : normals) {
+        normal = normalMatrix.transform(Point3D(normal.x, normal.y, normal.z, 0)).normalize();
+    }
+}
+
+Point3D Mesh::getCenter() const {
+    Point3D center;
+    for (const auto& position : positions) {
+        center = center + position;
+    }
+    if (!positions.empty()) {
+        center = center * (1.0 / positions.size());
+    }
+    return center;
+}
+
+Point3D Mesh::getFaceNormal(int face) const {
+    if (faceSize(face) < 3) return Point3D(0, 0, 0, 0);
+    const int* f = faceIndices(face);
+    Point3D a = positions[f[1]] - positions[f[0]];
+    Point3D b = positions[f[2]] - positions[f[0]];
+    return a.cross(b).normalize();
+}
+
+Polyhedron Mesh::toPolyhedron() const {
+    std::vector<Polygon> polygons;
+    polygons.reserve(faceCount());
+    for (int f = 0; f < faceCount(); f++) {
+        Polygon polygon;
+        const int* face = faceIndices(f);
+        for (int i = 0; i < faceSize(f); i++) {
+            polygon.points.push_back(positions[face[i]]);
+            if (hasTexCoords()) polygon.texCoords.push_back(texCoords[face[i]]);
+            if (hasNormals()) polygon.normals.push_back(normals[face[i]]);
+        }
+        polygons.push_back(polygon);
+    }
+    return Polyhedron(polygons);
+}
+
+namespace {
+
+struct CornerKey {
+    Point3D position, texCoord, normal;
+};
+
+struct CornerHash {
+    size_t operator()(const CornerKey& key) const {
+        PointHash h;
+        return h(key.position) ^ (h(key.texCoord) * 31) ^ (h(key.normal) * 131);
+    }
+};
+
+struct CornerEqual {
+    bool operator()(const CornerKey& a, const CornerKey& b) const {
+        PointEqual eq;
+        return eq(a.position, b.position) && eq(a.texCoord, b.texCoord) && eq(a.normal, b.normal);
+    }
+};
+
+}
+
+Mesh Mesh::fromPolyhedron(const Polyhedron& poly) {
+    Mesh mesh;
+    bool withTexCoords = !poly.polygons.empty();
+    bool withNormals = poly.hasVertexNormals();
+    for (const auto& polygon : poly.polygons) {
+        if (polygon.texCoords.size() != polygon.points.size()) withTexCoords = false;
+    }
+
+    std::unordered_map<CornerKey, int, CornerHash, CornerEqual> corners;
+    for (const auto& polygon : poly.polygons) {
+        for (size_t i = 0; i < polygon.points.size(); i++) {
+            CornerKey key{polygon.points[i],
+                          withTexCoords ? polygon.texCoords[i] : Point3D(),
+                          withNormals ? polygon.normals[i] : Point3D()};
+            auto it = corners.find(key);
+            if (it == corners.end()) {
+                it = corners.emplace(key, mesh.vertexCount()).first;
+                mesh.positions.push_back(key.position);
+                if (withTexCoords) mesh.texCoords.push_back(key.texCoord);
+                if (withNormals) mesh.normals.push_back(key.normal);
+            }
+            mesh.indices.push_back(it->second);
+        }
+        mesh.faceOffsets.push_back((int)mesh.indices.size());
+    }
+    return mesh;
+}
+
+void computeSmoothNormals(Mesh& mesh) {
+    // Вершины с одинаковыми координатами (например, на шве текстуры) получают общую нормаль
+    std::unordered_map<Point3D, int, PointHash, PointEqual> groups;
+    std::vector<int> groupOf(mesh.vertexCount());
+    for (int v = 0; v < mesh.vertexCount(); v++) {
+        groupOf[v] = groups.emplace(mesh.positions[v], (int)groups.size()).first->second;
+    }
+
+    std::vector<Point3D> sums(groups.size(), Point3D(0, 0, 0, 0));
+    for (int f = 0; f < mesh.faceCount(); f++) {
+        Point3D faceNormal = mesh.getFaceNormal(f);
+        const int* face = mesh.faceIndices(f);
+        for (int i = 0; i < mesh.faceSize(f); i++) {
+            Point3D& sum = sums[groupOf[face[i]]];
+            sum = sum + faceNormal;
+        }
+    }
+
+    mesh.normals.resize(mesh.vertexCount());
+    for (int v = 0; v < mesh.vertexCount(); v++) {
+        mesh.normals[v] = sums[groupOf[v]].normalize();
+    }
+}
@@ -2,21 +2,30 @@
 #define GEOMETRY_H
 
 #include "math_3d.h"
+#include "texture_cache.h"
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <initializer_list>
+#include <functional>
 #include <SFML/Graphics.hpp>
 
 class Polygon {
 public:
     std::vector<Point3D> points;
     std::vector<Point3D> texCoords; // Текстурные координаты
+    std::vector<Point3D> normals;   // Нормали вершин (vn из obj-файла), если заданы
     
     Polygon(const std::vector<Point3D>& points = {}, 
-            const std::vector<Point3D>& texCoords = {}) 
-        : points(points), texCoords(texCoords) {}
+            const std::vector<Point3D>& texCoords = {},
+            const std::vector<Point3D>& normals = {}) 
+        : points(points), texCoords(texCoords), normals(normals) {}
 
     void transform(const Matrix4x4& matrix);
+    // normalMatrix - matrix.normalMatrix(), если он уже посчитан для многих полигонов
+    void transform(const Matrix4x4& matrix, const Matrix4x4& normalMatrix);
     Point3D getNormal() const;
+    bool hasVertexNormals() const { return !points.empty() && normals.size() == points.size(); }
 };
 
 class Polyhedron {
@@ -27,46 +36,145 @@ public:
     
     void transform(const Matrix4x4& matrix);
     Point3D getCenter() const;
+    bool hasVertexNormals() const;
+};
+
+// Хэш точной битовой записи координат (-0.0 и 0.0 считаются одной точкой)
+struct PointHash {
+    static size_t mix(size_t seed, double value) {
+        if (value == 0.0) value = 0.0;
+        return seed ^ (std::hash<double>()(value) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+    }
+    size_t operator()(const Point3D& p) const {
+        return mix(mix(mix(0, p.x), p.y), p.z);
+    }
+};
+
+struct PointEqual {
+    bool operator()(const Point3D& a, const Point3D& b) const {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+};
+
+// Индексированная сетка: каждая вершина хранится один раз, грани ссылаются на неё по индексу.
+// Грани - произвольные многоугольники: вершины грани f лежат в
+// indices[faceOffsets[f]] .. indices[faceOffsets[f + 1] - 1]
+class Mesh {
+public:
+    std::vector<Point3D> positions;
+    std::vector<Point3D> normals;   // по одной на вершину или пусто
+    std::vector<Point3D> texCoords; // по одной на вершину или пусто
+    std::vector<int> indices;
+    std::vector<int> faceOffsets;   // faceCount() + 1 элементов, первый всегда 0
+
+    Mesh() : faceOffsets(1, 0) {}
+
+    int vertexCount() const { return (int)positions.size(); }
+    int faceCount() const { return (int)faceOffsets.size() - 1; }
+    int faceSize(int face) const { return faceOffsets[face + 1] - faceOffsets[face]; }
+    const int* faceIndices(int face) const { return indices.data() + faceOffsets[face]; }
+    bool hasNormals() const { return !positions.empty() && normals.size() == positions.size(); }
+    bool hasTexCoords() const { return !positions.empty() && texCoords.size() == positions.size(); }
+
+    void addFace(std::initializer_list<int> face);
+    void transform(const Matrix4x4& matrix);
+    Point3D getCenter() const;
+    Point3D getFaceNormal(int face) const;
+
+    Polyhedron toPolyhedron() const;
+    // Склеивает вершины многоугольников с совпадающими координатами, текстурными координатами и нормалями
+    static Mesh fromPolyhedron(const Polyhedron& poly);
 };
 
 struct Light {
+    enum Type { POINT, SPOT };
+
     Point3D position;
     sf::Color color;
     float intensity; // 0.0 - 1.0
+    Type type = POINT;
+    float range = 0; // радиус действия; 0 - без ограничения (основной источник)
+    // Прожектор: ось конуса и косинусы внешнего и внутреннего углов
+    Point3D direction = Point3D(0, -1, 0, 0);
+    float cosOuter = 0.8f, cosInner = 0.9f;
 };
 
+// Текстура для программного растеризатора.
+// Пиксели и mip-уровни берутся из дискового кэша (см. texture_cache.h), jpg декодируется
+// только при первом запуске или после изменения исходного файла
 struct Texture {
-    sf::Image image;
+    CachedTexture data;
     int width, height;
     
     Texture() : width(0), height(0) {}
     
     bool loadFromFile(const std::string& filename) {
-        if (image.loadFromFile(filename)) {
-            width = image.getSize().x;
-            height = image.getSize().y;
+        if (data.load(filename)) {
+            width = data.width();
+            height = data.height();
             return true;
         }
         return false;
     }
+
+    int levelCount() const { return data.levelCount(); }
     
-    sf::Color getColor(float u, float v) const {
+    // level - номер mip-уровня (0 - исходное разрешение)
+    sf::Color getColor(float u, float v, int level = 0) const {
         if (width == 0 || height == 0) return sf::Color::White;
         
         u = u - floor(u);
         v = v - floor(v);
         if (u < 0) u += 1.0f;
         if (v < 0) v += 1.0f;
+
+        level = std::max(0, std::min(level, data.levelCount() - 1));
+        int w = data.width(level);
+        int h = data.height(level);
         
-        int x = (int)(u * width) % width;
-        int y = (int)(v * height) % height;
+        int x = (int)(u * w) % w;
+        int y = (int)(v * h) % h;
         
-        return image.getPixel(x, y);
+        // В кэше строки идут снизу вверх, а v = 0 соответствует верхней строке изображения
+        const sf::Uint8* texel = data.levelData(level) + ((size_t)(h - 1 - y) * w + x) * 4;
+        return sf::Color(texel[0], texel[1], texel[2], texel[3]);
+    }
+};
+
+// Материал объекта для программного растеризатора: способ закраски и его параметры
+struct Material {
+    enum Shading { FLAT, GOURAUD, PHONG_TOON, TEXTURED };
+
+    Shading shading = FLAT;
+    std::vector<sf::Color> palette;   // цвет грани - palette[face % size], пусто - белый
+    const Texture* texture = nullptr; // для TEXTURED
+    bool backfaceCulling = true;      // освещённые режимы отсекают нелицевые грани всегда
+
+    // Режим, который сетка действительно поддерживает: без нормалей нет освещения,
+    // без текстурных координат - текстуры, остаётся заливка цветом грани
+    Shading shadingFor(const Mesh& mesh) const {
+        if ((shading == GOURAUD || shading == PHONG_TOON) && !mesh.hasNormals()) return FLAT;
+        if (shading == TEXTURED && !mesh.hasTexCoords()) return FLAT;
+        return shading;
+    }
+
+    bool cullsBackFaces(const Mesh& mesh) const {
+        Shading actual = shadingFor(mesh);
+        return actual == GOURAUD || actual == PHONG_TOON || backfaceCulling;
+    }
+
+    sf::Color faceColor(int face) const {
+        return palette.empty() ? sf::Color::White : palette[face % palette.size()];
     }
 };
 
 // Функция для сглаживания нормалей (для Гуро и Фонга)
-// Возвращает мапу [Вершина] -> Усредненная нормаль
+// Возвращает мапу [Вершина] -> Усредненная нормаль.
+// Нужна только для моделей без собственных нормалей (см. Polyhedron::hasVertexNormals)
 std::map<Point3D, Point3D> calculateSmoothNormals(const Polyhedron& poly);
 
+// То же для индексированной сетки: нормали граней усредняются по вершинам с одинаковыми
+// координатами (за один линейный проход, без сравнения точек через std::map)
+void computeSmoothNormals(Mesh& mesh);
+
 #endif
\ No newline at end of file
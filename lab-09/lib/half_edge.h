@@ -0,0 +1,114 @@
+#ifndef HALF_EDGE_H
+#define HALF_EDGE_H
+
+#include "geometry.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Полурёберная структура поверх индексированной сетки Mesh. Строится за один линейный
+// проход и дальше отвечает на запросы соседства за O(1).
+//
+// Номер полуребра совпадает с номером угла грани в mesh.indices: полуребро h выходит
+// из вершины indices[h] и идёт к следующей вершине той же грани. Вершины сетки с
+// одинаковыми координатами (швы текстуры, разные нормали) объединяются в одну точку,
+// поэтому через шов рёбра тоже склеиваются со своими парами.
+class HalfEdgeMesh {
+public:
+    HalfEdgeMesh() = default;
+
+    explicit HalfEdgeMesh(const Mesh& mesh)
+        : origins(mesh.indices), offsets(mesh.faceOffsets),
+          faces(mesh.indices.size()), twins(mesh.indices.size(), -1), pointOf(mesh.vertexCount()) {
+        std::unordered_map<Point3D, int, PointHash, PointEqual> points;
+        for (int v = 0; v < mesh.vertexCount(); v++) {
+            pointOf[v] = points.emplace(mesh.positions[v], (int)points.size()).first->second;
+        }
+        pointEdges.assign(points.size(), -1);
+
+        for (int f = 0; f < mesh.faceCount(); f++) {
+            for (int h = offsets[f]; h < offsets[f + 1]; h++) faces[h] = f;
+        }
+
+        // Ещё не нашедшие пару полурёбра по ключу (начало, конец); ребро, у которого
+        // больше двух граней или несогласована ориентация, остаётся граничным
+        std::unordered_map<uint64_t, int> open;
+        open.reserve(origins.size());
+        auto key = [](int a, int b) { return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b; };
+        for (int h = 0; h < halfEdgeCount(); h++) {
+            int a = point(origin(h)), b = point(target(h));
+            auto it = open.find(key(b, a));
+            if (it != open.end()) {
+                twins[h] = it->second;
+                twins[it->second] = h;
+                open.erase(it);
+            } else {
+                open.emplace(key(a, b), h);
+            }
+        }
+
+        // Для точки на краю запоминается граничное исходящее полуребро: обход веера
+        // от него проходит все грани вокруг точки
+        for (int h = 0; h < halfEdgeCount(); h++) {
+            int& edge = pointEdges[point(origin(h))];
+            if (edge < 0 || isBoundary(h)) edge = h;
+        }
+    }
+
+    int halfEdgeCount() const { return (int)origins.size(); }
+    int faceCount() const { return (int)offsets.size() - 1; }
+    int pointCount() const { return (int)pointEdges.size(); }
+
+    // Вершина сетки, из которой выходит полуребро, и вершина, в которую оно входит
+    int origin(int h) const { return origins[h]; }
+    int target(int h) const { return origins[next(h)]; }
+    // Точка (группа вершин с одинаковыми координатами) вершины сетки
+    int point(int vertex) const { return pointOf[vertex]; }
+
+    int face(int h) const { return faces[h]; }
+    int next(int h) const { return h + 1 == offsets[faces[h] + 1] ? offsets[faces[h]] : h + 1; }
+    int prev(int h) const { return h == offsets[faces[h]] ? offsets[faces[h] + 1] - 1 : h - 1; }
+    // Парное полуребро соседней грани или -1 на краю
+    int twin(int h) const { return twins[h]; }
+    bool isBoundary(int h) const { return twins[h] < 0; }
+
+    int faceHalfEdge(int f) const { return offsets[f]; }
+    int faceSize(int f) const { return offsets[f + 1] - offsets[f]; }
+    int pointHalfEdge(int p) const { return pointEdges[p]; }
+    bool isBoundaryPoint(int p) const { return pointEdges[p] >= 0 && isBoundary(pointEdges[p]); }
+
+    // Каждое ребро представлено ровно одним полуребром: граничным или большим из пары
+    bool isEdgeRepresentative(int h) const { return twins[h] < h; }
+
+    // Исходящие из точки полурёбра по кругу (для точки на краю - от граничного)
+    template <typename Visitor>
+    void forEachOutgoing(int p, Visitor&& visit) const {
+        int start = pointEdges[p];
+        if (start < 0) return;
+        int h = start;
+        for (int guard = 0; guard < halfEdgeCount(); guard++) {
+            visit(h);
+            int incoming = twins[prev(h)];
+            if (incoming < 0 || incoming == start) return;
+            h = incoming;
+        }
+    }
+
+    // Соседние через рёбра грани (на краю соседа нет и грань не посещается)
+    template <typename Visitor>
+    void forEachFaceNeighbour(int f, Visitor&& visit) const {
+        for (int h = offsets[f]; h < offsets[f + 1]; h++) {
+            if (twins[h] >= 0) visit(faces[twins[h]]);
+        }
+    }
+
+private:
+    std::vector<int> origins;
+    std::vector<int> offsets;
+    std::vector<int> faces;
+    std::vector<int> twins;
+    std::vector<int> pointOf;
+    std::vector<int> pointEdges;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef HDR_COLOR_H
+#define HDR_COLOR_H
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Линейный цвет кадра (HDR): каналы не ограничены сверху, поэтому вклады источников
+// и отсчёты MSAA просто складываются. Четвёртое поле дополняет пиксель до 16 байт -
+// он читается одной SIMD-загрузкой
+struct LinearColor {
+    float r, g, b, pad;
+
+    LinearColor(float r = 0, float g = 0, float b = 0) : r(r), g(g), b(b), pad(0) {}
+
+    LinearColor operator+(const LinearColor& other) const { return LinearColor(r + other.r, g + other.g, b + other.b); }
+    LinearColor operator*(float k) const { return LinearColor(r * k, g * k, b * k); }
+    LinearColor operator*(const LinearColor& other) const { return LinearColor(r * other.r, g * other.g, b * other.b); }
+};
+
+// Цвета материалов, текстур и источников заданы в sRGB - перевод в линейное пространство
+inline LinearColor toLinear(const sf::Color& color) {
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> t;
+        for (int i = 0; i < 256; i++) {
+            double c = i / 255.0;
+            t[i] = (float)(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+        }
+        return t;
+    }();
+    return LinearColor(table[color.r], table[color.g], table[color.b]);
+}
+
+// Сведение строки HDR в RGBA8: тональная компрессия и гамма-кодирование sRGB.
+// До колена (0.8) значения не меняются, выше плавно сжимаются к 1 - обычные цвета
+// остаются как были, пересветы не обрезаются ступенькой. Гамма - таблица на 4096 значений
+inline void tonemapRow(const LinearColor* in, int count, sf::Uint8* out) {
+    const int gammaSize = 4096;
+    static const std::array<sf::Uint8, gammaSize> gamma = [] {
+        std::array<sf::Uint8, gammaSize> t;
+        for (int i = 0; i < gammaSize; i++) {
+            double c = (i + 0.5) / gammaSize;
+            double s = c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055;
+            t[i] = (sf::Uint8)std::min(255.0, s * 255.0 + 0.5);
+        }
+        return t;
+    }();
+    const float knee = 0.8f, shoulder = 1.0f - knee;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    // Пиксель целиком в одном регистре: r, g, b и поле выравнивания
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 kneeV = _mm_set1_ps(knee);
+    const __m128 invShoulder = _mm_set1_ps(1.0f / shoulder);
+    const __m128 scale = _mm_set1_ps((float)gammaSize);
+    const __m128 almostOne = _mm_set1_ps(1.0f - 1.0f / gammaSize);
+    for (int i = 0; i < count; i++) {
+        __m128 c = _mm_max_ps(_mm_loadu_ps(&in[i].r), zero);
+        __m128 over = _mm_max_ps(_mm_sub_ps(c, kneeV), zero);
+        __m128 t = _mm_add_ps(_mm_min_ps(c, kneeV), _mm_div_ps(over, _mm_add_ps(one, _mm_mul_ps(over, invShoulder))));
+        // max с нулём заодно превращает NaN в 0
+        t = _mm_min_ps(_mm_max_ps(t, zero), almostOne);
+        __m128i index = _mm_cvttps_epi32(_mm_mul_ps(t, scale));
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128((__m128i*)lanes, index);
+        out[4 * i] = gamma[lanes[0]];
+        out[4 * i + 1] = gamma[lanes[1]];
+        out[4 * i + 2] = gamma[lanes[2]];
+        out[4 * i + 3] = 255;
+    }
+#else
+    auto encode = [&](float c) {
+        c = std::max(0.0f, c);
+        float over = std::max(0.0f, c - knee);
+        float t = std::min(c, knee) + over / (1.0f + over / shoulder);
+        return gamma[std::min(gammaSize - 1, (int)(t * gammaSize))];
+    };
+    for (int i = 0; i < count; i++) {
+        out[4 * i] = encode(in[i].r);
+        out[4 * i + 1] = encode(in[i].g);
+        out[4 * i + 2] = encode(in[i].b);
+        out[4 * i + 3] = 255;
+    }
+#endif
+}
+
+#endif
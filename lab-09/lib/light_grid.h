@@ -0,0 +1,177 @@
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Вклад локального источника (точечного или прожектора) в точке: затухание по
+// расстоянию, окно по радиусу действия и конус прожектора, умноженные на N*L.
+// Для источника без радиуса (range == 0) затухания нет
+inline float localLightFactor(const Light& light, const Point3D& worldPos, const Point3D& normal) {
+    Point3D toLight = light.position - worldPos;
+    double distance2 = toLight.dot(toLight);
+    double window = 1.0;
+    if (light.range > 0) {
+        double ratio2 = distance2 / ((double)light.range * light.range);
+        if (ratio2 >= 1.0) return 0.0f;
+        window = (1.0 - ratio2 * ratio2);
+        window *= window;
+    }
+    double distance = std::sqrt(distance2);
+    if (distance == 0) return 0.0f;
+    Point3D lightDir = toLight * (1.0 / distance);
+    double ndl = normal.dot(lightDir);
+    if (ndl <= 0) return 0.0f;
+
+    double factor = ndl * window * light.intensity;
+    if (light.range > 0) factor /= 1.0 + distance2;
+    if (light.type == Light::SPOT) {
+        double cosAngle = -lightDir.dot(light.direction);
+        if (cosAngle <= light.cosOuter) return 0.0f;
+        if (cosAngle < light.cosInner) {
+            double t = (cosAngle - light.cosOuter) / (light.cosInner - light.cosOuter);
+            factor *= t * t * (3.0 - 2.0 * t);
+        }
+    }
+    return (float)factor;
+}
+
+// Плиточное отсечение источников (Forward+). После предварительного прохода по
+// глубине для каждой плитки экрана известен диапазон глубин видимых поверхностей.
+// Источник попадает в список плитки, если его сфера действия пересекает прямоугольник
+// плитки на экране и её диапазон глубин. Пиксель перебирает только источники своей
+// плитки, поэтому стоимость не растёт линейно с их общим числом.
+class LightGrid {
+public:
+    static const int tileSize = 16;
+
+    LightGrid(int width, int height)
+        : width(width), height(height),
+          tilesX((width + tileSize - 1) / tileSize), tilesY((height + tileSize - 1) / tileSize) {}
+
+    // depth - буфер глубины NDC (std::numeric_limits<float>::max() - пусто) после предварительного
+    // прохода, samples значений на пиксель
+    void build(const std::vector<float>& depth, int samples, const std::vector<Light>& sceneLights,
+               const Matrix4x4& view, const Matrix4x4& projection) {
+        lights = &sceneLights;
+        int tileCount = tilesX * tilesY;
+
+        // Диапазон глубин каждой плитки
+        std::vector<float> tileMin(tileCount, std::numeric_limits<float>::max());
+        std::vector<float> tileMax(tileCount, -std::numeric_limits<float>::max());
+        for (int y = 0; y < height; y++) {
+            const float* row = depth.data() + (size_t)y * width * samples;
+            int tileRow = (y / tileSize) * tilesX;
+            for (int i = 0; i < width * samples; i++) {
+                if (row[i] == std::numeric_limits<float>::max()) continue;
+                int tile = tileRow + i / samples / tileSize;
+                tileMin[tile] = std::min(tileMin[tile], row[i]);
+                tileMax[tile] = std::max(tileMax[tile], row[i]);
+            }
+        }
+
+        // Прямоугольник плиток и диапазон глубин каждого источника
+        struct Bounds { int x0, y0, x1, y1; double zMin, zMax; };
+        std::vector<Bounds> bounds;
+        std::vector<int> boundLight;
+        for (int i = 0; i < (int)sceneLights.size(); i++) {
+            Bounds b;
+            if (screenBounds(sceneLights[i], view, projection, b.x0, b.y0, b.x1, b.y1, b.zMin, b.zMax)) {
+                bounds.push_back(b);
+                boundLight.push_back(i);
+            }
+        }
+
+        // Списки в сжатом виде: сначала подсчёт, затем заполнение
+        tileOffsets.assign(tileCount + 1, 0);
+        auto overlaps = [&](const Bounds& b, int tile) {
+            return tileMin[tile] <= tileMax[tile] && b.zMin <= tileMax[tile] && b.zMax >= tileMin[tile];
+        };
+        for (const Bounds& b : bounds) {
+            for (int ty = b.y0; ty <= b.y1; ty++) {
+                for (int tx = b.x0; tx <= b.x1; tx++) {
+                    if (overlaps(b, ty * tilesX + tx)) tileOffsets[ty * tilesX + tx + 1]++;
+                }
+            }
+        }
+        for (int t = 0; t < tileCount; t++) tileOffsets[t + 1] += tileOffsets[t];
+        tileLights.resize(tileOffsets[tileCount]);
+        std::vector<int> fill(tileOffsets.begin(), tileOffsets.end() - 1);
+        for (size_t i = 0; i < bounds.size(); i++) {
+            const Bounds& b = bounds[i];
+            for (int ty = b.y0; ty <= b.y1; ty++) {
+                for (int tx = b.x0; tx <= b.x1; tx++) {
+                    int tile = ty * tilesX + tx;
+                    if (overlaps(b, tile)) tileLights[fill[tile]++] = boundLight[i];
+                }
+            }
+        }
+    }
+
+    // Обход источников плитки, в которую попадает пиксель (x, y)
+    template <typename Visitor>
+    void forEachLight(int x, int y, Visitor&& visit) const {
+        int tile = (y / tileSize) * tilesX + x / tileSize;
+        for (int i = tileOffsets[tile]; i < tileOffsets[tile + 1]; i++) visit((*lights)[tileLights[i]]);
+    }
+
+    // Среднее число источников на плитку - для вывода статистики
+    double averageLightsPerTile() const {
+        return tileOffsets.empty() ? 0.0 : (double)tileLights.size() / (tileOffsets.size() - 1);
+    }
+
+private:
+    int width, height;
+    int tilesX, tilesY;
+    const std::vector<Light>* lights = nullptr;
+    std::vector<int> tileOffsets;
+    std::vector<int> tileLights;
+
+    // Проекция ограничивающего куба сферы действия: прямоугольник плиток и глубины NDC.
+    // Если куб пересекает плоскость камеры, прямоугольник - весь экран.
+    // false - источник целиком за камерой
+    bool screenBounds(const Light& light, const Matrix4x4& view, const Matrix4x4& projection,
+                      int& x0, int& y0, int& x1, int& y1, double& zMin, double& zMax) const {
+        Point3D center = view.transform(light.position);
+        double r = light.range;
+        const double (*p)[4] = projection.m;
+        auto clipW = [&](double z) { return p[3][2] * z + p[3][3]; };
+        auto ndcZ = [&](double z) { return (p[2][2] * z + p[2][3]) / clipW(z); };
+
+        // Камера смотрит вдоль -z: ближняя к ней сторона сферы - center.z + r
+        if (clipW(center.z - r) <= 1e-6) return false;
+        bool crossesCamera = clipW(center.z + r) <= 1e-6;
+        zMin = crossesCamera ? -std::numeric_limits<double>::max() : ndcZ(center.z + r);
+        zMax = ndcZ(center.z - r);
+        if (zMin > zMax) std::swap(zMin, zMax);
+
+        if (crossesCamera) {
+            x0 = 0; y0 = 0; x1 = tilesX - 1; y1 = tilesY - 1;
+            return true;
+        }
+        double minX = std::numeric_limits<double>::max(), maxX = -minX;
+        double minY = minX, maxY = -minX;
+        for (int corner = 0; corner < 8; corner++) {
+            double x = center.x + ((corner & 1) ? r : -r);
+            double y = center.y + ((corner & 2) ? r : -r);
+            double z = center.z + ((corner & 4) ? r : -r);
+            double w = clipW(z);
+            double sx = ((p[0][0] * x + p[0][1] * y + p[0][2] * z + p[0][3]) / w + 1.0) * width / 2.0;
+            double sy = (-(p[1][0] * x + p[1][1] * y + p[1][2] * z + p[1][3]) / w + 1.0) * height / 2.0;
+            minX = std::min(minX, sx); maxX = std::max(maxX, sx);
+            minY = std::min(minY, sy); maxY = std::max(maxY, sy);
+        }
+        if (maxX < 0 || maxY < 0 || minX >= width || minY >= height) return false;
+        x0 = std::max(0, (int)minX / tileSize);
+        y0 = std::max(0, (int)minY / tileSize);
+        x1 = std::min(tilesX - 1, (int)maxX / tileSize);
+        y1 = std::min(tilesY - 1, (int)maxY / tileSize);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef MARCHING_CUBES_H
+#define MARCHING_CUBES_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include "parallel.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Неявные поверхности field(x, y, z) = isoLevel методом marching cubes.
+//
+// Углы куба нумеруются битами (x - бит 0, y - бит 1, z - бит 2), рёбра - по
+// оси (0..3 вдоль X, 4..7 вдоль Y, 8..11 вдоль Z). Таблица треугольников не
+// набирается вручную, а строится при первом вызове обходом граней куба: на каждой
+// грани отрезки отсекают непрерывные цепочки внутренних углов (при неоднозначной
+// грани внутренние углы разделяются), отрезки соседних граней сцепляются по общим
+// рёбрам в замкнутые контуры, контуры разбиваются веером. Правило одно для обеих
+// сторон грани, поэтому соседние кубы стыкуются без дыр.
+
+struct MarchingCubesTable {
+    // Ребро: начальный угол и ось
+    int edgeCorner[12];
+    int edgeAxis[12];
+    // Треугольники случая: до 12 треугольников по 3 ребра, -1 - конец списка
+    std::array<std::array<int8_t, 37>, 256> triangles;
+
+    static const MarchingCubesTable& instance() {
+        static const MarchingCubesTable table;
+        return table;
+    }
+
+private:
+    MarchingCubesTable() {
+        for (int axis = 0; axis < 3; axis++) {
+            int other1 = (axis + 1) % 3, other2 = (axis + 2) % 3;
+            for (int k = 0; k < 4; k++) {
+                int e = axis * 4 + k;
+                edgeCorner[e] = ((k & 1) << other1) | ((k >> 1) << other2);
+                edgeAxis[e] = axis;
+            }
+        }
+
+        // Грани в порядке обхода против часовой стрелки при взгляде снаружи куба
+        const int faces[6][4] = {
+            {0, 4, 6, 2}, {1, 3, 7, 5},   // x = 0, x = 1
+            {0, 1, 5, 4}, {2, 6, 7, 3},   // y = 0, y = 1
+            {0, 2, 3, 1}, {4, 5, 7, 6}    // z = 0, z = 1
+        };
+
+        for (int config = 0; config < 256; config++) {
+            auto inside = [&](int corner) { return (config >> corner) & 1; };
+            int next[12];
+            std::fill(next, next + 12, -1);
+
+            for (const auto& face : faces) {
+                int crossing[4];
+                for (int k = 0; k < 4; k++) {
+                    crossing[k] = edgeBetween(face[k], face[(k + 1) % 4]);
+                }
+                // Цепочка внутренних углов начинается после ребра входа (снаружи -> внутрь)
+                // и заканчивается ребром выхода; отрезок идёт от входа к выходу
+                for (int k = 0; k < 4; k++) {
+                    int from = face[k], to = face[(k + 1) % 4];
+                    if (inside(from) || !inside(to)) continue;
+                    int entry = crossing[k];
+                    int j = (k + 1) % 4;
+                    while (inside(face[(j + 1) % 4])) j = (j + 1) % 4;
+                    int exit = crossing[j];
+                    next[entry] = exit;
+                }
+            }
+
+            int count = 0;
+            bool used[12] = {};
+            for (int start = 0; start < 12; start++) {
+                if (next[start] < 0 || used[start]) continue;
+                std::vector<int> loop;
+                for (int e = start; !used[e]; e = next[e]) {
+                    used[e] = true;
+                    loop.push_back(e);
+                }
+                for (size_t i = 1; i + 1 < loop.size(); i++) {
+                    triangles[config][count++] = (int8_t)loop[0];
+                    triangles[config][count++] = (int8_t)loop[i];
+                    triangles[config][count++] = (int8_t)loop[i + 1];
+                }
+            }
+            for (int i = count; i < 37; i++) triangles[config][i] = -1;
+        }
+    }
+
+    int edgeBetween(int a, int b) const {
+        int corner = std::min(a, b);
+        int axis = (a ^ b) == 1 ? 0 : (a ^ b) == 2 ? 1 : 2;
+        for (int e = axis * 4; e < axis * 4 + 4; e++) {
+            if (edgeCorner[e] == corner) return e;
+        }
+        return -1;
+    }
+};
+
+// Поверхность field(x, y, z) = isoLevel в параллелепипеде [minCorner, maxCorner],
+// resolution ячеек по каждой оси. Внутренность - field < isoLevel, нормали
+// направлены по градиенту (наружу).
+//
+// Сетка делится на блоки по 16 ячеек. Грубый проход считает поле через каждые
+// 4 ячейки и по наибольшему перепаду между соседними грубыми узлами оценивает,
+// может ли поверхность пройти через блок; пустые блоки не сэмплируются вовсе.
+// Активные блоки сэмплируются и обрабатываются параллельно, затем вершины на
+// общих гранях блоков склеиваются по глобальному номеру ребра решётки
+template <typename Field>
+Mesh generateImplicitSurface(
+    Field&& field,
+    const Point3D& minCorner, const Point3D& maxCorner,
+    int resolution,
+    double isoLevel = 0)
+{
+    const MarchingCubesTable& table = MarchingCubesTable::instance();
+    const int blockSize = 16;
+    const int coarseStride = 4;
+
+    Mesh mesh;
+    resolution = std::max(1, resolution);
+    int blocksPerAxis = (resolution + blockSize - 1) / blockSize;
+    double step[3] = {
+        (maxCorner.x - minCorner.x) / resolution,
+        (maxCorner.y - minCorner.y) / resolution,
+        (maxCorner.z - minCorner.z) / resolution
+    };
+    auto coord = [&](int axis, int index) {
+        double base = axis == 0 ? minCorner.x : axis == 1 ? minCorner.y : minCorner.z;
+        return base + step[axis] * index;
+    };
+    auto sample = [&](int i, int j, int k) {
+        return field(coord(0, i), coord(1, j), coord(2, k)) - isoLevel;
+    };
+
+    // Грубый проход
+    int coarseSide = (resolution + coarseStride - 1) / coarseStride + 1;
+    auto coarseIndex = [&](int ci) { return std::min(ci * coarseStride, resolution); };
+    std::vector<double> coarse((size_t)coarseSide * coarseSide * coarseSide);
+    auto coarseAt = [&](int ci, int cj, int ck) -> double& {
+        return coarse[((size_t)ck * coarseSide + cj) * coarseSide + ci];
+    };
+    parallelFor("marching cubes", 0, coarseSide, 1, [&](int from, int to) {
+        for (int ck = from; ck < to; ck++) {
+            for (int cj = 0; cj < coarseSide; cj++) {
+                for (int ci = 0; ci < coarseSide; ci++) {
+                    coarseAt(ci, cj, ck) = sample(coarseIndex(ci), coarseIndex(cj), coarseIndex(ck));
+                }
+            }
+        }
+    });
+
+    // Оценка константы Липшица по наибольшему перепаду между соседними грубыми узлами
+    double slope = 0;
+    for (int ck = 0; ck < coarseSide; ck++) {
+        for (int cj = 0; cj < coarseSide; cj++) {
+            for (int ci = 0; ci < coarseSide; ci++) {
+                double v = coarseAt(ci, cj, ck);
+                if (ci + 1 < coarseSide) slope = std::max(slope, std::abs(coarseAt(ci + 1, cj, ck) - v) / (step[0] * coarseStride));
+                if (cj + 1 < coarseSide) slope = std::max(slope, std::abs(coarseAt(ci, cj + 1, ck) - v) / (step[1] * coarseStride));
+                if (ck + 1 < coarseSide) slope = std::max(slope, std::abs(coarseAt(ci, cj, ck + 1) - v) / (step[2] * coarseStride));
+            }
+        }
+    }
+    // Запас в 2 раза: между грубыми узлами поле может меняться быстрее
+    double reach = 2.0 * slope * coarseStride *
+                   std::sqrt(step[0] * step[0] + step[1] * step[1] + step[2] * step[2]) * 0.5;
+
+    struct Block { int bi, bj, bk; };
+    std::vector<Block> activeBlocks;
+    int coarsePerBlock = blockSize / coarseStride;
+    for (int bk = 0; bk < blocksPerAxis; bk++) {
+        for (int bj = 0; bj < blocksPerAxis; bj++) {
+            for (int bi = 0; bi < blocksPerAxis; bi++) {
+                bool hasNegative = false, hasPositive = false, nearSurface = false;
+                for (int ck = bk * coarsePerBlock; ck <= std::min((bk + 1) * coarsePerBlock, coarseSide - 1); ck++) {
+                    for (int cj = bj * coarsePerBlock; cj <= std::min((bj + 1) * coarsePerBlock, coarseSide - 1); cj++) {
+                        for (int ci = bi * coarsePerBlock; ci <= std::min((bi + 1) * coarsePerBlock, coarseSide - 1); ci++) {
+                            double v = coarseAt(ci, cj, ck);
+                            hasNegative = hasNegative || v < 0;
+                            hasPositive = hasPositive || v >= 0;
+                            nearSurface = nearSurface || std::abs(v) <= reach;
+                        }
+                    }
+                }
+                if ((hasNegative && hasPositive) || nearSurface) {
+                    activeBlocks.push_back({ bi, bj, bk });
+                }
+            }
+        }
+    }
+
+    // Marching cubes в блоке. Вершина идентифицируется ребром решётки:
+    // (номер начального узла) * 3 + ось
+    struct BlockResult {
+        std::vector<Point3D> positions;
+        std::vector<Point3D> normals;
+        std::vector<uint64_t> edgeIds;
+        std::vector<int> triangles;
+    };
+    std::vector<BlockResult> results(activeBlocks.size());
+    long long side = resolution + 1;
+
+    parallelFor("marching cubes", 0, (int)activeBlocks.size(), 1, [&](int from, int to) {
+        int samplesSide = blockSize + 1;
+        std::vector<double> values((size_t)samplesSide * samplesSide * samplesSide);
+        std::vector<int> edgeVertex((size_t)samplesSide * samplesSide * samplesSide * 3);
+
+        for (int b = from; b < to; b++) {
+            const Block& block = activeBlocks[b];
+            BlockResult& result = results[b];
+            int i0 = block.bi * blockSize, j0 = block.bj * blockSize, k0 = block.bk * blockSize;
+            int ni = std::min(blockSize, resolution - i0);
+            int nj = std::min(blockSize, resolution - j0);
+            int nk = std::min(blockSize, resolution - k0);
+
+            auto local = [&](int i, int j, int k) { return ((size_t)k * samplesSide + j) * samplesSide + i; };
+            for (int k = 0; k <= nk; k++) {
+                for (int j = 0; j <= nj; j++) {
+                    for (int i = 0; i <= ni; i++) {
+                        values[local(i, j, k)] = sample(i0 + i, j0 + j, k0 + k);
+                    }
+                }
+            }
+            std::fill(edgeVertex.begin(), edgeVertex.end(), -1);
+
+            auto vertexOnEdge = [&](int i, int j, int k, int axis) {
+                int& slot = edgeVertex[local(i, j, k) * 3 + axis];
+                if (slot >= 0) return slot;
+                int di = axis == 0, dj = axis == 1, dk = axis == 2;
+                double v0 = values[local(i, j, k)];
+                double v1 = values[local(i + di, j + dj, k + dk)];
+                double t = v0 / (v0 - v1);
+                double x = coord(0, i0 + i) + step[0] * di * t;
+                double y = coord(1, j0 + j) + step[1] * dj * t;
+                double z = coord(2, k0 + k) + step[2] * dk * t;
+
+                double gx = field(x + step[0] * 0.5, y, z) - field(x - step[0] * 0.5, y, z);
+                double gy = field(x, y + step[1] * 0.5, z) - field(x, y - step[1] * 0.5, z);
+                double gz = field(x, y, z + step[2] * 0.5) - field(x, y, z - step[2] * 0.5);
+
+                slot = (int)result.positions.size();
+                result.positions.push_back(Point3D(x, y, z));
+                result.normals.push_back(Point3D(gx / step[0], gy / step[1], gz / step[2], 0).normalize());
+                long long node = ((long long)(k0 + k) * side + (j0 + j)) * side + (i0 + i);
+                result.edgeIds.push_back((uint64_t)node * 3 + axis);
+                return slot;
+            };
+
+            for (int k = 0; k < nk; k++) {
+                for (int j = 0; j < nj; j++) {
+                    for (int i = 0; i < ni; i++) {
+                        int config = 0;
+                        for (int c = 0; c < 8; c++) {
+                            if (values[local(i + (c & 1), j + ((c >> 1) & 1), k + (c >> 2))] < 0) config |= 1 << c;
+                        }
+                        if (config == 0 || config == 255) continue;
+
+                        const auto& tris = table.triangles[config];
+                        for (int t = 0; tris[t] >= 0; t++) {
+                            int e = tris[t];
+                            int corner = table.edgeCorner[e];
+                            result.triangles.push_back(vertexOnEdge(
+                                i + (corner & 1), j + ((corner >> 1) & 1), k + (corner >> 2), table.edgeAxis[e]));
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // Склейка блоков: вершины на гранях блоков встречаются в двух-четырёх блоках
+    std::unordered_map<uint64_t, int> vertexOfEdge;
+    std::vector<int> remap;
+    for (const BlockResult& result : results) {
+        remap.resize(result.positions.size());
+        for (size_t v = 0; v < result.positions.size(); v++) {
+            auto inserted = vertexOfEdge.emplace(result.edgeIds[v], (int)mesh.positions.size());
+            if (inserted.second) {
+                mesh.positions.push_back(result.positions[v]);
+                mesh.normals.push_back(result.normals[v]);
+            }
+            remap[v] = inserted.first->second;
+        }
+        for (size_t t = 0; t + 2 < result.triangles.size(); t += 3) {
+            int a = remap[result.triangles[t]], b = remap[result.triangles[t + 1]], c = remap[result.triangles[t + 2]];
+            // Вершина на самом углу ячейки может дать вырожденный треугольник
+            if (a == b || b == c || a == c) continue;
+            mesh.addFace({ a, b, c });
+        }
+    }
+    return mesh;
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "math_3d.h"
+#include <utility>
 
 Point3D Point3D::operator+(const Point3D& other) const {
     return Point3D(x + other.x, y + other.y, z + other.z);
@@ -72,3 +73,45 @@ Point3D Matrix4x4::transform(const Point3D& point) const {
     }
     return Point3D(x, y, z, w);
 }
+
+Matrix4x4 Matrix4x4::inverse() const {
+    // Метод Гаусса-Жордана с выбором главного элемента по столбцу
+    double a[4][8];
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            a[i][j] = m[i][j];
+            a[i][j + 4] = (i == j) ? 1.0 : 0.0;
+        }
+    }
+    for (int col = 0; col < 4; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < 4; row++) {
+            if (std::abs(a[row][col]) > std::abs(a[pivot][col])) pivot = row;
+        }
+        if (std::abs(a[pivot][col]) < 1e-15) return Matrix4x4();
+        if (pivot != col) {
+            for (int j = 0; j < 8; j++) std::swap(a[col][j], a[pivot][j]);
+        }
+        double scale = 1.0 / a[col][col];
+        for (int j = 0; j < 8; j++) a[col][j] *= scale;
+        for (int row = 0; row < 4; row++) {
+            if (row == col || a[row][col] == 0) continue;
+            double factor = a[row][col];
+            for (int j = 0; j < 8; j++) a[row][j] -= factor * a[col][j];
+        }
+    }
+    Matrix4x4 result;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) result.m[i][j] = a[i][j + 4];
+    }
+    return result;
+}
+
+Matrix4x4 Matrix4x4::normalMatrix() const {
+    Matrix4x4 inv = inverse();
+    Matrix4x4 result;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) result.m[i][j] = inv.m[j][i];
+    }
+    return result;
+}
@@ -32,6 +32,11 @@ public:
     
     Matrix4x4 operator*(const Matrix4x4& other) const;
     Point3D transform(const Point3D& point) const;
+    // Обратная матрица (для вырожденной возвращается единичная)
+    Matrix4x4 inverse() const;
+    // Матрица для нормалей: обратная транспонированная. При неравномерном масштабе
+    // нормаль, преобразованная самой матрицей, перестаёт быть перпендикулярной грани
+    Matrix4x4 normalMatrix() const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef MESH_CLUSTERS_H
+#define MESH_CLUSTERS_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Пространственный кластер граней сетки: номера граней (в исходном порядке), номера
+// их вершин и ограничивающая сфера в координатах модели
+struct MeshCluster {
+    std::vector<int> faces;
+    std::vector<int> vertices;
+    Point3D center;
+    double radius = 0;
+};
+
+// Ограничивающая сфера вершин: центр рамки и наибольшее расстояние до него.
+// vertices == nullptr - все вершины сетки
+inline void fitBoundingSphere(const Mesh& mesh, const std::vector<int>* vertices, Point3D& center, double& radius) {
+    int count = vertices ? (int)vertices->size() : mesh.vertexCount();
+    auto position = [&](int i) -> const Point3D& { return mesh.positions[vertices ? (*vertices)[i] : i]; };
+    center = Point3D(0, 0, 0);
+    radius = 0;
+    if (count == 0) return;
+    Point3D minP = position(0), maxP = position(0);
+    for (int i = 1; i < count; i++) {
+        const Point3D& p = position(i);
+        minP = Point3D(std::min(minP.x, p.x), std::min(minP.y, p.y), std::min(minP.z, p.z));
+        maxP = Point3D(std::max(maxP.x, p.x), std::max(maxP.y, p.y), std::max(maxP.z, p.z));
+    }
+    center = (minP + maxP) * 0.5;
+    double radius2 = 0;
+    for (int i = 0; i < count; i++) {
+        Point3D d = position(i) - center;
+        radius2 = std::max(radius2, d.dot(d));
+    }
+    radius = std::sqrt(radius2);
+}
+
+// Сфера пересчитывается для сдвинутых вершин той же связности (анимация)
+inline void refitMeshClusters(const Mesh& mesh, std::vector<MeshCluster>& clusters) {
+    for (MeshCluster& cluster : clusters) fitBoundingSphere(mesh, &cluster.vertices, cluster.center, cluster.radius);
+}
+
+// Разбиение крупной сетки на кластеры примерно по maxFaces граней: набор граней
+// делится пополам по медиане их центров вдоль самой длинной оси, пока не станет
+// достаточно мелким. Кластеры сортируются по глубине вместе с остальными объектами
+// кадра, поэтому ближние части модели рисуются раньше закрытых ими дальних.
+// Сетка, которая и так не больше двух кластеров, не делится (пустой результат)
+inline std::vector<MeshCluster> buildMeshClusters(const Mesh& mesh, int maxFaces = 512) {
+    std::vector<MeshCluster> clusters;
+    int faceCount = mesh.faceCount();
+    if (faceCount <= 2 * maxFaces) return clusters;
+
+    std::vector<Point3D> centers(faceCount);
+    for (int f = 0; f < faceCount; f++) {
+        const int* face = mesh.faceIndices(f);
+        Point3D sum(0, 0, 0);
+        for (int i = 0; i < mesh.faceSize(f); i++) sum = sum + mesh.positions[face[i]];
+        centers[f] = mesh.faceSize(f) > 0 ? sum * (1.0 / mesh.faceSize(f)) : sum;
+    }
+
+    std::vector<int> faces(faceCount);
+    for (int f = 0; f < faceCount; f++) faces[f] = f;
+    std::vector<int> mark(mesh.vertexCount(), -1);
+
+    // Явный стек диапазонов [from, to) вместо рекурсии
+    std::vector<std::pair<int, int>> stack = { { 0, faceCount } };
+    while (!stack.empty()) {
+        std::pair<int, int> range = stack.back();
+        stack.pop_back();
+        int from = range.first, to = range.second;
+
+        if (to - from > maxFaces) {
+            Point3D minP = centers[faces[from]], maxP = minP;
+            for (int i = from + 1; i < to; i++) {
+                const Point3D& c = centers[faces[i]];
+                minP = Point3D(std::min(minP.x, c.x), std::min(minP.y, c.y), std::min(minP.z, c.z));
+                maxP = Point3D(std::max(maxP.x, c.x), std::max(maxP.y, c.y), std::max(maxP.z, c.z));
+            }
+            Point3D extent = maxP - minP;
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+            auto key = [&](int f) { return axis == 0 ? centers[f].x : (axis == 1 ? centers[f].y : centers[f].z); };
+            int middle = (from + to) / 2;
+            std::nth_element(faces.begin() + from, faces.begin() + middle, faces.begin() + to,
+                             [&](int a, int b) { return key(a) < key(b); });
+            stack.push_back({ middle, to });
+            stack.push_back({ from, middle });
+            continue;
+        }
+
+        MeshCluster cluster;
+        // Исходный порядок граней сохраняет оптимизацию под кэш вершин (mesh_optimizer.h)
+        cluster.faces.assign(faces.begin() + from, faces.begin() + to);
+        std::sort(cluster.faces.begin(), cluster.faces.end());
+        int id = (int)clusters.size();
+        for (int f : cluster.faces) {
+            const int* face = mesh.faceIndices(f);
+            for (int i = 0; i < mesh.faceSize(f); i++) {
+                if (mark[face[i]] != id) {
+                    mark[face[i]] = id;
+                    cluster.vertices.push_back(face[i]);
+                }
+            }
+        }
+        fitBoundingSphere(mesh, &cluster.vertices, cluster.center, cluster.radius);
+        clusters.push_back(std::move(cluster));
+    }
+    return clusters;
+}
+
+#endif
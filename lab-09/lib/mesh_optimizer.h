@@ -0,0 +1,389 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "geometry.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Переупорядочивание граней и вершин сетки под кэш вершин, перерисовку и выборку.
+//
+// 1. Порядок граней под кэш преобразованных вершин - жадный алгоритм Форсайта:
+//    следующей берётся грань с наибольшей суммой оценок вершин (вершина ценнее,
+//    если недавно была в кэше и у неё осталось мало необработанных граней).
+// 2. Кластеры: порядок из п. 1 режется на куски там, где грань целиком промахивается
+//    мимо кэша, и куски сортируются так, чтобы обращённые наружу шли первыми (как в
+//    Tipsify) - ближние к камере грани чаще рисуются раньше закрытых ими.
+// 3. Вершины перенумеровываются в порядке первого использования - выборка атрибутов
+//    идёт почти подряд по памяти.
+//
+// Грани - произвольные многоугольники (для треугольного буфера offsets == nullptr).
+// Тип позиции - любой с полями x, y, z.
+
+template <typename Index>
+struct FaceSpan {
+    const Index* indices;
+    const int* offsets; // faceCount + 1 элементов или nullptr для треугольников
+    int faceCount;
+
+    int size(int f) const { return offsets ? offsets[f + 1] - offsets[f] : 3; }
+    const Index* face(int f) const { return indices + (offsets ? offsets[f] : 3 * f); }
+};
+
+// Среднее число промахов FIFO-кэша вершин на треугольник (ACMR)
+template <typename Index>
+double simulateAcmr(const FaceSpan<Index>& faces, const std::vector<int>& order, int vertexCount, int cacheSize = 16) {
+    std::vector<long long> insertedAt(vertexCount, -1);
+    long long time = 0, misses = 0, triangles = 0;
+    for (int f : order) {
+        const Index* face = faces.face(f);
+        int n = faces.size(f);
+        triangles += std::max(0, n - 2);
+        for (int i = 0; i < n; i++) {
+            int v = (int)face[i];
+            if (insertedAt[v] >= 0 && time - insertedAt[v] < cacheSize) continue;
+            insertedAt[v] = time++;
+            misses++;
+        }
+    }
+    return triangles ? (double)misses / triangles : 0.0;
+}
+
+// Порядок граней для LRU-кэша вершин размера cacheSize (алгоритм Форсайта)
+template <typename Index>
+std::vector<int> vertexCacheOrder(const FaceSpan<Index>& faces, int vertexCount, int cacheSize = 32) {
+    const int faceCount = faces.faceCount;
+
+    // Грани каждой вершины (CSR)
+    std::vector<int> valence(vertexCount, 0);
+    for (int f = 0; f < faceCount; f++) {
+        for (int i = 0; i < faces.size(f); i++) valence[faces.face(f)[i]]++;
+    }
+    std::vector<int> adjacencyStart(vertexCount + 1, 0);
+    for (int v = 0; v < vertexCount; v++) adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+    std::vector<int> adjacency(adjacencyStart[vertexCount]);
+    std::vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (int f = 0; f < faceCount; f++) {
+        for (int i = 0; i < faces.size(f); i++) adjacency[fill[faces.face(f)[i]]++] = f;
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    auto vertexScore = [&](int v) {
+        if (valence[v] == 0) return -1.0;
+        double score = 0;
+        int position = cachePosition[v];
+        if (position >= 0) {
+            score = position < 3 ? 0.75 : std::pow(1.0 - (double)(position - 3) / (cacheSize - 3), 1.5);
+        }
+        return score + 2.0 / std::sqrt((double)valence[v]);
+    };
+
+    std::vector<double> vertexScores(vertexCount);
+    for (int v = 0; v < vertexCount; v++) vertexScores[v] = vertexScore(v);
+    std::vector<double> faceScores(faceCount, 0);
+    std::vector<char> emitted(faceCount, 0);
+    auto scoreFace = [&](int f) {
+        double score = 0;
+        for (int i = 0; i < faces.size(f); i++) score += vertexScores[faces.face(f)[i]];
+        return score;
+    };
+    for (int f = 0; f < faceCount; f++) faceScores[f] = scoreFace(f);
+
+    std::vector<int> order;
+    order.reserve(faceCount);
+    std::vector<int> cache, nextCache;
+    int scan = 0;
+    int bestFace = -1;
+
+    while ((int)order.size() < faceCount) {
+        // Кандидатов в кэше нет - берём следующую необработанную грань
+        if (bestFace < 0) {
+            while (emitted[scan]) scan++;
+            bestFace = scan;
+        }
+        int f = bestFace;
+        emitted[f] = 1;
+        order.push_back(f);
+
+        const Index* face = faces.face(f);
+        int n = faces.size(f);
+        nextCache.clear();
+        for (int i = 0; i < n; i++) {
+            int v = (int)face[i];
+            valence[v]--;
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end()) nextCache.push_back(v);
+        }
+        for (int v : cache) {
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end()) nextCache.push_back(v);
+        }
+        // Вытесненные вершины теряют бонус кэша
+        for (size_t i = cacheSize; i < nextCache.size(); i++) {
+            cachePosition[nextCache[i]] = -1;
+            vertexScores[nextCache[i]] = vertexScore(nextCache[i]);
+        }
+        std::vector<int> touched(nextCache.begin() + std::min<size_t>(cacheSize, nextCache.size()), nextCache.end());
+        if ((int)nextCache.size() > cacheSize) nextCache.resize(cacheSize);
+        cache.swap(nextCache);
+        for (size_t i = 0; i < cache.size(); i++) {
+            cachePosition[cache[i]] = (int)i;
+            vertexScores[cache[i]] = vertexScore(cache[i]);
+        }
+
+        // Оценки граней меняются только у граней вершин кэша и вытесненных вершин
+        bestFace = -1;
+        double bestScore = -1;
+        touched.insert(touched.end(), cache.begin(), cache.end());
+        for (int v : touched) {
+            for (int a = adjacencyStart[v]; a < adjacencyStart[v + 1]; a++) {
+                int g = adjacency[a];
+                if (emitted[g]) continue;
+                faceScores[g] = scoreFace(g);
+                if (cachePosition[v] >= 0 && faceScores[g] > bestScore) {
+                    bestScore = faceScores[g];
+                    bestFace = g;
+                }
+            }
+        }
+    }
+    return order;
+}
+
+// Площадь, нормаль и центр многоугольника (веер из первой вершины)
+template <typename Index, typename Position>
+void faceGeometry(const FaceSpan<Index>& faces, int f, const std::vector<Position>& positions,
+                  double normal[3], double center[3], double& area) {
+    const Index* face = faces.face(f);
+    int n = faces.size(f);
+    normal[0] = normal[1] = normal[2] = 0;
+    center[0] = center[1] = center[2] = 0;
+    const Position& p0 = positions[face[0]];
+    for (int i = 0; i < n; i++) {
+        const Position& p = positions[face[i]];
+        center[0] += p.x / n;
+        center[1] += p.y / n;
+        center[2] += p.z / n;
+    }
+    for (int i = 1; i + 1 < n; i++) {
+        const Position& a = positions[face[i]];
+        const Position& b = positions[face[i + 1]];
+        double ax = a.x - p0.x, ay = a.y - p0.y, az = a.z - p0.z;
+        double bx = b.x - p0.x, by = b.y - p0.y, bz = b.z - p0.z;
+        normal[0] += ay * bz - az * by;
+        normal[1] += az * bx - ax * bz;
+        normal[2] += ax * by - ay * bx;
+    }
+    area = 0.5 * std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+}
+
+// Средняя перерисовка: сколько раз пиксель закрашивается при отрисовке граней в порядке
+// order с тестом глубины и отсечением нелицевых граней. Считается маленьким растеризатором
+// 256x256 с шести сторон (±X, ±Y, ±Z) в ортографической проекции
+template <typename Index, typename Position>
+double measureOverdraw(const FaceSpan<Index>& faces, const std::vector<int>& order,
+                       const std::vector<Position>& positions, int gridSize = 256) {
+    if (positions.empty()) return 0.0;
+    double lo[3] = { 1e300, 1e300, 1e300 }, hi[3] = { -1e300, -1e300, -1e300 };
+    for (const Position& p : positions) {
+        double c[3] = { p.x, p.y, p.z };
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], c[k]);
+            hi[k] = std::max(hi[k], c[k]);
+        }
+    }
+    double extent = std::max({ hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], 1e-12 });
+    double scale = (gridSize - 1) / extent;
+
+    long long shaded = 0, covered = 0;
+    std::vector<double> depth((size_t)gridSize * gridSize);
+    for (int axis = 0; axis < 3; axis++) {
+        int uAxis = (axis + 1) % 3, vAxis = (axis + 2) % 3;
+        for (int side = -1; side <= 1; side += 2) {
+            std::fill(depth.begin(), depth.end(), std::numeric_limits<double>::infinity());
+            for (int f : order) {
+                double normal[3], center[3], area;
+                faceGeometry(faces, f, positions, normal, center, area);
+                // Камера со стороны side смотрит против оси: лицевые грани смотрят на неё
+                if (normal[axis] * side <= 0) continue;
+
+                const Index* face = faces.face(f);
+                auto project = [&](int v, double& x, double& y, double& z) {
+                    const Position& p = positions[v];
+                    double c[3] = { p.x, p.y, p.z };
+                    x = (c[uAxis] - lo[uAxis]) * scale;
+                    y = (c[vAxis] - lo[vAxis]) * scale;
+                    z = -side * c[axis];
+                };
+                double x0, y0, z0;
+                project((int)face[0], x0, y0, z0);
+                for (int i = 1; i + 1 < faces.size(f); i++) {
+                    double x1, y1, z1, x2, y2, z2;
+                    project((int)face[i], x1, y1, z1);
+                    project((int)face[i + 1], x2, y2, z2);
+                    double det = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+                    if (std::abs(det) < 1e-12) continue;
+                    int minX = std::max(0, (int)std::floor(std::min({ x0, x1, x2 })));
+                    int maxX = std::min(gridSize - 1, (int)std::ceil(std::max({ x0, x1, x2 })));
+                    int minY = std::max(0, (int)std::floor(std::min({ y0, y1, y2 })));
+                    int maxY = std::min(gridSize - 1, (int)std::ceil(std::max({ y0, y1, y2 })));
+                    for (int py = minY; py <= maxY; py++) {
+                        for (int px = minX; px <= maxX; px++) {
+                            double cx = px + 0.5, cy = py + 0.5;
+                            double b1 = ((cx - x0) * (y2 - y0) - (x2 - x0) * (cy - y0)) / det;
+                            double b2 = ((x1 - x0) * (cy - y0) - (cx - x0) * (y1 - y0)) / det;
+                            if (b1 < 0 || b2 < 0 || b1 + b2 > 1) continue;
+                            double z = z0 + b1 * (z1 - z0) + b2 * (z2 - z0);
+                            double& stored = depth[(size_t)py * gridSize + px];
+                            if (z < stored) {
+                                stored = z;
+                                shaded++;
+                            }
+                        }
+                    }
+                }
+            }
+            for (double z : depth) {
+                if (z < std::numeric_limits<double>::infinity()) covered++;
+            }
+        }
+    }
+    return covered ? (double)shaded / covered : 0.0;
+}
+
+// Кластеры порядка cacheOrder сортируются от обращённых наружу к обращённым внутрь.
+// Если ACMR вырос больше чем в threshold раз, возвращается исходный порядок
+template <typename Index, typename Position>
+std::vector<int> overdrawOrder(const FaceSpan<Index>& faces, const std::vector<int>& cacheOrder,
+                               const std::vector<Position>& positions, int vertexCount,
+                               double threshold = 1.05, int cacheSize = 16, int minClusterSize = 16) {
+    // Границы кластеров: грань, все вершины которой промахиваются мимо кэша
+    std::vector<int> clusterStart;
+    std::vector<long long> insertedAt(vertexCount, -1);
+    long long time = 0;
+    for (size_t i = 0; i < cacheOrder.size(); i++) {
+        const Index* face = faces.face(cacheOrder[i]);
+        int n = faces.size(cacheOrder[i]);
+        int misses = 0;
+        for (int k = 0; k < n; k++) {
+            int v = (int)face[k];
+            if (insertedAt[v] >= 0 && time - insertedAt[v] < cacheSize) continue;
+            insertedAt[v] = time++;
+            misses++;
+        }
+        bool hardBoundary = misses == n;
+        if (clusterStart.empty() || (hardBoundary && (int)i - clusterStart.back() >= minClusterSize)) {
+            clusterStart.push_back((int)i);
+        }
+    }
+    clusterStart.push_back((int)cacheOrder.size());
+
+    double meshCenter[3] = { 0, 0, 0 };
+    for (const Position& p : positions) {
+        meshCenter[0] += p.x / positions.size();
+        meshCenter[1] += p.y / positions.size();
+        meshCenter[2] += p.z / positions.size();
+    }
+
+    int clusterCount = (int)clusterStart.size() - 1;
+    std::vector<double> key(clusterCount);
+    for (int c = 0; c < clusterCount; c++) {
+        double normal[3] = { 0, 0, 0 }, center[3] = { 0, 0, 0 }, totalArea = 0;
+        for (int i = clusterStart[c]; i < clusterStart[c + 1]; i++) {
+            double n[3], m[3], area;
+            faceGeometry(faces, cacheOrder[i], positions, n, m, area);
+            for (int k = 0; k < 3; k++) {
+                normal[k] += n[k];
+                center[k] += m[k] * area;
+            }
+            totalArea += area;
+        }
+        double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (totalArea <= 0 || length <= 0) continue;
+        for (int k = 0; k < 3; k++) {
+            key[c] += (center[k] / totalArea - meshCenter[k]) * normal[k] / length;
+        }
+    }
+
+    std::vector<int> clusters(clusterCount);
+    for (int c = 0; c < clusterCount; c++) clusters[c] = c;
+    std::stable_sort(clusters.begin(), clusters.end(), [&](int a, int b) { return key[a] > key[b]; });
+
+    std::vector<int> order;
+    order.reserve(cacheOrder.size());
+    for (int c : clusters) {
+        order.insert(order.end(), cacheOrder.begin() + clusterStart[c], cacheOrder.begin() + clusterStart[c + 1]);
+    }
+
+    double before = simulateAcmr(faces, cacheOrder, vertexCount, cacheSize);
+    double after = simulateAcmr(faces, order, vertexCount, cacheSize);
+    return after <= before * threshold ? order : cacheOrder;
+}
+
+// Новые номера вершин в порядке первого использования; неиспользованные - в конце
+template <typename Index>
+std::vector<int> vertexFetchRemap(const FaceSpan<Index>& faces, const std::vector<int>& order, int vertexCount) {
+    std::vector<int> remap(vertexCount, -1);
+    int next = 0;
+    for (int f : order) {
+        for (int i = 0; i < faces.size(f); i++) {
+            int v = (int)faces.face(f)[i];
+            if (remap[v] < 0) remap[v] = next++;
+        }
+    }
+    for (int v = 0; v < vertexCount; v++) {
+        if (remap[v] < 0) remap[v] = next++;
+    }
+    return remap;
+}
+
+template <typename T>
+void applyVertexRemap(std::vector<T>& attribute, const std::vector<int>& remap) {
+    if (attribute.size() != remap.size()) return;
+    std::vector<T> reordered(attribute.size());
+    for (size_t v = 0; v < remap.size(); v++) reordered[remap[v]] = attribute[v];
+    attribute.swap(reordered);
+}
+
+struct MeshOptimizationStats {
+    double acmrBefore = 0, acmrAfter = 0;
+    double overdrawBefore = 0, overdrawAfter = 0;
+};
+
+// Переупорядочивает грани и вершины сетки на месте
+inline MeshOptimizationStats optimizeMesh(Mesh& mesh) {
+    MeshOptimizationStats stats;
+    int faceCount = mesh.faceCount();
+    int vertexCount = mesh.vertexCount();
+    if (faceCount == 0) return stats;
+
+    FaceSpan<int> faces{ mesh.indices.data(), mesh.faceOffsets.data(), faceCount };
+    std::vector<int> original(faceCount);
+    for (int f = 0; f < faceCount; f++) original[f] = f;
+    stats.acmrBefore = simulateAcmr(faces, original, vertexCount);
+    stats.overdrawBefore = measureOverdraw(faces, original, mesh.positions);
+
+    std::vector<int> order = vertexCacheOrder(faces, vertexCount);
+    order = overdrawOrder(faces, order, mesh.positions, vertexCount);
+    std::vector<int> remap = vertexFetchRemap(faces, order, vertexCount);
+
+    std::vector<int> indices;
+    std::vector<int> offsets(1, 0);
+    indices.reserve(mesh.indices.size());
+    offsets.reserve(faceCount + 1);
+    for (int f : order) {
+        for (int i = 0; i < faces.size(f); i++) indices.push_back(remap[faces.face(f)[i]]);
+        offsets.push_back((int)indices.size());
+    }
+    mesh.indices.swap(indices);
+    mesh.faceOffsets.swap(offsets);
+    applyVertexRemap(mesh.positions, remap);
+    applyVertexRemap(mesh.normals, remap);
+    applyVertexRemap(mesh.texCoords, remap);
+
+    FaceSpan<int> optimized{ mesh.indices.data(), mesh.faceOffsets.data(), faceCount };
+    stats.acmrAfter = simulateAcmr(optimized, original, vertexCount);
+    stats.overdrawAfter = measureOverdraw(optimized, original, mesh.positions);
+    return stats;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "job_system.h"
+
+// Параллельный цикл по диапазону [begin, end) на общем планировщике задач.
+// Диапазон режется на непрерывные блоки не меньше grain элементов, каждый блок
+// обрабатывается вызовом body(from, to). Первый блок выполняет вызывающий поток,
+// так что маленькие диапазоны обходятся без обращения к планировщику.
+// name - строковый литерал для замеров времени (JobSystem::setProfiling)
+template <typename Body>
+void parallelFor(const char* name, int begin, int end, int grain, Body body) {
+    JobSystem::instance().parallelFor(name, begin, end, grain, body);
+}
+
+template <typename Body>
+void parallelFor(int begin, int end, int grain, Body body) {
+    parallelFor("parallelFor", begin, end, grain, body);
+}
+
+#endif
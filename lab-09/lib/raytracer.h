@@ -0,0 +1,211 @@
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include "bvh.h"
+#include "parallel.h"
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+// Объект для трассировки; номер в массиве совпадает с номером экземпляра в SceneBvh
+struct TracedObject {
+    const Mesh* mesh = nullptr;
+    Matrix4x4 model;
+    std::vector<sf::Color> palette;   // цвет грани - palette[face % size]
+    const Texture* texture = nullptr; // используется, если у сетки есть текстурные координаты
+    double reflectivity = 0.2;
+};
+
+// Трассировка лучей на CPU - эталон качества рядом с растеризатором: настоящие тени от
+// источника света и одно отражение. Кадр делится на плитки 16x16, которые потоки
+// разбирают по одной; внутри плитки первичные, теневые и отражённые лучи идут пакетами
+// по 2x2 пикселя через SceneBvh.
+class RayTracer {
+public:
+    RayTracer(int width, int height) : width(width), height(height), pixels((size_t)width * height * 4, 255) {
+        image.create(width, height, sf::Color::Black);
+    }
+
+    // inverseViewProjection - обратная матрица к projection * view
+    const sf::Image& render(const SceneBvh& bvh, const std::vector<TracedObject>& objects,
+                            const Matrix4x4& inverseViewProjection, const Light& light) {
+        const int tileSize = 16;
+        int tilesX = (width + tileSize - 1) / tileSize;
+        int tilesY = (height + tileSize - 1) / tileSize;
+        std::atomic<int> nextTile(0);
+        normalMatrices.clear();
+        for (const TracedObject& object : objects) normalMatrices.push_back(object.model.normalMatrix());
+
+        // По задаче на поток планировщика; плитки они разбирают сами
+        int workers = JobSystem::instance().threadCount();
+        parallelFor("raytrace", 0, workers, 1, [&](int, int) {
+            for (int tile = nextTile++; tile < tilesX * tilesY; tile = nextTile++) {
+                int x0 = (tile % tilesX) * tileSize, y0 = (tile / tilesX) * tileSize;
+                for (int y = y0; y < std::min(height, y0 + tileSize); y += 2) {
+                    for (int x = x0; x < std::min(width, x0 + tileSize); x += 2) {
+                        traceQuad(bvh, objects, inverseViewProjection, light, x, y);
+                    }
+                }
+            }
+        });
+
+        image.create(width, height, pixels.data());
+        return image;
+    }
+
+private:
+    struct Surface {
+        bool valid = false;
+        Point3D position, normal;
+        Point3D albedo; // 0..1
+        double reflectivity = 0;
+    };
+
+    int width, height;
+    std::vector<sf::Uint8> pixels;
+    sf::Image image;
+    std::vector<Matrix4x4> normalMatrices; // по объектам кадра
+
+    static constexpr double ambient = 0.1;
+    static constexpr double offset = 1e-4;
+
+    // Первичные лучи четырёх пикселей квадрата 2x2, затем тени и отражения
+    void traceQuad(const SceneBvh& bvh, const std::vector<TracedObject>& objects,
+                   const Matrix4x4& inverseViewProjection, const Light& light, int x, int y) {
+        RayPacket primary;
+        int px[RayPacket::size], py[RayPacket::size];
+        for (int l = 0; l < RayPacket::size; l++) {
+            px[l] = x + (l & 1);
+            py[l] = y + (l >> 1);
+            double ndcX = 2.0 * (px[l] + 0.5) / width - 1.0;
+            double ndcY = 1.0 - 2.0 * (py[l] + 0.5) / height;
+            Point3D nearPoint = inverseViewProjection.transform(Point3D(ndcX, ndcY, -1));
+            Point3D farPoint = inverseViewProjection.transform(Point3D(ndcX, ndcY, 1));
+            Ray ray;
+            ray.origin = nearPoint;
+            ray.direction = farPoint - nearPoint;
+            primary.set(l, ray);
+            primary.active[l] = px[l] < width && py[l] < height;
+        }
+
+        RayHit hits[RayPacket::size];
+        bvh.intersect(primary, hits);
+        Surface surfaces[RayPacket::size];
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (primary.active[l] && hits[l].face >= 0) surfaces[l] = surfaceAt(objects, normalMatrices, primary.ray(l), hits[l]);
+        }
+        Point3D direct[RayPacket::size];
+        shade(bvh, light, primary, surfaces, direct);
+
+        // Одно отражение: цвет в точке попадания отражённого луча, тоже с тенью
+        RayPacket reflected;
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (!surfaces[l].valid || surfaces[l].reflectivity <= 0) continue;
+            Point3D d = Point3D(primary.dx[l], primary.dy[l], primary.dz[l], 0).normalize();
+            const Point3D& n = surfaces[l].normal;
+            Ray ray;
+            ray.origin = surfaces[l].position + n * offset;
+            ray.direction = d - n * (2.0 * d.dot(n));
+            reflected.set(l, ray);
+        }
+        RayHit reflectedHits[RayPacket::size];
+        bvh.intersect(reflected, reflectedHits);
+        Surface reflectedSurfaces[RayPacket::size];
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (reflected.active[l] && reflectedHits[l].face >= 0) {
+                reflectedSurfaces[l] = surfaceAt(objects, normalMatrices, reflected.ray(l), reflectedHits[l]);
+            }
+        }
+        Point3D bounce[RayPacket::size];
+        shade(bvh, light, reflected, reflectedSurfaces, bounce);
+
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (!primary.active[l]) continue;
+            Point3D color(0, 0, 0);
+            if (surfaces[l].valid) {
+                double k = reflected.active[l] ? surfaces[l].reflectivity : 0.0;
+                color = direct[l] * (1.0 - k) + bounce[l] * k;
+            }
+            sf::Uint8* pixel = pixels.data() + ((size_t)py[l] * width + px[l]) * 4;
+            pixel[0] = (sf::Uint8)std::min(255.0, color.x * 255.0);
+            pixel[1] = (sf::Uint8)std::min(255.0, color.y * 255.0);
+            pixel[2] = (sf::Uint8)std::min(255.0, color.z * 255.0);
+            pixel[3] = 255;
+        }
+    }
+
+    // Точка, нормаль (интерполированная, к наблюдателю) и цвет поверхности в попадании
+    static Surface surfaceAt(const std::vector<TracedObject>& objects, const std::vector<Matrix4x4>& normalMatrices,
+                             const Ray& ray, const RayHit& hit) {
+        const TracedObject& object = objects[hit.instance];
+        const Matrix4x4& normalMatrix = normalMatrices[hit.instance];
+        const Mesh& mesh = *object.mesh;
+        const int* face = mesh.faceIndices(hit.face);
+        int a = face[0], b = face[hit.triangle + 1], c = face[hit.triangle + 2];
+        double w = 1.0 - hit.u - hit.v;
+
+        Surface surface;
+        surface.valid = true;
+        surface.position = ray.origin + ray.direction * hit.t;
+        Point3D geometric = (mesh.positions[b] - mesh.positions[a]).cross(mesh.positions[c] - mesh.positions[a]);
+        geometric = normalMatrix.transform(Point3D(geometric.x, geometric.y, geometric.z, 0)).normalize();
+        Point3D normal = geometric;
+        if (mesh.hasNormals()) {
+            Point3D n = mesh.normals[a] * w + mesh.normals[b] * hit.u + mesh.normals[c] * hit.v;
+            normal = normalMatrix.transform(Point3D(n.x, n.y, n.z, 0)).normalize();
+        }
+        // Грани двусторонние: нормаль разворачивается к лучу
+        if (geometric.dot(ray.direction) > 0) geometric = geometric * -1.0;
+        if (normal.dot(geometric) < 0) normal = normal * -1.0;
+        surface.normal = normal;
+
+        sf::Color color = object.palette.empty() ? sf::Color::White : object.palette[hit.face % object.palette.size()];
+        if (object.texture && object.texture->width > 0 && mesh.hasTexCoords()) {
+            Point3D uv = mesh.texCoords[a] * w + mesh.texCoords[b] * hit.u + mesh.texCoords[c] * hit.v;
+            color = object.texture->getColor((float)uv.x, (float)uv.y);
+        }
+        surface.albedo = Point3D(color.r / 255.0, color.g / 255.0, color.b / 255.0);
+        surface.reflectivity = object.reflectivity;
+        return surface;
+    }
+
+    // Ламберт + блик Блинна-Фонга; тень - пакет лучей к источнику (any-hit)
+    static void shade(const SceneBvh& bvh, const Light& light, const RayPacket& rays,
+                      const Surface surfaces[], Point3D colors[]) {
+        RayPacket shadow;
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (!surfaces[l].valid) continue;
+            Ray ray;
+            ray.origin = surfaces[l].position + surfaces[l].normal * offset;
+            ray.direction = light.position - ray.origin;
+            ray.tMax = 1.0;
+            shadow.set(l, ray);
+        }
+        bool inShadow[RayPacket::size] = { false, false, false, false };
+        bvh.occluded(shadow, inShadow);
+
+        Point3D lightColor(light.color.r / 255.0 * light.intensity, light.color.g / 255.0 * light.intensity,
+                           light.color.b / 255.0 * light.intensity);
+        for (int l = 0; l < RayPacket::size; l++) {
+            colors[l] = Point3D(0, 0, 0);
+            if (!surfaces[l].valid) continue;
+            const Surface& s = surfaces[l];
+            double diffuse = 0, specular = 0;
+            if (!inShadow[l]) {
+                Point3D toLight = (light.position - s.position).normalize();
+                Point3D toEye = Point3D(-rays.dx[l], -rays.dy[l], -rays.dz[l], 0).normalize();
+                diffuse = std::max(0.0, s.normal.dot(toLight));
+                if (diffuse > 0) specular = 0.3 * std::pow(std::max(0.0, s.normal.dot((toLight + toEye).normalize())), 32.0);
+            }
+            colors[l] = Point3D(s.albedo.x * (ambient + diffuse * lightColor.x) + specular * lightColor.x,
+                                s.albedo.y * (ambient + diffuse * lightColor.y) + specular * lightColor.y,
+                                s.albedo.z * (ambient + diffuse * lightColor.z) + specular * lightColor.z);
+        }
+    }
+};
+
+#endif
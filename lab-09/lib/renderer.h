@@ -3,12 +3,15 @@
 
 #include "math_3d.h"
 #include "geometry.h"
+#include "parallel.h"
 #include <cmath>
 #include <SFML/Graphics.hpp>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -300,6 +303,7 @@ Polyhedron loadOBJ(const std::string& filename) {
 
     std::vector<Point3D> vertices;
     std::vector<Point3D> texCoords;
+    std::vector<Point3D> normals;
     std::vector<Polygon> polygons;
     std::string line;
 
@@ -320,15 +324,23 @@ Polyhedron loadOBJ(const std::string& filename) {
             iss >> u >> v;
             texCoords.emplace_back(u, v, 0);
         }
+        else if (type == "vn") {
+            double x, y, z;
+            iss >> x >> y >> z;
+            normals.push_back(Point3D(x, y, z, 0).normalize());
+        }
         else if (type == "f") {
             std::vector<Point3D> face;
             std::vector<Point3D> faceTexCoords;
+            std::vector<Point3D> faceNormals;
             std::string token;
             while (iss >> token) {
+                // Форматы вершины грани: v, v/vt, v//vn, v/vt/vn
                 std::stringstream ss(token);
-                std::string indexStr, texIndexStr;
+                std::string indexStr, texIndexStr, normalIndexStr;
                 std::getline(ss, indexStr, '/');
                 std::getline(ss, texIndexStr, '/');
+                std::getline(ss, normalIndexStr, '/');
                 
                 int idx = std::stoi(indexStr);
                 if (idx < 0) idx = vertices.size() + idx + 1;
@@ -337,16 +349,28 @@ Polyhedron loadOBJ(const std::string& filename) {
                 if (!texIndexStr.empty()) {
                     int texIdx = std::stoi(texIndexStr);
                     if (texIdx < 0) texIdx = texCoords.size() + texIdx + 1;
-                    if (texIdx > 0 && texIdx <= texCoords.size()) {
+                    if (texIdx > 0 && (size_t)texIdx <= texCoords.size()) {
                         faceTexCoords.push_back(texCoords[texIdx - 1]);
                     }
                 }
+
+                if (!normalIndexStr.empty()) {
+                    int normalIdx = std::stoi(normalIndexStr);
+                    if (normalIdx < 0) normalIdx = normals.size() + normalIdx + 1;
+                    if (normalIdx > 0 && (size_t)normalIdx <= normals.size()) {
+                        faceNormals.push_back(normals[normalIdx - 1]);
+                    }
+                }
             }
-            polygons.push_back(Polygon(face, faceTexCoords));
+            // Нормали берутся из файла только если они заданы для каждой вершины грани
+            if (faceNormals.size() != face.size()) faceNormals.clear();
+            polygons.push_back(Polygon(face, faceTexCoords, faceNormals));
         }
     }
 
-    std::cout << "Модель успешно загружена: " << polygons.size() << " полигонов." << std::endl;
+    std::cout << "Модель успешно загружена: " << polygons.size() << " полигонов";
+    if (!normals.empty()) std::cout << ", нормалей из файла: " << normals.size();
+    std::cout << "." << std::endl;
     return Polyhedron(polygons);
 }
 
@@ -359,6 +383,7 @@ void saveOBJ(const Polyhedron& polyhedron, const std::string& filename) {
 
     std::vector<Point3D> vertices;
     std::vector<Point3D> texCoords;
+    std::vector<Point3D> normals;
     for (const auto& polygon : polyhedron.polygons) {
         for (const auto& point : polygon.points) {
             vertices.push_back(point);
@@ -366,6 +391,9 @@ void saveOBJ(const Polyhedron& polyhedron, const std::string& filename) {
         for (const auto& tex : polygon.texCoords) {
             texCoords.push_back(tex);
         }
+        for (const auto& normal : polygon.normals) {
+            normals.push_back(normal);
+        }
     }
 
     for (const auto& v : vertices) {
@@ -376,12 +404,19 @@ void saveOBJ(const Polyhedron& polyhedron, const std::string& filename) {
         file << "vt " << vt.x << " " << vt.y << "\n";
     }
 
+    for (const auto& vn : normals) {
+        file << "vn " << vn.x << " " << vn.y << " " << vn.z << "\n";
+    }
+
     int vertexIndex = 1;
     int texIndex = 1;
+    int normalIndex = 1;
     for (const auto& polygon : polyhedron.polygons) {
+        bool withNormals = polygon.hasVertexNormals();
         file << "f";
         for (size_t i = 0; i < polygon.points.size(); ++i) {
             file << " " << vertexIndex << "/" << texIndex;
+            if (withNormals) file << "/" << normalIndex++;
             vertexIndex++;
             texIndex++;
         }
@@ -391,103 +426,476 @@ void saveOBJ(const Polyhedron& polyhedron, const std::string& filename) {
     std::cout << "Модель сохранена в " << filename << std::endl;
 }
 
-Polyhedron generateSurfaceOfRevolution(
+void saveOBJ(const Mesh& mesh, const std::string& filename) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Ошибка: не удалось создать файл " << filename << std::endl;
+        return;
+    }
+
+    // Атрибуты в сетке общие для всех граней, поэтому индексы v/vt/vn совпадают
+    for (const auto& v : mesh.positions) {
+        file << "v " << v.x << " " << v.y << " " << v.z << "\n";
+    }
+    for (const auto& vt : mesh.texCoords) {
+        file << "vt " << vt.x << " " << vt.y << "\n";
+    }
+    for (const auto& vn : mesh.normals) {
+        file << "vn " << vn.x << " " << vn.y << " " << vn.z << "\n";
+    }
+
+    bool withTexCoords = mesh.hasTexCoords();
+    bool withNormals = mesh.hasNormals();
+    for (int f = 0; f < mesh.faceCount(); f++) {
+        const int* face = mesh.faceIndices(f);
+        file << "f";
+        for (int i = 0; i < mesh.faceSize(f); i++) {
+            int index = face[i] + 1;
+            file << " " << index;
+            if (withTexCoords || withNormals) file << "/";
+            if (withTexCoords) file << index;
+            if (withNormals) file << "/" << index;
+        }
+        file << "\n";
+    }
+
+    std::cout << "Модель сохранена в " << filename << std::endl;
+}
+
+// Индексированная сетка для отрисовки: гладкие нормали считаются один раз здесь,
+// если их не было в исходной модели, а не в каждом кадре
+Mesh buildMesh(const Polyhedron& polyhedron) {
+    Mesh mesh = Mesh::fromPolyhedron(polyhedron);
+    if (!mesh.hasNormals()) {
+        computeSmoothNormals(mesh);
+    }
+    return mesh;
+}
+
+// Поворот точки вокруг оси axisIndex (0 - X, 1 - Y, 2 - Z) на угол с косинусом c и синусом s.
+// Направление поворота у всех осей одно: при росте угла точка движется по -(ось x точка).
+// Для Y это прежнее направление, для Z - обратное прежнему: поверхность вокруг любой оси
+// совпадает с повёрнутой поверхностью вокруг Y, и профиль, идущий вдоль оси в сторону
+// её роста, даёт грани, обходом смотрящие наружу (их и оставляет отсечение нелицевых)
+inline Point3D rotateAroundAxis(const Point3D& p, int axisIndex, double c, double s) {
+    switch (axisIndex) {
+        case 0: return Point3D(p.x, p.y * c + p.z * s, -p.y * s + p.z * c, p.w);
+        case 1: return Point3D(p.x * c - p.z * s, p.y, p.x * s + p.z * c, p.w);
+        default: return Point3D(p.x * c + p.y * s, -p.x * s + p.y * c, p.z, p.w);
+    }
+}
+
+// Поверхность вращения профиля вокруг оси.
+// Синусы и косинусы считаются один раз на сегмент, каждая вершина кольца создаётся
+// ровно один раз (кольцо шва повторено ради текстурной координаты u = 1),
+// точки профиля на оси схлопываются в одну вершину-полюс. Открытые концы профиля
+// при closeCaps закрываются плоскими крышками. Нормали считаются аналитически
+// по касательной к профилю, отдельный проход сглаживания не нужен.
+Mesh generateSurfaceOfRevolution(
     const std::vector<Point3D>& profile,
     char axis,
-    int segments)
+    int segments,
+    bool closeCaps = true)
 {
-    std::vector<Polygon> polygons;
-    double angleStep = 2.0 * M_PI / segments;
-
-    for (int i = 0; i < segments; ++i) {
-        double theta1 = i * angleStep;
-        double theta2 = (i + 1) * angleStep;
-
-        std::vector<Point3D> ring1, ring2;
-        std::vector<Point3D> texRing1, texRing2;
-        
-        for (size_t j = 0; j < profile.size(); ++j) {
-            const auto& p = profile[j];
-            double x = p.x, y = p.y, z = p.z;
-            Point3D p1, p2;
-
-            if (axis == 'y' || axis == 'Y') {
-                p1 = Point3D(x * cos(theta1), y, x * sin(theta1));
-                p2 = Point3D(x * cos(theta2), y, x * sin(theta2));
-            } else if (axis == 'x' || axis == 'X') {
-                p1 = Point3D(p.z * sin(theta1), p.y * cos(theta1), p.z * cos(theta1));
-                p2 = Point3D(p.z * sin(theta2), p.y * cos(theta2), p.z * cos(theta2));
-            } else { // ось Z
-                p1 = Point3D(x * cos(theta1) - y * sin(theta1), x * sin(theta1) + y * cos(theta1), z);
-                p2 = Point3D(x * cos(theta2) - y * sin(theta2), x * sin(theta2) + y * cos(theta2), z);
+    Mesh mesh;
+    int profileSize = (int)profile.size();
+    if (profileSize < 2 || segments < 3) return mesh;
+
+    int axisIndex = (axis == 'x' || axis == 'X') ? 0 : (axis == 'y' || axis == 'Y') ? 1 : 2;
+    Point3D axisDir(axisIndex == 0, axisIndex == 1, axisIndex == 2, 0);
+    auto alongAxis = [&](const Point3D& p) { return axisIndex == 0 ? p.x : axisIndex == 1 ? p.y : p.z; };
+    auto onAxis = [&](const Point3D& p) { return axisDir * alongAxis(p); };
+
+    // Таблица углов; последний элемент точно равен первому, чтобы шов совпадал побитно
+    std::vector<double> cosTable(segments + 1), sinTable(segments + 1);
+    for (int i = 0; i < segments; i++) {
+        double theta = 2.0 * M_PI * i / segments;
+        cosTable[i] = cos(theta);
+        sinTable[i] = sin(theta);
+    }
+    cosTable[segments] = cosTable[0];
+    sinTable[segments] = sinTable[0];
+
+    // Точки профиля: полюс (на оси) или номер точки в кольце, плюс нормаль при угле 0
+    std::vector<bool> isPole(profileSize);
+    std::vector<int> ringSlot(profileSize, -1);
+    std::vector<Point3D> baseNormals(profileSize);
+    int ringSize = 0;
+    for (int j = 0; j < profileSize; j++) {
+        Point3D radial = profile[j] - onAxis(profile[j]);
+        isPole[j] = radial.length() < 1e-9;
+        if (!isPole[j]) ringSlot[j] = ringSize++;
+
+        Point3D tangent = profile[std::min(j + 1, profileSize - 1)] - profile[std::max(j - 1, 0)];
+        // Производная кольца по углу в точке угла 0
+        Point3D ringDir = rotateAroundAxis(Point3D(radial.x, radial.y, radial.z, 0), axisIndex, 0.0, 1.0);
+        baseNormals[j] = tangent.cross(ringDir).normalize();
+    }
+    // Нормаль полюса направлена вдоль оси в ту же сторону, что и нормали соседних колец
+    for (int j = 0; j < profileSize; j++) {
+        if (!isPole[j]) continue;
+        int neighbor = (j + 1 < profileSize && !isPole[j + 1]) ? j + 1 : (j > 0 ? j - 1 : j);
+        double side = baseNormals[neighbor].dot(axisDir);
+        baseNormals[j] = axisDir * (side < 0 ? -1.0 : 1.0);
+        baseNormals[j].w = 0;
+    }
+
+    int ringVertexCount = (segments + 1) * ringSize;
+    std::vector<int> poleVertex(profileSize, -1);
+    int vertexCount = ringVertexCount;
+    for (int j = 0; j < profileSize; j++) {
+        if (isPole[j]) poleVertex[j] = vertexCount++;
+    }
+    mesh.positions.resize(vertexCount);
+    mesh.normals.resize(vertexCount);
+    mesh.texCoords.resize(vertexCount);
+
+    for (int j = 0; j < profileSize; j++) {
+        if (!isPole[j]) continue;
+        mesh.positions[poleVertex[j]] = profile[j];
+        mesh.normals[poleVertex[j]] = baseNormals[j];
+        mesh.texCoords[poleVertex[j]] = Point3D(0.5, (double)j / (profileSize - 1), 0);
+    }
+
+    // Полоса между точками профиля j и j + 1 даёт четырёхугольник, треугольник у полюса
+    // или ничего, если обе точки на оси. Число граней у всех сегментов одинаковое,
+    // поэтому смещения граней сегмента известны заранее
+    std::vector<int> stripSize(profileSize - 1);
+    int facesPerSegment = 0, indicesPerSegment = 0;
+    for (int j = 0; j + 1 < profileSize; j++) {
+        stripSize[j] = isPole[j] && isPole[j + 1] ? 0 : (isPole[j] || isPole[j + 1]) ? 3 : 4;
+        if (stripSize[j] > 0) facesPerSegment++;
+        indicesPerSegment += stripSize[j];
+    }
+    mesh.indices.resize((size_t)segments * indicesPerSegment);
+    mesh.faceOffsets.resize((size_t)segments * facesPerSegment + 1);
+
+    auto vertexIndex = [&](int ring, int j) {
+        return isPole[j] ? poleVertex[j] : ring * ringSize + ringSlot[j];
+    };
+
+    parallelFor("surface", 0, segments + 1, 64, [&](int from, int to) {
+        for (int i = from; i < to; i++) {
+            double c = cosTable[i], s = sinTable[i];
+            float u = (float)i / segments;
+            for (int j = 0; j < profileSize; j++) {
+                if (isPole[j]) continue;
+                int v = i * ringSize + ringSlot[j];
+                mesh.positions[v] = rotateAroundAxis(profile[j], axisIndex, c, s);
+                mesh.normals[v] = rotateAroundAxis(baseNormals[j], axisIndex, c, s);
+                mesh.texCoords[v] = Point3D(u, (float)j / (profileSize - 1), 0);
             }
 
-            ring1.push_back(p1);
-            ring2.push_back(p2);
-            
-            float u1 = (float)i / segments;
-            float u2 = (float)(i+1) / segments;
-            float v = (float)j / (profile.size() - 1);
-            texRing1.push_back(Point3D(u1, v, 0));
-            texRing2.push_back(Point3D(u2, v, 0));
+            if (i == segments) continue;
+            int* out = mesh.indices.data() + (size_t)i * indicesPerSegment;
+            int* offsets = mesh.faceOffsets.data() + (size_t)i * facesPerSegment + 1;
+            int offset = i * indicesPerSegment;
+            for (int j = 0; j + 1 < profileSize; j++) {
+                if (stripSize[j] == 0) continue;
+                int a = vertexIndex(i, j), b = vertexIndex(i, j + 1);
+                int c2 = vertexIndex(i + 1, j + 1), d = vertexIndex(i + 1, j);
+                *out++ = a;
+                *out++ = b;
+                if (!isPole[j + 1]) *out++ = c2;
+                if (!isPole[j]) *out++ = d;
+                offset += stripSize[j];
+                *offsets++ = offset;
+            }
         }
-
-        for (size_t j = 0; j < profile.size() - 1; ++j) {
-            polygons.push_back(Polygon({
-                ring1[j], ring1[j + 1], ring2[j + 1], ring2[j]
-            }, {
-                texRing1[j], texRing1[j + 1], texRing2[j + 1], texRing2[j]
-            }));
+    });
+
+    // Плоские крышки на концах профиля, не лежащих на оси
+    auto addCap = [&](int j, double outward) {
+        Point3D normal = axisDir * outward;
+        normal.w = 0;
+        int center = mesh.vertexCount();
+        mesh.positions.push_back(onAxis(profile[j]));
+        mesh.normals.push_back(normal);
+        mesh.texCoords.push_back(Point3D(0.5, 0.5, 0));
+        for (int i = 0; i < segments; i++) {
+            Point3D rim = mesh.positions[vertexIndex(i, j)];
+            mesh.positions.push_back(rim);
+            mesh.normals.push_back(normal);
+            mesh.texCoords.push_back(Point3D(0.5 + 0.5 * cosTable[i], 0.5 + 0.5 * sinTable[i], 0));
+        }
+        // Треугольник (центр, i, i + 1) смотрит против оси
+        for (int i = 0; i < segments; i++) {
+            int a = center + 1 + i, b = center + 1 + (i + 1) % segments;
+            if (outward < 0) mesh.addFace({center, a, b});
+            else mesh.addFace({center, b, a});
         }
+    };
+    if (closeCaps && !isPole[0]) {
+        double side = (profile[1] - profile[0]).dot(axisDir);
+        addCap(0, side > 0 ? -1.0 : 1.0);
+    }
+    if (closeCaps && !isPole[profileSize - 1]) {
+        double side = (profile[profileSize - 1] - profile[profileSize - 2]).dot(axisDir);
+        addCap(profileSize - 1, side < 0 ? -1.0 : 1.0);
     }
 
-    return Polyhedron(polygons);
+    return mesh;
 }
 
-Polyhedron generateFunctionSurface(
-    std::function<double(double, double)> func,
+// Поверхность z = func(x, y) на сетке (steps + 1) x (steps + 1) вершин.
+// Функция передаётся шаблонным параметром и встраивается компилятором; строки сетки
+// считаются параллельно блоками. Нормали - центральные разности по соседним узлам
+// (на краю - односторонние), направлены в сторону обхода граней
+template <typename Func>
+Mesh generateFunctionSurface(
+    Func&& func,
     double x0, double x1,
     double y0, double y1,
     int steps)
 {
-    std::vector<Point3D> points;
-    std::vector<Polygon> polygons;
+    Mesh mesh;
+    if (steps < 1) return mesh;
 
+    int side = steps + 1;
+    int vertexCount = side * side;
     double dx = (x1 - x0) / steps;
     double dy = (y1 - y0) / steps;
+    const int rowGrain = std::max(1, 4096 / side);
+
+    mesh.positions.resize(vertexCount);
+    mesh.normals.resize(vertexCount);
+    mesh.texCoords.resize(vertexCount);
+    mesh.indices.resize((size_t)steps * steps * 4);
+    mesh.faceOffsets.resize((size_t)steps * steps + 1);
+
+    parallelFor("surface", 0, side, rowGrain, [&](int from, int to) {
+        for (int i = from; i < to; ++i) {
+            double x = x0 + i * dx;
+            for (int j = 0; j < side; ++j) {
+                double y = y0 + j * dy;
+                int idx = i * side + j;
+                mesh.positions[idx] = Point3D(x, y, func(x, y));
+                mesh.texCoords[idx] = Point3D((double)i / steps, (double)j / steps, 0);
+            }
+        }
+    });
+
+    // Нормали и грани зависят от соседних строк, поэтому считаются после выборки
+    parallelFor("surface", 0, side, rowGrain, [&](int from, int to) {
+        for (int i = from; i < to; ++i) {
+            int iPrev = std::max(i - 1, 0), iNext = std::min(i + 1, steps);
+            for (int j = 0; j < side; ++j) {
+                int jPrev = std::max(j - 1, 0), jNext = std::min(j + 1, steps);
+                double dzdx = (mesh.positions[iNext * side + j].z - mesh.positions[iPrev * side + j].z) /
+                              ((iNext - iPrev) * dx);
+                double dzdy = (mesh.positions[i * side + jNext].z - mesh.positions[i * side + jPrev].z) /
+                              ((jNext - jPrev) * dy);
+                mesh.normals[i * side + j] = Point3D(dzdx, dzdy, -1, 0).normalize();
+            }
 
-    for (int i = 0; i <= steps; ++i) {
-        double x = x0 + i * dx;
-        for (int j = 0; j <= steps; ++j) {
-            double y = y0 + j * dy;
-            double z = func(x, y);
-            points.push_back(Point3D(x, y, z));
+            if (i == steps) continue;
+            for (int j = 0; j < steps; ++j) {
+                int idx = i * side + j;
+                int face = i * steps + j;
+                int* quad = &mesh.indices[(size_t)face * 4];
+                quad[0] = idx;
+                quad[1] = idx + 1;
+                quad[2] = idx + side + 1;
+                quad[3] = idx + side;
+                mesh.faceOffsets[face + 1] = (face + 1) * 4;
+            }
+        }
+    });
+
+    return mesh;
+}
+
+Mesh generateFunctionSurface(
+    const std::function<double(double, double)>& func,
+    double x0, double x1,
+    double y0, double y1,
+    int steps)
+{
+    return generateFunctionSurface<const std::function<double(double, double)>&>(func, x0, x1, y0, y1, steps);
+}
+
+// Адаптивная поверхность z = func(x, y) на ограниченном квадродереве.
+// Ячейка делится, пока значение функции в серединах рёбер и в центре отличается от
+// билинейной интерполяции по углам больше чем на tolerance (но не глубже maxDepth
+// и не мельче minDepth). Соседние листья отличаются не больше чем на один уровень,
+// поэтому на ребре листа лежит не больше одной лишней вершины: такой лист
+// разбивается веером треугольников из центра, остальные остаются четырёхугольниками.
+// Вершины на общих рёбрах общие, трещин между ячейками разного размера нет
+template <typename Func>
+Mesh generateAdaptiveFunctionSurface(
+    Func&& func,
+    double x0, double x1,
+    double y0, double y1,
+    double tolerance,
+    int maxDepth = 10,
+    int minDepth = 2)
+{
+    maxDepth = std::max(0, std::min(maxDepth, 14));
+    minDepth = std::max(0, std::min(minDepth, maxDepth));
+
+    // Целочисленная решётка на уровень глубже maxDepth, чтобы центры ячеек попадали в узлы
+    const long long resolution = 1LL << (maxDepth + 1);
+    auto cellKey = [](int level, long long ix, long long iy) {
+        return ((uint64_t)level << 58) | ((uint64_t)ix << 29) | (uint64_t)iy;
+    };
+    auto gridX = [&](long long gx) { return x0 + (x1 - x0) * gx / resolution; };
+    auto gridY = [&](long long gy) { return y0 + (y1 - y0) * gy / resolution; };
+
+    struct Cell { int level; long long ix, iy; };
+    std::unordered_set<uint64_t> leaves;
+    std::unordered_set<uint64_t> branches;
+
+    // Уточнение по уровням: погрешность всех ячеек уровня считается параллельно
+    std::vector<Cell> current = { {0, 0, 0} };
+    for (int level = 0; !current.empty(); level++) {
+        std::vector<char> refine(current.size(), 0);
+        parallelFor("surface", 0, (int)current.size(), 64, [&](int from, int to) {
+            for (int c = from; c < to; c++) {
+                const Cell& cell = current[c];
+                if (level >= maxDepth) continue;
+                if (level < minDepth) { refine[c] = 1; continue; }
+
+                long long size = resolution >> level;
+                double ax = gridX(cell.ix * size), bx = gridX((cell.ix + 1) * size);
+                double ay = gridY(cell.iy * size), by = gridY((cell.iy + 1) * size);
+                double mx = 0.5 * (ax + bx), my = 0.5 * (ay + by);
+                double f00 = func(ax, ay), f10 = func(bx, ay);
+                double f01 = func(ax, by), f11 = func(bx, by);
+
+                double error = std::max({
+                    std::abs(func(mx, ay) - 0.5 * (f00 + f10)),
+                    std::abs(func(mx, by) - 0.5 * (f01 + f11)),
+                    std::abs(func(ax, my) - 0.5 * (f00 + f01)),
+                    std::abs(func(bx, my) - 0.5 * (f10 + f11)),
+                    std::abs(func(mx, my) - 0.25 * (f00 + f10 + f01 + f11))
+                });
+                refine[c] = error > tolerance;
+            }
+        });
+
+        std::vector<Cell> next;
+        for (size_t c = 0; c < current.size(); c++) {
+            const Cell& cell = current[c];
+            if (!refine[c]) {
+                leaves.insert(cellKey(cell.level, cell.ix, cell.iy));
+                continue;
+            }
+            branches.insert(cellKey(cell.level, cell.ix, cell.iy));
+            for (int k = 0; k < 4; k++) {
+                next.push_back({ level + 1, cell.ix * 2 + (k & 1), cell.iy * 2 + (k >> 1) });
+            }
+        }
+        current.swap(next);
+    }
+
+    // Балансировка 2:1: у листа уровня L все соседи по рёбрам должны быть не крупнее L - 1
+    auto exists = [&](int level, long long ix, long long iy) {
+        uint64_t key = cellKey(level, ix, iy);
+        return leaves.count(key) || branches.count(key);
+    };
+    std::vector<Cell> pending;
+    std::function<void(int, long long, long long)> ensureCell = [&](int level, long long ix, long long iy) {
+        if (exists(level, ix, iy)) return;
+        ensureCell(level - 1, ix >> 1, iy >> 1);
+        // Родитель теперь существует и является листом - делим его
+        uint64_t parent = cellKey(level - 1, ix >> 1, iy >> 1);
+        leaves.erase(parent);
+        branches.insert(parent);
+        for (int k = 0; k < 4; k++) {
+            long long cx = (ix >> 1) * 2 + (k & 1), cy = (iy >> 1) * 2 + (k >> 1);
+            leaves.insert(cellKey(level, cx, cy));
+            pending.push_back({ level, cx, cy });
+        }
+    };
+
+    const int dirX[4] = { -1, 1, 0, 0 };
+    const int dirY[4] = { 0, 0, -1, 1 };
+    for (uint64_t key : leaves) {
+        pending.push_back({ (int)(key >> 58), (long long)((key >> 29) & 0x1FFFFFFF), (long long)(key & 0x1FFFFFFF) });
+    }
+    while (!pending.empty()) {
+        Cell cell = pending.back();
+        pending.pop_back();
+        if (cell.level < 2 || !leaves.count(cellKey(cell.level, cell.ix, cell.iy))) continue;
+        long long cellsAtLevel = 1LL << cell.level;
+        for (int d = 0; d < 4; d++) {
+            long long nx = cell.ix + dirX[d], ny = cell.iy + dirY[d];
+            if (nx < 0 || ny < 0 || nx >= cellsAtLevel || ny >= cellsAtLevel) continue;
+            ensureCell(cell.level - 1, nx >> 1, ny >> 1);
         }
     }
 
-    for (int i = 0; i < steps; ++i) {
-        for (int j = 0; j < steps; ++j) {
-            int idx = i * (steps + 1) + j;
-            float u1 = (float)i / steps;
-            float u2 = (float)(i+1) / steps;
-            float v1 = (float)j / steps;
-            float v2 = (float)(j+1) / steps;
-            
-            polygons.push_back(Polygon({
-                points[idx],
-                points[idx + 1],
-                points[idx + steps + 2],
-                points[idx + steps + 1]
-            }, {
-                Point3D(u1, v1, 0),
-                Point3D(u2, v1, 0),
-                Point3D(u2, v2, 0),
-                Point3D(u1, v2, 0)
-            }));
+    // Треугольники и четырёхугольники листьев; вершины общие через ключ узла решётки
+    std::vector<uint64_t> sortedLeaves(leaves.begin(), leaves.end());
+    std::sort(sortedLeaves.begin(), sortedLeaves.end());
+
+    Mesh mesh;
+    std::unordered_map<uint64_t, int> vertexOfNode;
+    std::vector<long long> nodeX, nodeY;
+    auto vertexAt = [&](long long gx, long long gy) {
+        uint64_t key = (uint64_t)gx * (resolution + 1) + gy;
+        auto it = vertexOfNode.find(key);
+        if (it != vertexOfNode.end()) return it->second;
+        int index = (int)nodeX.size();
+        vertexOfNode.emplace(key, index);
+        nodeX.push_back(gx);
+        nodeY.push_back(gy);
+        return index;
+    };
+
+    for (uint64_t key : sortedLeaves) {
+        int level = (int)(key >> 58);
+        long long ix = (key >> 29) & 0x1FFFFFFF, iy = key & 0x1FFFFFFF;
+        long long size = resolution >> level, half = size / 2;
+        long long gx = ix * size, gy = iy * size;
+        long long cellsAtLevel = 1LL << level;
+
+        // Соседняя ячейка того же уровня разделена - на общем ребре есть середина
+        auto finerAcross = [&](int dx, int dy) {
+            long long nx = ix + dx, ny = iy + dy;
+            if (nx < 0 || ny < 0 || nx >= cellsAtLevel || ny >= cellsAtLevel) return false;
+            return branches.count(cellKey(level, nx, ny)) > 0;
+        };
+
+        // Обход как у равномерной сетки: сначала вдоль y, затем вдоль x
+        std::vector<int> ring;
+        ring.push_back(vertexAt(gx, gy));
+        if (finerAcross(-1, 0)) ring.push_back(vertexAt(gx, gy + half));
+        ring.push_back(vertexAt(gx, gy + size));
+        if (finerAcross(0, 1)) ring.push_back(vertexAt(gx + half, gy + size));
+        ring.push_back(vertexAt(gx + size, gy + size));
+        if (finerAcross(1, 0)) ring.push_back(vertexAt(gx + size, gy + half));
+        ring.push_back(vertexAt(gx + size, gy));
+        if (finerAcross(0, -1)) ring.push_back(vertexAt(gx + half, gy));
+
+        if (ring.size() == 4) {
+            mesh.addFace({ ring[0], ring[1], ring[2], ring[3] });
+        } else {
+            int center = vertexAt(gx + half, gy + half);
+            for (size_t i = 0; i < ring.size(); i++) {
+                mesh.addFace({ center, ring[i], ring[(i + 1) % ring.size()] });
+            }
         }
     }
 
-    return Polyhedron(polygons);
+    // Значения функции и нормали в узлах считаются параллельно
+    int vertexCount = (int)nodeX.size();
+    mesh.positions.resize(vertexCount);
+    mesh.normals.resize(vertexCount);
+    mesh.texCoords.resize(vertexCount);
+    double hx = (x1 - x0) / resolution, hy = (y1 - y0) / resolution;
+    parallelFor("surface", 0, vertexCount, 1024, [&](int from, int to) {
+        for (int v = from; v < to; v++) {
+            double x = gridX(nodeX[v]), y = gridY(nodeY[v]);
+            double dzdx = (func(x + hx, y) - func(x - hx, y)) / (2 * hx);
+            double dzdy = (func(x, y + hy) - func(x, y - hy)) / (2 * hy);
+            mesh.positions[v] = Point3D(x, y, func(x, y));
+            mesh.normals[v] = Point3D(dzdx, dzdy, -1, 0).normalize();
+            mesh.texCoords[v] = Point3D((double)nodeX[v] / resolution, (double)nodeY[v] / resolution, 0);
+        }
+    });
+
+    return mesh;
 }
 
 #endif
\ No newline at end of file
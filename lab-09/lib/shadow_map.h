@@ -0,0 +1,252 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Растеризация только глубины - для карты теней и предварительного прохода по глубине.
+// Ни цвета, ни атрибутов: функции рёбер считаются один раз на строку и дальше
+// прибавляются на шаг по x, в буфер пишется меньшая глубина. Вершины уже в экранных
+// координатах (x, y - пиксели, z - глубина); обход в любую сторону, отсечения граней нет
+inline void rasterizeDepthOnly(float* depth, int width, int height,
+                               const Point3D& a, const Point3D& b, const Point3D& c) {
+    double area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (area == 0) return;
+    const Point3D& p1 = a;
+    const Point3D& p2 = area > 0 ? b : c;
+    const Point3D& p3 = area > 0 ? c : b;
+    area = std::abs(area);
+
+    int minX = std::max(0, (int)std::floor(std::min({ p1.x, p2.x, p3.x })));
+    int maxX = std::min(width - 1, (int)std::ceil(std::max({ p1.x, p2.x, p3.x })));
+    int minY = std::max(0, (int)std::floor(std::min({ p1.y, p2.y, p3.y })));
+    int maxY = std::min(height - 1, (int)std::ceil(std::max({ p1.y, p2.y, p3.y })));
+    if (minX > maxX || minY > maxY) return;
+
+    // Функция ребра e(x, y) = A * x + B * y + C, неотрицательна внутри треугольника;
+    // деление на площадь сразу даёт барицентрические координаты
+    auto edge = [area](const Point3D& from, const Point3D& to, double& A, double& B, double& C) {
+        A = (from.y - to.y) / area;
+        B = (to.x - from.x) / area;
+        C = (from.x * to.y - from.y * to.x) / area;
+    };
+    double A1, B1, C1, A2, B2, C2, A3, B3, C3;
+    edge(p2, p3, A1, B1, C1); // вес p1
+    edge(p3, p1, A2, B2, C2); // вес p2
+    edge(p1, p2, A3, B3, C3); // вес p3
+
+    // Глубина тоже линейна по экрану: z = zA * x + zB * y + zC
+    double zA = A1 * p1.z + A2 * p2.z + A3 * p3.z;
+    double zB = B1 * p1.z + B2 * p2.z + B3 * p3.z;
+    double zC = C1 * p1.z + C2 * p2.z + C3 * p3.z;
+
+    for (int y = minY; y <= maxY; y++) {
+        double py = y + 0.5, px = minX + 0.5;
+        double w1 = A1 * px + B1 * py + C1;
+        double w2 = A2 * px + B2 * py + C2;
+        double w3 = A3 * px + B3 * py + C3;
+        double z = zA * px + zB * py + zC;
+        float* row = depth + (size_t)y * width;
+        for (int x = minX; x <= maxX; x++) {
+            if (w1 >= 0 && w2 >= 0 && w3 >= 0 && z < row[x]) row[x] = (float)z;
+            w1 += A1;
+            w2 += A2;
+            w3 += A3;
+            z += zA;
+        }
+    }
+}
+
+// Объект, отбрасывающий тень
+struct ShadowCaster {
+    const Mesh* mesh;
+    Matrix4x4 model;
+};
+
+// Кубическая карта теней точечного источника: шесть граней 90°, в каждой - глубина NDC
+// ближайшего к источнику объекта. Карта перестраивается, только если сдвинулся
+// источник, сменился набор объектов или их матрицы, или вызывающий код сообщил
+// об изменении геометрии через номер версии.
+class ShadowMap {
+public:
+    explicit ShadowMap(int size = 512) : size(size), faces(6, std::vector<float>((size_t)size * size)) {}
+
+    // Возвращает true, если карта была перерисована
+    bool update(const Point3D& light, const std::vector<ShadowCaster>& casters, int geometryVersion) {
+        if (valid && sameAsCached(light, casters, geometryVersion)) return false;
+        lightPosition = light;
+        cachedCasters = casters;
+        cachedVersion = geometryVersion;
+        valid = true;
+
+        // Вершины переводятся в систему источника один раз на все грани куба
+        std::vector<std::vector<Point3D>> relative(casters.size());
+        for (size_t i = 0; i < casters.size(); i++) {
+            const Mesh& mesh = *casters[i].mesh;
+            relative[i].resize(mesh.vertexCount());
+            for (int v = 0; v < mesh.vertexCount(); v++) {
+                relative[i][v] = casters[i].model.transform(mesh.positions[v]) - light;
+            }
+        }
+
+        parallelFor("shadow map", 0, 6, 1, [&](int from, int to) {
+            for (int face = from; face < to; face++) renderFace(face, casters, relative);
+        });
+        return true;
+    }
+
+    // Доля света в точке: 0 - полная тень, 1 - освещена. PCF - среднее по 3x3 текселям.
+    // Точка сдвигается вдоль нормали (в сторону источника) на размер текселя,
+    // чтобы поверхность не затеняла сама себя
+    float visibility(const Point3D& worldPos, const Point3D& worldNormal) const {
+        if (!valid) return 1.0f;
+        Point3D toPoint = worldPos - lightPosition;
+        double distance = std::max({ std::abs(toPoint.x), std::abs(toPoint.y), std::abs(toPoint.z) });
+        if (distance < zNear) return 1.0f;
+        double texel = 2.0 * distance / size;
+        Point3D normal = worldNormal.dot(toPoint) > 0 ? worldNormal * -1.0 : worldNormal;
+        toPoint = toPoint + normal * (1.5 * texel);
+
+        int face = faceOf(toPoint);
+        double depth = toPoint.dot(axis(face, 0));
+        if (depth < zNear) return 1.0f;
+        double sx = (toPoint.dot(axis(face, 1)) / depth + 1.0) * 0.5 * size;
+        double sy = (1.0 - toPoint.dot(axis(face, 2)) / depth) * 0.5 * size;
+        int cx = (int)std::floor(sx), cy = (int)std::floor(sy);
+        double bias = 1.5 * texel;
+
+        const std::vector<float>& map = faces[face];
+        int lit = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            int y = std::max(0, std::min(size - 1, cy + dy));
+            for (int dx = -1; dx <= 1; dx++) {
+                int x = std::max(0, std::min(size - 1, cx + dx));
+                if (linearDepth(map[(size_t)y * size + x]) >= depth - bias) lit++;
+            }
+        }
+        return lit / 9.0f;
+    }
+
+    // Сбросить кэш: следующий update перерисует карту
+    void invalidate() { valid = false; }
+
+private:
+    static constexpr double zNear = 0.05;
+    static constexpr double zFar = 100.0;
+    // Базис грани: направление взгляда, вправо, вверх
+    static const Point3D& axis(int face, int k) {
+        static const Point3D axes[6][3] = {
+            { Point3D(1, 0, 0, 0), Point3D(0, 0, -1, 0), Point3D(0, 1, 0, 0) },
+            { Point3D(-1, 0, 0, 0), Point3D(0, 0, 1, 0), Point3D(0, 1, 0, 0) },
+            { Point3D(0, 1, 0, 0), Point3D(1, 0, 0, 0), Point3D(0, 0, -1, 0) },
+            { Point3D(0, -1, 0, 0), Point3D(1, 0, 0, 0), Point3D(0, 0, 1, 0) },
+            { Point3D(0, 0, 1, 0), Point3D(1, 0, 0, 0), Point3D(0, 1, 0, 0) },
+            { Point3D(0, 0, -1, 0), Point3D(-1, 0, 0, 0), Point3D(0, 1, 0, 0) },
+        };
+        return axes[face][k];
+    }
+
+    int size;
+    std::vector<std::vector<float>> faces;
+    bool valid = false;
+    Point3D lightPosition;
+    std::vector<ShadowCaster> cachedCasters;
+    int cachedVersion = 0;
+
+    static int faceOf(const Point3D& d) {
+        double ax = std::abs(d.x), ay = std::abs(d.y), az = std::abs(d.z);
+        if (ax >= ay && ax >= az) return d.x > 0 ? 0 : 1;
+        if (ay >= az) return d.y > 0 ? 2 : 3;
+        return d.z > 0 ? 4 : 5;
+    }
+
+    // Глубина NDC той же перспективы, что и createPerspectiveMatrix, и обратно
+    static double ndcDepth(double depth) {
+        return (zFar + zNear) / (zFar - zNear) - 2.0 * zFar * zNear / ((zFar - zNear) * depth);
+    }
+    static double linearDepth(float ndc) {
+        return 2.0 * zFar * zNear / ((zFar + zNear) - ndc * (zFar - zNear));
+    }
+
+    bool sameAsCached(const Point3D& light, const std::vector<ShadowCaster>& casters, int geometryVersion) const {
+        if (light.x != lightPosition.x || light.y != lightPosition.y || light.z != lightPosition.z) return false;
+        if (geometryVersion != cachedVersion || casters.size() != cachedCasters.size()) return false;
+        for (size_t i = 0; i < casters.size(); i++) {
+            if (casters[i].mesh != cachedCasters[i].mesh) return false;
+            if (!std::equal(&casters[i].model.m[0][0], &casters[i].model.m[0][0] + 16, &cachedCasters[i].model.m[0][0])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void renderFace(int face, const std::vector<ShadowCaster>& casters,
+                    const std::vector<std::vector<Point3D>>& relative) {
+        std::vector<float>& map = faces[face];
+        // 1 - дальняя плоскость: пустой тексель ничего не затеняет
+        std::fill(map.begin(), map.end(), 1.0f);
+        const Point3D& forward = axis(face, 0);
+        const Point3D& right = axis(face, 1);
+        const Point3D& up = axis(face, 2);
+
+        std::vector<Point3D> view;
+        for (size_t i = 0; i < casters.size(); i++) {
+            const Mesh& mesh = *casters[i].mesh;
+            view.resize(relative[i].size());
+            for (size_t v = 0; v < view.size(); v++) {
+                const Point3D& p = relative[i][v];
+                view[v] = Point3D(p.dot(right), p.dot(up), p.dot(forward));
+            }
+
+            for (int f = 0; f < mesh.faceCount(); f++) {
+                int faceSize = mesh.faceSize(f);
+                const int* indices = mesh.faceIndices(f);
+                for (int t = 1; t + 1 < faceSize; t++) {
+                    const Point3D& a = view[indices[0]];
+                    const Point3D& b = view[indices[t]];
+                    const Point3D& c = view[indices[t + 1]];
+                    if (a.z < zNear && b.z < zNear && c.z < zNear) continue;
+                    // Быстрый отказ по пирамиде видимости грани (|x|, |y| <= z)
+                    if (a.x > a.z && b.x > b.z && c.x > c.z) continue;
+                    if (-a.x > a.z && -b.x > b.z && -c.x > c.z) continue;
+                    if (a.y > a.z && b.y > b.z && c.y > c.z) continue;
+                    if (-a.y > a.z && -b.y > b.z && -c.y > c.z) continue;
+                    rasterizeClipped(map, a, b, c);
+                }
+            }
+        }
+    }
+
+    // Отсечение ближней плоскостью (z >= zNear) и проекция в пиксели грани
+    void rasterizeClipped(std::vector<float>& map, const Point3D& a, const Point3D& b, const Point3D& c) const {
+        Point3D input[3] = { a, b, c };
+        Point3D clipped[4];
+        int count = 0;
+        for (int i = 0; i < 3; i++) {
+            const Point3D& p = input[i];
+            const Point3D& q = input[(i + 1) % 3];
+            bool pIn = p.z >= zNear, qIn = q.z >= zNear;
+            if (pIn) clipped[count++] = p;
+            if (pIn != qIn) {
+                double t = (zNear - p.z) / (q.z - p.z);
+                clipped[count++] = p + (q - p) * t;
+            }
+        }
+        if (count < 3) return;
+
+        Point3D screen[4];
+        for (int i = 0; i < count; i++) {
+            const Point3D& p = clipped[i];
+            screen[i] = Point3D((p.x / p.z + 1.0) * 0.5 * size, (1.0 - p.y / p.z) * 0.5 * size, ndcDepth(p.z));
+        }
+        for (int i = 1; i + 1 < count; i++) {
+            rasterizeDepthOnly(map.data(), size, size, screen[0], screen[i], screen[i + 1]);
+        }
+    }
+};
+
+#endif
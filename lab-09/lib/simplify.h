@@ -0,0 +1,394 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// Упрощение сетки стягиванием рёбер по квадратичной метрике ошибки (QEM).
+//
+// Стягивается полуребро v -> u: вершина v исчезает, u остаётся на месте. Новых
+// вершин не появляется, поэтому текстурные координаты и нормали оставшихся вершин
+// не нужно интерполировать. Вершины с одинаковыми координатами (шов развёртки или
+// нормалей) считаются одной точкой топологии; точки шва не удаляются, так что швы
+// uv сохраняются точно. Точка границы может сдвинуться только вдоль границы, а
+// к её квадрике добавлены плоскости, перпендикулярные граничным рёбрам.
+class MeshSimplifier {
+public:
+    // triangles - тройки индексов вершин positions
+    MeshSimplifier(const std::vector<Point3D>& positions, const std::vector<int>& triangles)
+        : positions(positions) {
+        buildTopology(triangles);
+        buildQuadrics();
+        for (int g = 0; g < (int)groupPosition.size(); g++) {
+            pushEdges(g);
+        }
+    }
+
+    // Стягивает рёбра, пока треугольников больше targetTriangles и ошибка очередного
+    // стягивания не больше errorLimit. Возвращает false, если цель не достигнута
+    bool simplifyTo(int targetTriangles, double errorLimit = 1e30) {
+        while (liveTriangles > targetTriangles) {
+            if (heap.empty()) return false;
+            Candidate c = heap.top();
+            if (c.error > errorLimit * errorLimit) return false;
+            heap.pop();
+            if (removedGroup[c.from] || removedGroup[c.to]) continue;
+            if (c.fromVersion != version[c.from] || c.toVersion != version[c.to]) continue;
+            int keepVertex;
+            if (!canCollapse(c.from, c.to, keepVertex)) continue;
+            collapse(c.from, c.to, keepVertex);
+            maxError = std::max(maxError, c.error);
+        }
+        return true;
+    }
+
+    int triangleCount() const { return liveTriangles; }
+
+    // Наибольшее отклонение от исходной поверхности среди выполненных стягиваний
+    // (корень из средней квадратичной ошибки по плоскостям квадрики)
+    double error() const { return std::sqrt(std::max(0.0, maxError)); }
+
+    // Индексы оставшихся треугольников (по исходным вершинам)
+    std::vector<int> triangles() const {
+        std::vector<int> result;
+        result.reserve((size_t)liveTriangles * 3);
+        for (size_t t = 0; t < triangleRemoved.size(); t++) {
+            if (triangleRemoved[t]) continue;
+            result.insert(result.end(), corners.begin() + t * 3, corners.begin() + t * 3 + 3);
+        }
+        return result;
+    }
+
+private:
+    // Симметричная матрица 4x4 квадрики: 10 коэффициентов и суммарный вес плоскостей
+    struct Quadric {
+        double a[10] = {};
+        double weight = 0;
+
+        void addPlane(const Point3D& n, double d, double w) {
+            double p[4] = { n.x, n.y, n.z, d };
+            int k = 0;
+            for (int i = 0; i < 4; i++) {
+                for (int j = i; j < 4; j++) {
+                    a[k++] += w * p[i] * p[j];
+                }
+            }
+            weight += w;
+        }
+
+        void add(const Quadric& q) {
+            for (int i = 0; i < 10; i++) a[i] += q.a[i];
+            weight += q.weight;
+        }
+
+        double evaluate(const Point3D& p) const {
+            double v[4] = { p.x, p.y, p.z, 1.0 };
+            double sum = 0;
+            int k = 0;
+            for (int i = 0; i < 4; i++) {
+                for (int j = i; j < 4; j++) {
+                    sum += (i == j ? 1.0 : 2.0) * a[k++] * v[i] * v[j];
+                }
+            }
+            return sum;
+        }
+    };
+
+    struct Candidate {
+        double error;
+        int from, to;
+        int fromVersion, toVersion;
+        bool operator<(const Candidate& other) const { return error > other.error; }
+    };
+
+    void buildTopology(const std::vector<int>& triangles) {
+        std::unordered_map<Point3D, int, PointHash, PointEqual> groupOf;
+        vertexGroup.resize(positions.size());
+        for (size_t v = 0; v < positions.size(); v++) {
+            auto inserted = groupOf.emplace(positions[v], (int)groupPosition.size());
+            if (inserted.second) {
+                groupPosition.push_back(positions[v]);
+                seam.push_back(false);
+            } else {
+                // Одна точка, несколько вершин - шов атрибутов
+                seam[inserted.first->second] = true;
+            }
+            vertexGroup[v] = inserted.first->second;
+        }
+
+        int groupCount = (int)groupPosition.size();
+        groupTriangles.resize(groupCount);
+        removedGroup.assign(groupCount, false);
+        version.assign(groupCount, 0);
+        boundary.assign(groupCount, false);
+
+        for (size_t t = 0; t + 2 < triangles.size(); t += 3) {
+            int a = triangles[t], b = triangles[t + 1], c = triangles[t + 2];
+            if (vertexGroup[a] == vertexGroup[b] || vertexGroup[b] == vertexGroup[c] ||
+                vertexGroup[a] == vertexGroup[c]) continue;
+            int index = (int)triangleRemoved.size();
+            corners.insert(corners.end(), { a, b, c });
+            triangleRemoved.push_back(false);
+            for (int v : { a, b, c }) groupTriangles[vertexGroup[v]].push_back(index);
+        }
+        liveTriangles = (int)triangleRemoved.size();
+    }
+
+    int groupAt(int triangle, int corner) const { return vertexGroup[corners[triangle * 3 + corner]]; }
+
+    Point3D triangleNormal(int t, int movedGroup = -1, const Point3D& movedTo = Point3D()) const {
+        Point3D p[3];
+        for (int k = 0; k < 3; k++) {
+            int g = groupAt(t, k);
+            p[k] = g == movedGroup ? movedTo : groupPosition[g];
+        }
+        return (p[1] - p[0]).cross(p[2] - p[0]);
+    }
+
+    void buildQuadrics() {
+        quadric.assign(groupPosition.size(), Quadric());
+        std::unordered_map<long long, int> edgeUse;
+        auto edgeKey = [&](int a, int b) { return (long long)std::min(a, b) * (long long)groupPosition.size() + std::max(a, b); };
+
+        for (int t = 0; t < (int)triangleRemoved.size(); t++) {
+            Point3D n = triangleNormal(t);
+            double area = n.length() * 0.5;
+            if (area <= 0) continue;
+            n = n.normalize();
+            double d = -n.dot(groupPosition[groupAt(t, 0)]);
+            for (int k = 0; k < 3; k++) {
+                quadric[groupAt(t, k)].addPlane(n, d, area);
+                edgeUse[edgeKey(groupAt(t, k), groupAt(t, (k + 1) % 3))]++;
+            }
+        }
+
+        // Граничные рёбра: плоскость через ребро перпендикулярно грани с большим весом
+        for (int t = 0; t < (int)triangleRemoved.size(); t++) {
+            Point3D n = triangleNormal(t).normalize();
+            for (int k = 0; k < 3; k++) {
+                int a = groupAt(t, k), b = groupAt(t, (k + 1) % 3);
+                if (edgeUse[edgeKey(a, b)] != 1) continue;
+                boundary[a] = boundary[b] = true;
+                Point3D edge = groupPosition[b] - groupPosition[a];
+                double length = edge.length();
+                if (length <= 0) continue;
+                Point3D side = edge.cross(n).normalize();
+                double w = 10.0 * length * length;
+                quadric[a].addPlane(side, -side.dot(groupPosition[a]), w);
+                quadric[b].addPlane(side, -side.dot(groupPosition[a]), w);
+            }
+        }
+    }
+
+    template <typename Visit>
+    void forEachNeighbor(int g, Visit visit) const {
+        for (int t : groupTriangles[g]) {
+            if (triangleRemoved[t]) continue;
+            for (int k = 0; k < 3; k++) {
+                int other = groupAt(t, k);
+                if (other != g) visit(other);
+            }
+        }
+    }
+
+    double collapseError(int from, int to) const {
+        Quadric q = quadric[from];
+        q.add(quadric[to]);
+        return q.weight > 0 ? q.evaluate(groupPosition[to]) / q.weight : 0.0;
+    }
+
+    void pushEdges(int g) {
+        std::vector<int> neighbors;
+        forEachNeighbor(g, [&](int n) { neighbors.push_back(n); });
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+        for (int n : neighbors) {
+            if (!seam[g]) heap.push({ collapseError(g, n), g, n, version[g], version[n] });
+            if (!seam[n]) heap.push({ collapseError(n, g), n, g, version[n], version[g] });
+        }
+    }
+
+    bool canCollapse(int from, int to, int& keepVertex) const {
+        if (seam[from]) return false;
+
+        // Треугольники на ребре и вершина u, которой заменятся углы v
+        int sharedTriangles = 0;
+        keepVertex = -1;
+        for (int t : groupTriangles[from]) {
+            if (triangleRemoved[t]) continue;
+            for (int k = 0; k < 3; k++) {
+                if (groupAt(t, k) != to) continue;
+                sharedTriangles++;
+                int vertex = corners[t * 3 + k];
+                if (keepVertex >= 0 && keepVertex != vertex) return false;
+                keepVertex = vertex;
+            }
+        }
+        if (sharedTriangles == 0) return false;
+        // Граничная точка сдвигается только вдоль границы
+        if (boundary[from] && sharedTriangles != 1) return false;
+
+        // Условие связности: общих соседей столько же, сколько треугольников на ребре
+        std::vector<int> fromNeighbors, toNeighbors;
+        forEachNeighbor(from, [&](int n) { fromNeighbors.push_back(n); });
+        forEachNeighbor(to, [&](int n) { toNeighbors.push_back(n); });
+        std::sort(fromNeighbors.begin(), fromNeighbors.end());
+        fromNeighbors.erase(std::unique(fromNeighbors.begin(), fromNeighbors.end()), fromNeighbors.end());
+        std::sort(toNeighbors.begin(), toNeighbors.end());
+        toNeighbors.erase(std::unique(toNeighbors.begin(), toNeighbors.end()), toNeighbors.end());
+        std::vector<int> common;
+        std::set_intersection(fromNeighbors.begin(), fromNeighbors.end(),
+                              toNeighbors.begin(), toNeighbors.end(), std::back_inserter(common));
+        if ((int)common.size() != sharedTriangles) return false;
+
+        // Оставшиеся треугольники вокруг v не должны перевернуться или выродиться
+        for (int t : groupTriangles[from]) {
+            if (triangleRemoved[t]) continue;
+            bool hasTo = groupAt(t, 0) == to || groupAt(t, 1) == to || groupAt(t, 2) == to;
+            if (hasTo) continue;
+            Point3D before = triangleNormal(t);
+            Point3D after = triangleNormal(t, from, groupPosition[to]);
+            if (after.length() <= 1e-12 * (1.0 + before.length())) return false;
+            if (before.dot(after) <= 0.2 * before.length() * after.length()) return false;
+        }
+        return true;
+    }
+
+    void collapse(int from, int to, int keepVertex) {
+        for (int t : groupTriangles[from]) {
+            if (triangleRemoved[t]) continue;
+            bool hasTo = groupAt(t, 0) == to || groupAt(t, 1) == to || groupAt(t, 2) == to;
+            if (hasTo) {
+                triangleRemoved[t] = true;
+                liveTriangles--;
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                if (groupAt(t, k) == from) corners[t * 3 + k] = keepVertex;
+            }
+            groupTriangles[to].push_back(t);
+        }
+        groupTriangles[from].clear();
+        removedGroup[from] = true;
+        quadric[to].add(quadric[from]);
+        boundary[to] = boundary[to] || boundary[from];
+
+        // Убираем удалённые треугольники из списка u, иначе списки только растут
+        auto& list = groupTriangles[to];
+        list.erase(std::remove_if(list.begin(), list.end(), [&](int t) { return triangleRemoved[t]; }), list.end());
+
+        version[to]++;
+        pushEdges(to);
+    }
+
+    std::vector<Point3D> positions;
+    std::vector<int> vertexGroup;
+    std::vector<Point3D> groupPosition;
+    std::vector<std::vector<int>> groupTriangles;
+    std::vector<bool> seam;
+    std::vector<bool> boundary;
+    std::vector<bool> removedGroup;
+    std::vector<int> version;
+    std::vector<Quadric> quadric;
+
+    std::vector<int> corners;
+    std::vector<bool> triangleRemoved;
+    int liveTriangles = 0;
+
+    std::priority_queue<Candidate> heap;
+    double maxError = 0;
+};
+
+// Уровень детализации: сетка и её погрешность относительно исходной (в единицах модели)
+struct MeshLod {
+    Mesh mesh;
+    double error;
+};
+
+struct LodChain {
+    std::vector<MeshLod> levels; // levels[0] - исходная сетка
+    Point3D center;
+    double radius = 0;
+};
+
+// Цепочка LOD: каждый следующий уровень примерно в reduction раз меньше по числу
+// треугольников. Все уровни получаются за один проход упрощения; упрощение
+// останавливается, когда погрешность доходит до maxRelativeError от радиуса модели
+inline LodChain buildLodChain(const Mesh& mesh, int maxLevels = 5, double reduction = 0.5,
+                              int minTriangles = 32, double maxRelativeError = 0.05) {
+    LodChain chain;
+    chain.levels.push_back({ mesh, 0.0 });
+    chain.center = mesh.getCenter();
+    for (const auto& p : mesh.positions) {
+        chain.radius = std::max(chain.radius, (p - chain.center).length());
+    }
+
+    std::vector<int> triangles;
+    for (int f = 0; f < mesh.faceCount(); f++) {
+        const int* face = mesh.faceIndices(f);
+        for (int i = 1; i + 1 < mesh.faceSize(f); i++) {
+            triangles.insert(triangles.end(), { face[0], face[i], face[i + 1] });
+        }
+    }
+
+    MeshSimplifier simplifier(mesh.positions, triangles);
+    int target = simplifier.triangleCount();
+    for (int level = 1; level < maxLevels; level++) {
+        int previous = simplifier.triangleCount();
+        target = (int)(target * reduction);
+        if (target < minTriangles) break;
+        simplifier.simplifyTo(target, chain.radius * maxRelativeError);
+        // Дальше упростить почти не удалось (швы, границы) - новый уровень не нужен
+        if (simplifier.triangleCount() > previous * 0.9) break;
+
+        // Вершины, на которые больше не ссылается ни один треугольник, отбрасываются
+        std::vector<int> remaining = simplifier.triangles();
+        std::vector<int> remap(mesh.vertexCount(), -1);
+        MeshLod lod;
+        lod.error = simplifier.error();
+        for (size_t i = 0; i < remaining.size(); i += 3) {
+            int face[3];
+            for (int k = 0; k < 3; k++) {
+                int v = remaining[i + k];
+                if (remap[v] < 0) {
+                    remap[v] = lod.mesh.vertexCount();
+                    lod.mesh.positions.push_back(mesh.positions[v]);
+                    if (mesh.hasNormals()) lod.mesh.normals.push_back(mesh.normals[v]);
+                    if (mesh.hasTexCoords()) lod.mesh.texCoords.push_back(mesh.texCoords[v]);
+                }
+                face[k] = remap[v];
+            }
+            lod.mesh.addFace({ face[0], face[1], face[2] });
+        }
+        chain.levels.push_back(std::move(lod));
+    }
+    return chain;
+}
+
+// Самый грубый уровень, погрешность которого на экране не больше pixelError.
+// modelView переводит модель в систему камеры, pixelsPerUnit - пикселей на единицу
+// длины на расстоянии 1 (высота окна / (2 tg(fov / 2)))
+inline int selectLod(const LodChain& chain, const Matrix4x4& modelView, double pixelsPerUnit, double pixelError = 1.0) {
+    if (chain.levels.size() <= 1) return 0;
+    double scale = 0;
+    for (int col = 0; col < 3; col++) {
+        scale = std::max(scale, std::sqrt(modelView.m[0][col] * modelView.m[0][col] +
+                                          modelView.m[1][col] * modelView.m[1][col] +
+                                          modelView.m[2][col] * modelView.m[2][col]));
+    }
+    Point3D center = modelView.transform(chain.center);
+    double distance = std::max(center.length() - chain.radius * scale, 1e-3);
+    for (int level = (int)chain.levels.size() - 1; level > 0; level--) {
+        if (chain.levels[level].error * scale * pixelsPerUnit / distance <= pixelError) return level;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,478 @@
+#ifndef SUBDIVISION_H
+#define SUBDIVISION_H
+
+#include "geometry.h"
+#include "half_edge.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+enum class SubdivisionScheme {
+    CatmullClark, // четырёхугольники, подходит для куба и поверхностей вращения
+    Loop          // треугольники, подходит для икосаэдра и треугольных сеток
+};
+
+// Поверхность подразделения, заранее сведённая к таблице шаблонов (stencils).
+//
+// При построении уровни подразделения проходятся один раз: для каждой новой точки
+// записывается её линейная комбинация точек предыдущего уровня, и комбинации сразу
+// перемножаются с таблицей предыдущего уровня. В итоге каждая точка последнего уровня -
+// разреженная строка весов по вершинам управляющей сетки. Пересчёт после правки или
+// анимации управляющей сетки - параллельное умножение разреженной матрицы на вектор,
+// связность и текстурные координаты при этом не перестраиваются.
+//
+// Вершины управляющей сетки с одинаковыми координатами (швы) подразделяются как одна
+// точка; текстурные координаты подразделяются линейно по углам граней (face-varying),
+// поэтому шов текстуры остаётся на месте и не расползается.
+class SubdivisionSurface {
+public:
+    SubdivisionSurface(const Mesh& control, int levels, SubdivisionScheme scheme)
+        : scheme(scheme), controlCount(control.vertexCount()) {
+        Level level = controlLevel(control);
+        withTexCoords = control.hasTexCoords();
+
+        // Единичные шаблоны нулевого уровня: точка - первая вершина с такими координатами
+        std::vector<int> representative(level.pointCount, -1);
+        for (int v = 0; v < control.vertexCount(); v++) {
+            int& r = representative[pointOfControl[v]];
+            if (r < 0) r = v;
+        }
+        stencilOffsets.resize(level.pointCount + 1);
+        for (int p = 0; p <= level.pointCount; p++) stencilOffsets[p] = p;
+        stencilSources = representative;
+        stencilWeights.assign(level.pointCount, 1.0);
+
+        // Каждый уровень увеличивает число граней примерно вчетверо
+        const int maxFaces = 2000000;
+        levelCount = 0;
+        for (int l = 0; l < levels && level.faceCount() * 4 <= maxFaces; l++) {
+            Level next;
+            LocalStencils local;
+            refine(level, next, local);
+            compose(local);
+            level = std::move(next);
+            levelCount++;
+        }
+        buildRefinedMesh(level);
+    }
+
+    // Loop для чисто треугольных сеток, Катмулл-Кларк для остальных
+    static SubdivisionScheme defaultScheme(const Mesh& mesh) {
+        for (int f = 0; f < mesh.faceCount(); f++) {
+            if (mesh.faceSize(f) != 3) return SubdivisionScheme::CatmullClark;
+        }
+        return SubdivisionScheme::Loop;
+    }
+
+    int levels() const { return levelCount; }
+    int stencilEntryCount() const { return (int)stencilWeights.size(); }
+    const Mesh& topology() const { return refined; }
+
+    Mesh evaluate(const std::vector<Point3D>& controlPositions) const {
+        Mesh mesh = refined;
+        evaluate(controlPositions, mesh);
+        return mesh;
+    }
+
+    // Пересчитывает положения и нормали out по новым положениям вершин управляющей сетки.
+    // Если out ещё не подразделённая сетка, в него копируется связность
+    void evaluate(const std::vector<Point3D>& controlPositions, Mesh& out) const {
+        if (out.vertexCount() != refined.vertexCount() || out.indices.size() != refined.indices.size()) out = refined;
+        if ((int)controlPositions.size() != controlCount) return;
+
+        int pointCount = (int)stencilOffsets.size() - 1;
+        std::vector<Point3D> points(pointCount);
+        parallelFor("subdivision", 0, pointCount, 1024, [&](int from, int to) {
+            for (int p = from; p < to; p++) {
+                double x = 0, y = 0, z = 0;
+                for (int s = stencilOffsets[p]; s < stencilOffsets[p + 1]; s++) {
+                    const Point3D& c = controlPositions[stencilSources[s]];
+                    x += stencilWeights[s] * c.x;
+                    y += stencilWeights[s] * c.y;
+                    z += stencilWeights[s] * c.z;
+                }
+                points[p] = Point3D(x, y, z);
+            }
+        });
+
+        int faceCount = refined.faceCount();
+        std::vector<Point3D> faceNormals(faceCount);
+        parallelFor("subdivision", 0, faceCount, 4096, [&](int from, int to) {
+            for (int f = from; f < to; f++) {
+                const int* face = refined.faceIndices(f);
+                const Point3D& p0 = points[vertexPoint[face[0]]];
+                Point3D normal(0, 0, 0, 0);
+                for (int i = 1; i + 1 < refined.faceSize(f); i++) {
+                    Point3D a = points[vertexPoint[face[i]]] - p0;
+                    Point3D b = points[vertexPoint[face[i + 1]]] - p0;
+                    normal = normal + a.cross(b);
+                }
+                faceNormals[f] = normal;
+            }
+        });
+
+        std::vector<Point3D> pointNormals(pointCount);
+        parallelFor("subdivision", 0, pointCount, 4096, [&](int from, int to) {
+            for (int p = from; p < to; p++) {
+                Point3D sum(0, 0, 0, 0);
+                for (int i = pointFaceOffsets[p]; i < pointFaceOffsets[p + 1]; i++) sum = sum + faceNormals[pointFaces[i]];
+                pointNormals[p] = sum.normalize();
+            }
+        });
+
+        out.normals.resize(out.vertexCount());
+        parallelFor("subdivision", 0, out.vertexCount(), 4096, [&](int from, int to) {
+            for (int v = from; v < to; v++) {
+                out.positions[v] = points[vertexPoint[v]];
+                out.normals[v] = pointNormals[vertexPoint[v]];
+            }
+        });
+    }
+
+private:
+    // Уровень подразделения: грани как списки точек и текстурные координаты углов
+    struct Level {
+        std::vector<int> corners;
+        std::vector<int> offsets{ 0 };
+        std::vector<Point3D> uvs;
+        int pointCount = 0;
+
+        int faceCount() const { return (int)offsets.size() - 1; }
+        void addFace(const std::vector<int>& face, const std::vector<Point3D>& faceUvs) {
+            corners.insert(corners.end(), face.begin(), face.end());
+            uvs.insert(uvs.end(), faceUvs.begin(), faceUvs.end());
+            offsets.push_back((int)corners.size());
+        }
+    };
+
+    // Шаблоны точек нового уровня по точкам предыдущего (повторы источников допустимы)
+    struct LocalStencils {
+        std::vector<int> offsets{ 0 };
+        std::vector<int> sources;
+        std::vector<double> weights;
+
+        void add(int source, double weight) {
+            sources.push_back(source);
+            weights.push_back(weight);
+        }
+        void close() { offsets.push_back((int)sources.size()); }
+    };
+
+    struct Edge {
+        int a, b;
+        int faceCount = 0;
+        int opposite[2] = { -1, -1 }; // противолежащие точки треугольников (для Loop)
+        int faces[2] = { -1, -1 };
+    };
+
+    Level controlLevel(const Mesh& control) {
+        HalfEdgeMesh topology(control);
+        pointOfControl.resize(control.vertexCount());
+        for (int v = 0; v < control.vertexCount(); v++) pointOfControl[v] = topology.point(v);
+
+        Level level;
+        level.pointCount = topology.pointCount();
+        bool hasUv = control.hasTexCoords();
+        for (int f = 0; f < control.faceCount(); f++) {
+            const int* face = control.faceIndices(f);
+            // Повторяющиеся подряд точки (полюс поверхности вращения) схлопываются
+            std::vector<int> points;
+            std::vector<Point3D> uvs;
+            for (int i = 0; i < control.faceSize(f); i++) {
+                int point = topology.point(face[i]);
+                if (!points.empty() && points.back() == point) continue;
+                points.push_back(point);
+                uvs.push_back(hasUv ? control.texCoords[face[i]] : Point3D(0, 0, 0));
+            }
+            while (points.size() > 1 && points.back() == points.front()) {
+                points.pop_back();
+                uvs.pop_back();
+            }
+            int n = (int)points.size();
+            if (n < 3) continue;
+
+            if (scheme == SubdivisionScheme::Loop) {
+                // Схема Loop определена для треугольников: многоугольники режутся веером
+                for (int i = 1; i + 1 < n; i++) {
+                    level.addFace({ points[0], points[i], points[i + 1] }, { uvs[0], uvs[i], uvs[i + 1] });
+                }
+            } else {
+                level.addFace(points, uvs);
+            }
+        }
+        return level;
+    }
+
+    void refine(const Level& level, Level& next, LocalStencils& local) const {
+        int pointCount = level.pointCount;
+        int faceCount = level.faceCount();
+
+        // Рёбра уровня и ребро каждого угла (от угла к следующему)
+        std::vector<Edge> edges;
+        std::vector<int> cornerEdge(level.corners.size());
+        std::unordered_map<uint64_t, int> edgeIds;
+        edgeIds.reserve(level.corners.size());
+        for (int f = 0; f < faceCount; f++) {
+            int begin = level.offsets[f], n = level.offsets[f + 1] - begin;
+            for (int i = 0; i < n; i++) {
+                int a = level.corners[begin + i], b = level.corners[begin + (i + 1) % n];
+                uint64_t key = ((uint64_t)(uint32_t)std::min(a, b) << 32) | (uint32_t)std::max(a, b);
+                auto inserted = edgeIds.emplace(key, (int)edges.size());
+                if (inserted.second) edges.push_back({ a, b });
+                Edge& edge = edges[inserted.first->second];
+                if (edge.faceCount < 2) {
+                    edge.faces[edge.faceCount] = f;
+                    edge.opposite[edge.faceCount] = level.corners[begin + (i + 2) % n];
+                }
+                edge.faceCount++;
+                cornerEdge[begin + i] = inserted.first->second;
+            }
+        }
+        int edgeCount = (int)edges.size();
+        // Край сетки, а также ребро больше чем двух граней - острое
+        auto isSharp = [&](const Edge& edge) { return edge.faceCount != 2; };
+
+        // Рёбра и грани каждой точки (CSR)
+        std::vector<int> pointEdgeOffsets(pointCount + 1, 0), pointFaceOffsetsLocal(pointCount + 1, 0);
+        for (const Edge& edge : edges) {
+            pointEdgeOffsets[edge.a + 1]++;
+            pointEdgeOffsets[edge.b + 1]++;
+        }
+        for (int c : level.corners) pointFaceOffsetsLocal[c + 1]++;
+        for (int p = 0; p < pointCount; p++) {
+            pointEdgeOffsets[p + 1] += pointEdgeOffsets[p];
+            pointFaceOffsetsLocal[p + 1] += pointFaceOffsetsLocal[p];
+        }
+        std::vector<int> pointEdgeList(pointEdgeOffsets[pointCount]), pointFaceList(pointFaceOffsetsLocal[pointCount]);
+        {
+            std::vector<int> fillEdges(pointEdgeOffsets.begin(), pointEdgeOffsets.end() - 1);
+            std::vector<int> fillFaces(pointFaceOffsetsLocal.begin(), pointFaceOffsetsLocal.end() - 1);
+            for (int e = 0; e < edgeCount; e++) {
+                pointEdgeList[fillEdges[edges[e].a]++] = e;
+                pointEdgeList[fillEdges[edges[e].b]++] = e;
+            }
+            for (int f = 0; f < faceCount; f++) {
+                for (int c = level.offsets[f]; c < level.offsets[f + 1]; c++) pointFaceList[fillFaces[level.corners[c]]++] = f;
+            }
+        }
+
+        auto addFaceAverage = [&](int f, double weight) {
+            int begin = level.offsets[f], n = level.offsets[f + 1] - begin;
+            for (int i = 0; i < n; i++) local.add(level.corners[begin + i], weight / n);
+        };
+
+        // Точки-вершины: новые положения старых точек
+        for (int p = 0; p < pointCount; p++) {
+            int valence = pointEdgeOffsets[p + 1] - pointEdgeOffsets[p];
+            int sharpCount = 0;
+            int sharpNeighbours[2] = { -1, -1 };
+            for (int i = pointEdgeOffsets[p]; i < pointEdgeOffsets[p + 1]; i++) {
+                const Edge& edge = edges[pointEdgeList[i]];
+                if (!isSharp(edge)) continue;
+                if (sharpCount < 2) sharpNeighbours[sharpCount] = edge.a == p ? edge.b : edge.a;
+                sharpCount++;
+            }
+
+            if (valence == 0 || sharpCount > 2 || sharpCount == 1) {
+                // Угол края или особая точка остаются на месте
+                local.add(p, 1.0);
+            } else if (sharpCount == 2) {
+                local.add(p, 0.75);
+                local.add(sharpNeighbours[0], 0.125);
+                local.add(sharpNeighbours[1], 0.125);
+            } else if (scheme == SubdivisionScheme::Loop) {
+                double n = valence;
+                double beta = valence == 3 ? 3.0 / 16.0 : 3.0 / (8.0 * n);
+                local.add(p, 1.0 - n * beta);
+                for (int i = pointEdgeOffsets[p]; i < pointEdgeOffsets[p + 1]; i++) {
+                    const Edge& edge = edges[pointEdgeList[i]];
+                    local.add(edge.a == p ? edge.b : edge.a, beta);
+                }
+            } else {
+                // Катмулл-Кларк: (F + 2R + (n - 3) P) / n
+                double n = valence;
+                int faces = pointFaceOffsetsLocal[p + 1] - pointFaceOffsetsLocal[p];
+                for (int i = pointFaceOffsetsLocal[p]; i < pointFaceOffsetsLocal[p + 1]; i++) {
+                    addFaceAverage(pointFaceList[i], 1.0 / (n * faces));
+                }
+                for (int i = pointEdgeOffsets[p]; i < pointEdgeOffsets[p + 1]; i++) {
+                    const Edge& edge = edges[pointEdgeList[i]];
+                    local.add(edge.a, 1.0 / (n * n));
+                    local.add(edge.b, 1.0 / (n * n));
+                }
+                local.add(p, (n - 3) / n);
+            }
+            local.close();
+        }
+
+        // Точки на рёбрах
+        for (const Edge& edge : edges) {
+            if (isSharp(edge)) {
+                local.add(edge.a, 0.5);
+                local.add(edge.b, 0.5);
+            } else if (scheme == SubdivisionScheme::Loop) {
+                local.add(edge.a, 0.375);
+                local.add(edge.b, 0.375);
+                local.add(edge.opposite[0], 0.125);
+                local.add(edge.opposite[1], 0.125);
+            } else {
+                local.add(edge.a, 0.25);
+                local.add(edge.b, 0.25);
+                addFaceAverage(edge.faces[0], 0.25);
+                addFaceAverage(edge.faces[1], 0.25);
+            }
+            local.close();
+        }
+
+        // Точки в центрах граней (только Катмулл-Кларк)
+        if (scheme == SubdivisionScheme::CatmullClark) {
+            for (int f = 0; f < faceCount; f++) {
+                addFaceAverage(f, 1.0);
+                local.close();
+            }
+        }
+
+        // Новые грани с сохранением обхода
+        next.pointCount = pointCount + edgeCount + (scheme == SubdivisionScheme::CatmullClark ? faceCount : 0);
+        next.corners.reserve(level.corners.size() * 4);
+        next.uvs.reserve(level.corners.size() * 4);
+        auto mid = [](const Point3D& a, const Point3D& b) { return (a + b) * 0.5; };
+        for (int f = 0; f < faceCount; f++) {
+            int begin = level.offsets[f], n = level.offsets[f + 1] - begin;
+            auto corner = [&](int i) { return level.corners[begin + (i + n) % n]; };
+            auto uv = [&](int i) { return level.uvs[begin + (i + n) % n]; };
+            auto edgePoint = [&](int i) { return pointCount + cornerEdge[begin + (i + n) % n]; };
+
+            if (scheme == SubdivisionScheme::Loop) {
+                Point3D m01 = mid(uv(0), uv(1)), m12 = mid(uv(1), uv(2)), m20 = mid(uv(2), uv(0));
+                next.addFace({ corner(0), edgePoint(0), edgePoint(2) }, { uv(0), m01, m20 });
+                next.addFace({ corner(1), edgePoint(1), edgePoint(0) }, { uv(1), m12, m01 });
+                next.addFace({ corner(2), edgePoint(2), edgePoint(1) }, { uv(2), m20, m12 });
+                next.addFace({ edgePoint(0), edgePoint(1), edgePoint(2) }, { m01, m12, m20 });
+            } else {
+                int facePoint = pointCount + edgeCount + f;
+                Point3D center(0, 0, 0);
+                for (int i = 0; i < n; i++) center = center + uv(i) * (1.0 / n);
+                for (int i = 0; i < n; i++) {
+                    next.addFace({ corner(i), edgePoint(i), facePoint, edgePoint(i - 1) },
+                                 { uv(i), mid(uv(i), uv(i + 1)), center, mid(uv(i - 1), uv(i)) });
+                }
+            }
+        }
+    }
+
+    // Таблица нового уровня = локальные шаблоны x таблица предыдущего уровня.
+    // Блоки точек считаются параллельно, у каждого свой плотный накопитель
+    void compose(const LocalStencils& local) {
+        int pointCount = (int)local.offsets.size() - 1;
+        const int blockSize = 1024;
+        int blockCount = (pointCount + blockSize - 1) / blockSize;
+        std::vector<std::vector<int>> blockSizes(blockCount), blockSources(blockCount);
+        std::vector<std::vector<double>> blockWeights(blockCount);
+
+        parallelFor("subdivision", 0, blockCount, 1, [&](int fromBlock, int toBlock) {
+            std::vector<double> accumulator(controlCount, 0.0);
+            std::vector<int> touched;
+            for (int b = fromBlock; b < toBlock; b++) {
+                int end = std::min(pointCount, (b + 1) * blockSize);
+                for (int p = b * blockSize; p < end; p++) {
+                    for (int l = local.offsets[p]; l < local.offsets[p + 1]; l++) {
+                        int source = local.sources[l];
+                        for (int s = stencilOffsets[source]; s < stencilOffsets[source + 1]; s++) {
+                            int c = stencilSources[s];
+                            if (accumulator[c] == 0.0) touched.push_back(c);
+                            accumulator[c] += local.weights[l] * stencilWeights[s];
+                        }
+                    }
+                    std::sort(touched.begin(), touched.end());
+                    int count = 0;
+                    for (int c : touched) {
+                        if (std::abs(accumulator[c]) > 1e-12) {
+                            blockSources[b].push_back(c);
+                            blockWeights[b].push_back(accumulator[c]);
+                            count++;
+                        }
+                        accumulator[c] = 0.0;
+                    }
+                    touched.clear();
+                    blockSizes[b].push_back(count);
+                }
+            }
+        });
+
+        std::vector<int> offsets(1, 0);
+        std::vector<int> sources;
+        std::vector<double> weights;
+        offsets.reserve(pointCount + 1);
+        for (int b = 0; b < blockCount; b++) {
+            for (int size : blockSizes[b]) offsets.push_back(offsets.back() + size);
+            sources.insert(sources.end(), blockSources[b].begin(), blockSources[b].end());
+            weights.insert(weights.end(), blockWeights[b].begin(), blockWeights[b].end());
+        }
+        stencilOffsets.swap(offsets);
+        stencilSources.swap(sources);
+        stencilWeights.swap(weights);
+    }
+
+    // Вершины итоговой сетки - различные пары (точка, текстурные координаты) углов
+    void buildRefinedMesh(const Level& level) {
+        struct CornerHash {
+            size_t operator()(const std::pair<int, Point3D>& key) const {
+                return PointHash()(key.second) * 31 + (size_t)key.first;
+            }
+        };
+        struct CornerEqual {
+            bool operator()(const std::pair<int, Point3D>& a, const std::pair<int, Point3D>& b) const {
+                return a.first == b.first && PointEqual()(a.second, b.second);
+            }
+        };
+        std::unordered_map<std::pair<int, Point3D>, int, CornerHash, CornerEqual> vertices;
+        vertices.reserve(level.corners.size());
+
+        refined = Mesh();
+        refined.indices.reserve(level.corners.size());
+        refined.faceOffsets.reserve(level.offsets.size());
+        for (int f = 0; f < level.faceCount(); f++) {
+            for (int c = level.offsets[f]; c < level.offsets[f + 1]; c++) {
+                Point3D uv = withTexCoords ? level.uvs[c] : Point3D(0, 0, 0);
+                auto inserted = vertices.emplace(std::make_pair(level.corners[c], uv), (int)vertexPoint.size());
+                if (inserted.second) {
+                    vertexPoint.push_back(level.corners[c]);
+                    if (withTexCoords) refined.texCoords.push_back(uv);
+                }
+                refined.indices.push_back(inserted.first->second);
+            }
+            refined.faceOffsets.push_back((int)refined.indices.size());
+        }
+        refined.positions.resize(vertexPoint.size());
+
+        pointFaceOffsets.assign(level.pointCount + 1, 0);
+        for (int c : level.corners) pointFaceOffsets[c + 1]++;
+        for (int p = 0; p < level.pointCount; p++) pointFaceOffsets[p + 1] += pointFaceOffsets[p];
+        pointFaces.resize(level.corners.size());
+        std::vector<int> fill(pointFaceOffsets.begin(), pointFaceOffsets.end() - 1);
+        for (int f = 0; f < level.faceCount(); f++) {
+            for (int c = level.offsets[f]; c < level.offsets[f + 1]; c++) pointFaces[fill[level.corners[c]]++] = f;
+        }
+    }
+
+    SubdivisionScheme scheme;
+    int controlCount;
+    int levelCount = 0;
+    bool withTexCoords = false;
+    std::vector<int> pointOfControl;
+
+    // Таблица шаблонов: точка последнего уровня -> веса вершин управляющей сетки
+    std::vector<int> stencilOffsets;
+    std::vector<int> stencilSources;
+    std::vector<double> stencilWeights;
+
+    Mesh refined;                  // связность и текстурные координаты итоговой сетки
+    std::vector<int> vertexPoint;  // вершина итоговой сетки -> точка последнего уровня
+    std::vector<int> pointFaceOffsets;
+    std::vector<int> pointFaces;
+};
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include "math_3d.h"
+#include "geometry.h"
+#include "renderer.h"
+#include "asset_loader.h"
+#include "half_edge.h"
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Ландшафт z = height(x, y) на большой области.
+// Область - квадродерево чанков: корень покрывает всю область, каждый уровень
+// делит чанк на 4. У всех чанков одинаковая сетка resolution x resolution, поэтому
+// глубокие чанки детальнее. Сетки строятся лениво в рабочих потоках и хранятся
+// в LRU-кэше. В кадре обход дерева спускается в детей, пока экранная погрешность
+// чанка больше допустимой и дети уже готовы; иначе рисуется сам чанк.
+//
+// Все координаты вершин берутся из общей целочисленной решётки самого мелкого
+// уровня, так что одинаковые точки соседних чанков совпадают побитно. Рёбра чанка,
+// соседствующего с более крупным, прижимаются к рёбрам соседа (стыковка без трещин).
+class Terrain {
+public:
+    using HeightFunction = std::function<double(double, double)>;
+
+    // Сетка удерживается владением: кадр в работе (frame_pipeline.h) дорисует чанк,
+    // даже если его успели выгрузить или прижать заново
+    struct VisibleChunk {
+        std::shared_ptr<const Mesh> mesh;
+        const HalfEdgeMesh* topology; // у прижатой копии связность та же, что у исходной сетки
+        int depth;
+    };
+
+    Terrain(HeightFunction height,
+            double x0, double x1, double y0, double y1,
+            int maxDepth = 6, int resolution = 32, size_t cacheCapacity = 512)
+        : height(std::make_shared<const HeightFunction>(std::move(height))), x0(x0), x1(x1), y0(y0), y1(y1),
+          maxDepth(std::max(0, std::min(maxDepth, 16))),
+          resolution(std::max(2, resolution)),
+          cacheCapacity(cacheCapacity) {
+        latticeSize = (long long)this->resolution << this->maxDepth;
+    }
+
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    // Выбирает чанки для кадра. viewer - положение камеры в координатах ландшафта,
+    // pixelsPerUnit - сколько пикселей занимает единица длины на расстоянии 1
+    // (высота окна / (2 tg(fov / 2))), pixelError - допустимая погрешность в пикселях
+    void update(const Point3D& viewer, double pixelsPerUnit, double pixelError = 1.5) {
+        loader.processCompleted();
+        frame++;
+        visible.clear();
+        selected.clear();
+
+        select(0, 0, 0, viewer, pixelsPerUnit, pixelError);
+        for (auto& entry : selected) {
+            Chunk& chunk = chunks[entry.first];
+            visible.push_back({ stitch(chunk), &chunk.data.topology, chunk.depth });
+        }
+        evict();
+    }
+
+    const std::vector<VisibleChunk>& visibleChunks() const { return visible; }
+    int cachedChunks() const { return (int)chunks.size(); }
+    int pendingChunks() const { return inFlight; }
+
+    // Функция высоты по карте высот: яркость пикселя, билинейная интерполяция
+    static HeightFunction heightmapFunction(const sf::Image& image,
+                                            double x0, double x1, double y0, double y1,
+                                            double heightScale) {
+        int w = image.getSize().x, h = image.getSize().y;
+        std::vector<float> heights((size_t)w * h);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                sf::Color c = image.getPixel(x, y);
+                heights[(size_t)y * w + x] = (0.299f * c.r + 0.587f * c.g + 0.114f * c.b) / 255.0f;
+            }
+        }
+        return [heights = std::move(heights), w, h, x0, x1, y0, y1, heightScale](double x, double y) {
+            if (w == 0 || h == 0) return 0.0;
+            double u = std::max(0.0, std::min(1.0, (x - x0) / (x1 - x0))) * (w - 1);
+            double v = std::max(0.0, std::min(1.0, (y - y0) / (y1 - y0))) * (h - 1);
+            int ix = std::min((int)u, std::max(w - 2, 0)), iy = std::min((int)v, std::max(h - 2, 0));
+            int ix1 = std::min(ix + 1, w - 1), iy1 = std::min(iy + 1, h - 1);
+            double fx = u - ix, fy = v - iy;
+            double top = heights[(size_t)iy * w + ix] * (1 - fx) + heights[(size_t)iy * w + ix1] * fx;
+            double bottom = heights[(size_t)iy1 * w + ix] * (1 - fx) + heights[(size_t)iy1 * w + ix1] * fx;
+            return (top * (1 - fy) + bottom * fy) * heightScale;
+        };
+    }
+
+private:
+    struct ChunkData {
+        std::shared_ptr<const Mesh> mesh;
+        HalfEdgeMesh topology;
+        double error = 0;
+        double minZ = 0, maxZ = 0;
+    };
+
+    struct Chunk {
+        int depth = 0;
+        long long ix = 0, iy = 0;
+        bool ready = false;
+        ChunkData data;
+        long long lastUsedFrame = 0;
+        std::list<uint64_t>::iterator lruPosition;
+
+        // Копия сетки с прижатыми рёбрами для текущего набора более крупных соседей
+        std::shared_ptr<const Mesh> stitched;
+        int stitchKey = 0;
+    };
+
+    static uint64_t chunkKey(int depth, long long ix, long long iy) {
+        return ((uint64_t)depth << 58) | ((uint64_t)ix << 29) | (uint64_t)iy;
+    }
+
+    double latticeX(long long gx) const { return x0 + (x1 - x0) * gx / latticeSize; }
+    double latticeY(long long gy) const { return y0 + (y1 - y0) * gy / latticeSize; }
+    long long chunkSpacing(int depth) const { return 1LL << (maxDepth - depth); }
+
+    void touch(Chunk& chunk, uint64_t key) {
+        chunk.lastUsedFrame = frame;
+        lru.erase(chunk.lruPosition);
+        lru.push_front(key);
+        chunk.lruPosition = lru.begin();
+    }
+
+    // Ставит построение чанка в очередь; число одновременных задач ограничено,
+    // чтобы при быстром движении камеры очередь не заполнялась устаревшими чанками
+    Chunk* request(int depth, long long ix, long long iy) {
+        uint64_t key = chunkKey(depth, ix, iy);
+        auto it = chunks.find(key);
+        if (it != chunks.end()) {
+            touch(it->second, key);
+            return &it->second;
+        }
+        if (inFlight >= maxInFlight) return nullptr;
+
+        Chunk& chunk = chunks[key];
+        chunk.depth = depth;
+        chunk.ix = ix;
+        chunk.iy = iy;
+        lru.push_front(key);
+        chunk.lruPosition = lru.begin();
+        chunk.lastUsedFrame = frame;
+        inFlight++;
+
+        long long spacing = chunkSpacing(depth);
+        long long gx0 = ix * spacing * resolution, gy0 = iy * spacing * resolution;
+        // Функция высоты общая для всех задач: карта высот не копируется на каждый чанк
+        std::shared_ptr<const HeightFunction> sharedHeight = height;
+        int n = resolution;
+        double lx0 = x0, lx1 = x1, ly0 = y0, ly1 = y1;
+        long long lattice = latticeSize;
+        loader.load<ChunkData>(
+            [sharedHeight, gx0, gy0, spacing, n, lx0, lx1, ly0, ly1, lattice] {
+                return buildChunk(*sharedHeight, gx0, gy0, spacing, n, lx0, lx1, ly0, ly1, lattice);
+            },
+            [this, key](ChunkData& data) {
+                inFlight--;
+                auto it = chunks.find(key);
+                if (it == chunks.end()) return;
+                it->second.data = std::move(data);
+                it->second.ready = true;
+            },
+            // Неудачный чанк убирается из кэша: иначе он навсегда остался бы неготовым
+            // и держал очередь вытеснения; при следующем обходе он запросится заново
+            [this, key] {
+                inFlight--;
+                auto it = chunks.find(key);
+                if (it == chunks.end()) return;
+                lru.erase(it->second.lruPosition);
+                chunks.erase(it);
+            });
+        return &chunk;
+    }
+
+    // Сетка чанка: равномерная сетка generateFunctionSurface по индексам узлов
+    // (координаты узлов целые, поэтому точные), затем перевод в координаты решётки
+    static ChunkData buildChunk(const HeightFunction& height,
+                                long long gx0, long long gy0, long long spacing, int n,
+                                double x0, double x1, double y0, double y1, long long lattice) {
+        auto worldX = [&](double gx) { return x0 + (x1 - x0) * gx / lattice; };
+        auto worldY = [&](double gy) { return y0 + (y1 - y0) * gy / lattice; };
+        auto sample = [&](double i, double j) {
+            return height(worldX(gx0 + (long long)i * spacing), worldY(gy0 + (long long)j * spacing));
+        };
+
+        ChunkData data;
+        Mesh mesh = generateFunctionSurface(sample, 0, n, 0, n, n);
+        int side = n + 1;
+        double stepX = (x1 - x0) * spacing / lattice;
+        double stepY = (y1 - y0) * spacing / lattice;
+
+        data.minZ = data.maxZ = mesh.positions[0].z;
+        for (int i = 0; i < side; i++) {
+            for (int j = 0; j < side; j++) {
+                int v = i * side + j;
+                Point3D& p = mesh.positions[v];
+                long long gx = gx0 + i * spacing, gy = gy0 + j * spacing;
+                p.x = worldX(gx);
+                p.y = worldY(gy);
+                data.minZ = std::min(data.minZ, p.z);
+                data.maxZ = std::max(data.maxZ, p.z);
+                mesh.texCoords[v] = Point3D((double)gx / lattice, (double)gy / lattice, 0);
+
+                // Нормаль вверх по центральным разностям; на краю чанка соседние узлы
+                // берутся из функции, чтобы освещение соседних чанков совпадало
+                double left = i > 0 ? mesh.positions[v - side].z : sample(i - 1, j);
+                double right = i < n ? mesh.positions[v + side].z : sample(i + 1, j);
+                double down = j > 0 ? mesh.positions[v - 1].z : sample(i, j - 1);
+                double up = j < n ? mesh.positions[v + 1].z : sample(i, j + 1);
+                mesh.normals[v] = Point3D(-(right - left) / (2 * stepX), -(up - down) / (2 * stepY), 1, 0).normalize();
+            }
+        }
+
+        // Обход граней разворачивается, чтобы лицевая сторона смотрела вверх
+        for (int f = 0; f < mesh.faceCount(); f++) {
+            int* quad = &mesh.indices[mesh.faceOffsets[f]];
+            std::swap(quad[1], quad[3]);
+        }
+
+        // Погрешность чанка: насколько функция в серединах ячеек отличается от сетки.
+        // Дочерние чанки вдвое детальнее, так что этого достаточно для выбора уровня
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                double h00 = mesh.positions[i * side + j].z, h01 = mesh.positions[i * side + j + 1].z;
+                double h10 = mesh.positions[(i + 1) * side + j].z, h11 = mesh.positions[(i + 1) * side + j + 1].z;
+                double cx = worldX(gx0 + i * spacing + spacing / 2.0), cy = worldY(gy0 + j * spacing + spacing / 2.0);
+                data.error = std::max(data.error, std::abs(height(cx, cy) - 0.25 * (h00 + h01 + h10 + h11)));
+                data.error = std::max(data.error, std::abs(height(cx, worldY(gy0 + j * spacing)) - 0.5 * (h00 + h10)));
+                data.error = std::max(data.error, std::abs(height(worldX(gx0 + i * spacing), cy) - 0.5 * (h00 + h01)));
+            }
+        }
+        data.topology = HalfEdgeMesh(mesh);
+        data.mesh = std::make_shared<const Mesh>(std::move(mesh));
+        return data;
+    }
+
+    double distanceTo(const Chunk& chunk, const Point3D& viewer) const {
+        long long size = chunkSpacing(chunk.depth) * resolution;
+        double ax = latticeX(chunk.ix * size), bx = latticeX((chunk.ix + 1) * size);
+        double ay = latticeY(chunk.iy * size), by = latticeY((chunk.iy + 1) * size);
+        double dx = std::max({ std::min(ax, bx) - viewer.x, 0.0, viewer.x - std::max(ax, bx) });
+        double dy = std::max({ std::min(ay, by) - viewer.y, 0.0, viewer.y - std::max(ay, by) });
+        double dz = std::max({ chunk.data.minZ - viewer.z, 0.0, viewer.z - chunk.data.maxZ });
+        return std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    void select(int depth, long long ix, long long iy, const Point3D& viewer,
+                double pixelsPerUnit, double pixelError) {
+        Chunk* chunk = request(depth, ix, iy);
+        if (!chunk || !chunk->ready) return;
+
+        double distance = std::max(distanceTo(*chunk, viewer), 1e-6);
+        double screenError = chunk->data.error * pixelsPerUnit / distance;
+        if (screenError > pixelError && depth < maxDepth) {
+            Chunk* children[4];
+            bool childrenReady = true;
+            for (int k = 0; k < 4; k++) {
+                children[k] = request(depth + 1, ix * 2 + (k & 1), iy * 2 + (k >> 1));
+                childrenReady = childrenReady && children[k] && children[k]->ready;
+            }
+            // Пока дети строятся, рисуется сам чанк
+            if (childrenReady) {
+                for (int k = 0; k < 4; k++) {
+                    select(depth + 1, ix * 2 + (k & 1), iy * 2 + (k >> 1), viewer, pixelsPerUnit, pixelError);
+                }
+                return;
+            }
+        }
+        selected.emplace(chunkKey(depth, ix, iy), depth);
+    }
+
+    // Насколько крупнее выбранный чанк за ребром (0 - не крупнее или его нет)
+    int coarserNeighbor(int depth, long long nx, long long ny) const {
+        long long cells = 1LL << depth;
+        if (nx < 0 || ny < 0 || nx >= cells || ny >= cells) return 0;
+        for (int d = depth - 1; d >= 0; d--) {
+            int shift = depth - d;
+            if (selected.count(chunkKey(d, nx >> shift, ny >> shift))) return shift;
+        }
+        return 0;
+    }
+
+    std::shared_ptr<const Mesh> stitch(Chunk& chunk) {
+        const int dirX[4] = { -1, 1, 0, 0 };
+        const int dirY[4] = { 0, 0, -1, 1 };
+        int deltas[4];
+        int stitchKey = 0;
+        for (int e = 0; e < 4; e++) {
+            deltas[e] = std::min(coarserNeighbor(chunk.depth, chunk.ix + dirX[e], chunk.iy + dirY[e]), 15);
+            stitchKey |= deltas[e] << (4 * e);
+        }
+        if (stitchKey == 0) return chunk.data.mesh;
+        if (stitchKey == chunk.stitchKey) return chunk.stitched;
+
+        // Новая копия, а не правка прежней: прежнюю ещё может рисовать кадр в работе
+        auto stitched = std::make_shared<Mesh>(*chunk.data.mesh);
+        chunk.stitchKey = stitchKey;
+        int n = resolution, side = n + 1;
+        long long spacing = chunkSpacing(chunk.depth);
+        long long gx0 = chunk.ix * spacing * n, gy0 = chunk.iy * spacing * n;
+
+        // Высота узла, не попадающего в сетку соседа, - линейная интерполяция
+        // по двум ближайшим узлам соседа вдоль ребра (в решётке они те же)
+        auto snap = [&](int v, long long along, long long coarseSpacing, bool alongX, double fixed) {
+            long long a = along / coarseSpacing * coarseSpacing;
+            if (a == along) return;
+            long long b = a + coarseSpacing;
+            double t = (double)(along - a) / coarseSpacing;
+            double ha = alongX ? (*height)(latticeX(a), fixed) : (*height)(fixed, latticeY(a));
+            double hb = alongX ? (*height)(latticeX(b), fixed) : (*height)(fixed, latticeY(b));
+            stitched->positions[v].z = ha * (1 - t) + hb * t;
+        };
+
+        for (int e = 0; e < 4; e++) {
+            if (deltas[e] == 0) continue;
+            long long coarseSpacing = spacing << deltas[e];
+            for (int k = 0; k <= n; k++) {
+                if (e < 2) {
+                    int i = e == 0 ? 0 : n;
+                    snap(i * side + k, gy0 + k * spacing, coarseSpacing, false, latticeX(gx0 + i * spacing));
+                } else {
+                    int j = e == 2 ? 0 : n;
+                    snap(k * side + j, gx0 + k * spacing, coarseSpacing, true, latticeY(gy0 + j * spacing));
+                }
+            }
+        }
+        chunk.stitched = std::move(stitched);
+        return chunk.stitched;
+    }
+
+    // Выбрасывает давно не использованные чанки, пока кэш больше лимита
+    void evict() {
+        while (chunks.size() > cacheCapacity && !lru.empty()) {
+            uint64_t key = lru.back();
+            Chunk& chunk = chunks[key];
+            if (chunk.lastUsedFrame == frame || !chunk.ready) break;
+            lru.pop_back();
+            chunks.erase(key);
+        }
+    }
+
+    std::shared_ptr<const HeightFunction> height;
+    double x0, x1, y0, y1;
+    int maxDepth;
+    int resolution;
+    size_t cacheCapacity;
+    long long latticeSize;
+
+    std::unordered_map<uint64_t, Chunk> chunks;
+    std::list<uint64_t> lru;
+    std::unordered_map<uint64_t, int> selected;
+    std::vector<VisibleChunk> visible;
+    long long frame = 0;
+    int inFlight = 0;
+    const int maxInFlight = 16;
+
+    // Объявлен последним: потоки останавливаются раньше, чем разрушаются чанки
+    AssetLoader loader;
+};
+
+#endif
@@ -7,106 +7,551 @@
 #include <algorithm>
 #include "math_3d.h"
 #include "geometry.h"
+#include "shadow_map.h"
+#include "light_grid.h"
+#include "hdr_color.h"
+#include "mesh_clusters.h"
+
+// Прямоугольник пикселей [x0, x1) x [y0, y1)
+struct ScreenRect {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+    long long area() const { return empty() ? 0 : (long long)(x1 - x0) * (y1 - y0); }
+    bool intersects(const ScreenRect& other) const {
+        return x0 < other.x1 && other.x0 < x1 && y0 < other.y1 && other.y0 < y1;
+    }
+    ScreenRect united(const ScreenRect& other) const {
+        if (empty()) return other;
+        if (other.empty()) return *this;
+        return { std::min(x0, other.x0), std::min(y0, other.y0), std::max(x1, other.x1), std::max(y1, other.y1) };
+    }
+    ScreenRect clipped(int width, int height) const {
+        return { std::max(x0, 0), std::max(y0, 0), std::min(x1, width), std::min(y1, height) };
+    }
+};
 
 class ZBuffer {
 private:
     int width, height;
+    // Глубина по отсчётам: samples значений на пиксель (без сглаживания - одно)
     std::vector<float> zBuffer;
+    // Линейный HDR-цвет по отсчётам; в sf::Image он попадает только при сведении кадра
+    std::vector<LinearColor> colorBuffer;
     sf::Image frameBuffer;
-    Texture* currentTexture;
-    
-public:
-    ZBuffer(int w, int h) : width(w), height(h), currentTexture(nullptr) {
-        zBuffer.resize(width * height);
-        frameBuffer.create(width, height, sf::Color::Black);
-        clear();
-    }
-    
-    void clear() {
-        // Заполнить буфер кадра фоновым значением
-        for (int i = 0; i < width; i++) {
-            for (int j = 0; j < height; j++) {
-                frameBuffer.setPixel(i, j, sf::Color::Black);
-            }
-        }
-        
-        // Заполнить z-буфер максимальным значением z
-        std::fill(zBuffer.begin(), zBuffer.end(), std::numeric_limits<float>::max());
+    // Сглаживание (MSAA): состояние пикселя. Пиксель, целиком закрытый одним
+    // треугольником, хранит один цвет в первом отсчёте
+    enum PixelState : sf::Uint8 { EMPTY, UNIFORM, EXPANDED };
+    int samples;
+    std::vector<sf::Uint8> pixelStates;
+    std::vector<sf::Uint8> resolvedPixels;
+    bool resolveNeeded;
+    // Область, изменившаяся после прошлого сведения кадра: остальные пиксели
+    // resolvedPixels остаются с прошлого раза
+    ScreenRect resolveRegion;
+    // Растеризация ограничена этим прямоугольником (частичная перерисовка)
+    ScreenRect clipRect;
+    const Texture* currentTexture;
+    const ShadowMap* shadowMap;
+    // Рассеянный свет (вместо прежней добавки +10 к каждому каналу)
+    static constexpr float ambient = 0.03f;
+    const LightGrid* lightGrid;
+    // После предварительного прохода по глубине проходит и равная глубина:
+    // закрашивается ровно одна, видимая, поверхность
+    bool depthPrepassDone;
+    // Вершинная стадия drawMesh: буферы переиспользуются от сетки к сетке
+    std::vector<Point3D> projected, worldPositions, worldNormals;
+    std::vector<float> intensities;
+
+    // Треугольник после преобразования: экранные координаты и глубина NDC
+    struct ScreenTriangle {
+        int x1, y1, x2, y2, x3, y3;
+        float z1, z2, z3;
+        // Те же координаты без округления - для отсчётов внутри пикселя
+        float fx1, fy1, fx2, fy2, fx3, fy3;
+    };
+
+    // Вершинная стадия: преобразование вершины и перспективное деление
+    static Point3D projectVertex(const Point3D& p, const Matrix4x4& mvp) {
+        Point3D v = mvp.transform(p);
+        if (v.w != 0) { v.x /= v.w; v.y /= v.w; v.z /= v.w; }
+        return v;
     }
-    
-    // Растеризация треугольника с использованием z-буфера
-    void setTexture(Texture* texture) {
-        currentTexture = texture;
+
+    // Общая часть всех режимов: преобразование вершин и сборка треугольника
+    bool setupTriangle(const Point3D& p1, const Point3D& p2, const Point3D& p3,
+                       const Matrix4x4& mvp, bool backfaceCulling, ScreenTriangle& tri) const {
+        return assembleTriangle(projectVertex(p1, mvp), projectVertex(p2, mvp), projectVertex(p3, mvp),
+                                backfaceCulling, tri);
     }
-    
-    void rasterizeTriangle(const Point3D& p1, const Point3D& p2, const Point3D& p3, 
-                          const sf::Color& color, const Matrix4x4& mvp, bool backfaceCulling = true) {
-        
-        // Преобразование вершин
-        Point3D v1 = mvp.transform(p1);
-        Point3D v2 = mvp.transform(p2);
-        Point3D v3 = mvp.transform(p3);
-        
-        // Перспективное деление
-        if (v1.w != 0) { v1.x /= v1.w; v1.y /= v1.w; v1.z /= v1.w; }
-        if (v2.w != 0) { v2.x /= v2.w; v2.y /= v2.w; v2.z /= v2.w; }
-        if (v3.w != 0) { v3.x /= v3.w; v3.y /= v3.w; v3.z /= v3.w; }
-        
-        // Отсечение невидимых граней (backface culling)
-        if (backfaceCulling) {
-            Point3D edge1 = v2 - v1;
-            Point3D edge2 = v3 - v1;
-            Point3D normal = edge1.cross(edge2);
-
-            // Если нормаль направлена от камеры (z < 0), пропускаем
-            if (normal.z <= 0) return;
-        }
+
+    // Сборка треугольника из спроецированных вершин: отсечение нелицевых граней
+    // и перевод в экранные координаты
+    bool assembleTriangle(const Point3D& v1, const Point3D& v2, const Point3D& v3,
+                          bool backfaceCulling, ScreenTriangle& tri) const {
+        // Отсечение невидимых граней (backface culling):
+        // если нормаль направлена от камеры (z <= 0), пропускаем
+        if (backfaceCulling && ((v2.x - v1.x) * (v3.y - v1.y) - (v2.y - v1.y) * (v3.x - v1.x)) <= 0) return false;
         
         // Преобразование в экранные координаты
-        int x1 = (int)((v1.x + 1.0) * width / 2.0);
-        int y1 = (int)((-v1.y + 1.0) * height / 2.0);
-        float z1 = v1.z;
-        
-        int x2 = (int)((v2.x + 1.0) * width / 2.0);
-        int y2 = (int)((-v2.y + 1.0) * height / 2.0);
-        float z2 = v2.z;
+        tri.fx1 = (float)((v1.x + 1.0) * width / 2.0);
+        tri.fy1 = (float)((-v1.y + 1.0) * height / 2.0);
+        tri.fx2 = (float)((v2.x + 1.0) * width / 2.0);
+        tri.fy2 = (float)((-v2.y + 1.0) * height / 2.0);
+        tri.fx3 = (float)((v3.x + 1.0) * width / 2.0);
+        tri.fy3 = (float)((-v3.y + 1.0) * height / 2.0);
+        tri.x1 = (int)((v1.x + 1.0) * width / 2.0);
+        tri.y1 = (int)((-v1.y + 1.0) * height / 2.0);
+        tri.z1 = v1.z;
+        tri.x2 = (int)((v2.x + 1.0) * width / 2.0);
+        tri.y2 = (int)((-v2.y + 1.0) * height / 2.0);
+        tri.z2 = v2.z;
+        tri.x3 = (int)((v3.x + 1.0) * width / 2.0);
+        tri.y3 = (int)((-v3.y + 1.0) * height / 2.0);
+        tri.z3 = v3.z;
         
-        int x3 = (int)((v3.x + 1.0) * width / 2.0);
-        int y3 = (int)((-v3.y + 1.0) * height / 2.0);
-        float z3 = v3.z;
+        // Микротреугольник, не накрывающий ни одного пикселя (после округления вершин
+        // площадь нулевая), отбрасывается до подготовки освещения и атрибутов
+        if (samples == 1) {
+            return (long long)(tri.x2 - tri.x1) * (tri.y3 - tri.y1) != (long long)(tri.x3 - tri.x1) * (tri.y2 - tri.y1);
+        }
+        return (tri.fx2 - tri.fx1) * (tri.fy3 - tri.fy1) != (tri.fx3 - tri.fx1) * (tri.fy2 - tri.fy1);
+    }
+
+    // Ядро растеризации: обход ограничивающего прямоугольника и тест глубины.
+    // Для пикселя, прошедшего тест, вызывается shade(x, y, w1, w2, w3) с
+    // барицентрическими координатами - линейный цвет определяет режим отрисовки.
+    // DepthOnly - только глубина, shade не вызывается
+    template <bool DepthOnly, typename Shade>
+    void rasterizeScreenTriangle(const ScreenTriangle& tri, Shade&& shade) {
+        if (!DepthOnly) {
+            resolveRegion = resolveNeeded ? resolveRegion.united(clipRect) : clipRect;
+            resolveNeeded = true;
+        }
+        if (samples > 1) {
+            rasterizeMultisampled<DepthOnly>(tri, shade);
+            return;
+        }
+        int x1 = tri.x1, y1 = tri.y1, x2 = tri.x2, y2 = tri.y2, x3 = tri.x3, y3 = tri.y3;
         
         // Находим ограничивающий прямоугольник
-        int minX = std::max(0, std::min({x1, x2, x3}));
-        int maxX = std::min(width - 1, std::max({x1, x2, x3}));
-        int minY = std::max(0, std::min({y1, y2, y3}));
-        int maxY = std::min(height - 1, std::max({y1, y2, y3}));
+        int minX = std::max(clipRect.x0, std::min({x1, x2, x3}));
+        int maxX = std::min(clipRect.x1 - 1, std::max({x1, x2, x3}));
+        int minY = std::max(clipRect.y0, std::min({y1, y2, y3}));
+        int maxY = std::min(clipRect.y1 - 1, std::max({y1, y2, y3}));
+        if (minX > maxX || minY > maxY) return;
         
-        // Растеризация треугольника
-        for (int y = minY; y <= maxY; y++) {
-            for (int x = minX; x <= maxX; x++) {
-                // Барицентрические координаты
-                float w1 = ((y2 - y3) * (x - x3) + (x3 - x2) * (y - y3)) / 
-                          (float)((y2 - y3) * (x1 - x3) + (x3 - x2) * (y1 - y3));
-                float w2 = ((y3 - y1) * (x - x3) + (x1 - x3) * (y - y3)) / 
-                          (float)((y2 - y3) * (x1 - x3) + (x3 - x2) * (y1 - y3));
-                float w3 = 1.0f - w1 - w2;
-                
-                // Проверка, находится ли точка внутри треугольника
-                if (w1 >= 0 && w2 >= 0 && w3 >= 0) {
+        // Числители барицентрических координат - целые и линейные по экрану:
+        // e1 = a1 * x + b1 * y + c1, e2 = a2 * x + b2 * y + c2, e3 = denom - e1 - e2
+        long long denomInt = (long long)(y2 - y3) * (x1 - x3) + (long long)(x3 - x2) * (y1 - y3);
+        if (denomInt == 0) return;
+        float denom = (float)denomInt;
+        long long a1 = y2 - y3, b1 = x3 - x2, c1 = -(a1 * x3 + b1 * y3);
+        long long a2 = y3 - y1, b2 = x1 - x3, c2 = -(a2 * x3 + b2 * y3);
+        
+        // Обход прямоугольника; inside - весь прямоугольник заведомо внутри треугольника
+        auto rasterizeRect = [&](int fromX, int toX, int fromY, int toY, bool inside) {
+            for (int y = fromY; y <= toY; y++) {
+                long long e1 = a1 * fromX + b1 * y + c1;
+                long long e2 = a2 * fromX + b2 * y + c2;
+                for (int x = fromX; x <= toX; x++, e1 += a1, e2 += a2) {
+                    // Барицентрические координаты
+                    float w1 = e1 / denom;
+                    float w2 = e2 / denom;
+                    float w3 = 1.0f - w1 - w2;
+                    
+                    // Проверка, находится ли точка внутри треугольника
+                    if (!inside && (w1 < 0 || w2 < 0 || w3 < 0)) continue;
+                    
                     // Интерполяция глубины
-                    float z = w1 * z1 + w2 * z2 + w3 * z3;
+                    float z = w1 * tri.z1 + w2 * tri.z2 + w3 * tri.z3;
                     
                     int idx = y * width + x;
                     
                     // Сравнить глубину z(x, y) со значением в z-буфере
-                    if (z < zBuffer[idx]) {
+                    if (z < zBuffer[idx] || (depthPrepassDone && z == zBuffer[idx])) {
                         // Если z(x, y) < Z_буфер(x, y), обновляем оба буфера
                         zBuffer[idx] = z;
-                        frameBuffer.setPixel(x, y, color);
+                        if (!DepthOnly) colorBuffer[idx] = shade(x, y, w1, w2, w3);
+                    }
+                }
+            }
+        };
+        
+        // Мелкий треугольник - сразу по пикселям: разбиение на блоки не окупится
+        const int block = 8;
+        if ((maxX - minX + 1) * (maxY - minY + 1) <= 2 * block * block) {
+            rasterizeRect(minX, maxX, minY, maxY, false);
+            return;
+        }
+        
+        // Крупный - блоками 8x8. Числители линейны, поэтому по четырём углам блока видно:
+        // все углы снаружи одного ребра - блок пропускается целиком; все внутри с запасом -
+        // пиксели блока не проверяются. Запас по e3 перекрывает погрешность float в w3
+        long long sign = denomInt > 0 ? 1 : -1;
+        long long margin = std::max(1LL, std::abs(denomInt) / 100000);
+        for (int by = minY; by <= maxY; by += block) {
+            int toY = std::min(by + block - 1, maxY);
+            for (int bx = minX; bx <= maxX; bx += block) {
+                int toX = std::min(bx + block - 1, maxX);
+                long long min1 = std::numeric_limits<long long>::max(), max1 = std::numeric_limits<long long>::min();
+                long long min2 = min1, max2 = max1, min3 = min1, max3 = max1;
+                for (int corner = 0; corner < 4; corner++) {
+                    int cx = (corner & 1) ? toX : bx, cy = (corner & 2) ? toY : by;
+                    long long e1 = a1 * cx + b1 * cy + c1, e2 = a2 * cx + b2 * cy + c2;
+                    long long s1 = sign * e1, s2 = sign * e2, s3 = sign * (denomInt - e1 - e2);
+                    min1 = std::min(min1, s1); max1 = std::max(max1, s1);
+                    min2 = std::min(min2, s2); max2 = std::max(max2, s2);
+                    min3 = std::min(min3, s3); max3 = std::max(max3, s3);
+                }
+                if (max1 < 0 || max2 < 0 || max3 < 0) continue;
+                rasterizeRect(bx, toX, by, toY, min1 >= 0 && min2 >= 0 && min3 >= margin);
+            }
+        }
+    }
+
+    // Положения отсчётов внутри пикселя относительно центра (стандартные шаблоны 4x и 8x)
+    static const float* sampleOffsets(int count) {
+        static const float offsets4[] = { -2, -6, 6, -2, -6, 2, 2, 6 };
+        static const float offsets8[] = { 1, -3, -1, 3, 5, 1, -3, -5, -5, 5, -7, -1, 3, 7, 7, -7 };
+        return count == 8 ? offsets8 : offsets4;
+    }
+
+    // Сглаживание: покрытие и глубина проверяются в каждом отсчёте, а цвет считается
+    // один раз на пиксель (в центре) и записывается в покрытые отсчёты
+    template <bool DepthOnly, typename Shade>
+    void rasterizeMultisampled(const ScreenTriangle& tri, Shade& shade) {
+        float x1 = tri.fx1, y1 = tri.fy1, x2 = tri.fx2, y2 = tri.fy2, x3 = tri.fx3, y3 = tri.fy3;
+        float denom = (y2 - y3) * (x1 - x3) + (x3 - x2) * (y1 - y3);
+        if (denom == 0) return;
+
+        int minX = std::max(clipRect.x0, (int)std::floor(std::min({x1, x2, x3})));
+        int maxX = std::min(clipRect.x1 - 1, (int)std::floor(std::max({x1, x2, x3})));
+        int minY = std::max(clipRect.y0, (int)std::floor(std::min({y1, y2, y3})));
+        int maxY = std::min(clipRect.y1 - 1, (int)std::floor(std::max({y1, y2, y3})));
+
+        // Барицентрические координаты и глубина линейны по экрану: w = A * x + B * y + C
+        float A1 = (y2 - y3) / denom, B1 = (x3 - x2) / denom, C1 = -(A1 * x3 + B1 * y3);
+        float A2 = (y3 - y1) / denom, B2 = (x1 - x3) / denom, C2 = -(A2 * x3 + B2 * y3);
+        float zA = A1 * (tri.z1 - tri.z3) + A2 * (tri.z2 - tri.z3);
+        float zB = B1 * (tri.z1 - tri.z3) + B2 * (tri.z2 - tri.z3);
+
+        // Сдвиги координат от центра пикселя к каждому отсчёту
+        const float* offsets = sampleOffsets(samples);
+        float dw1[8], dw2[8], dz[8];
+        for (int s = 0; s < samples; s++) {
+            float ox = offsets[2 * s] / 16.0f, oy = offsets[2 * s + 1] / 16.0f;
+            dw1[s] = A1 * ox + B1 * oy;
+            dw2[s] = A2 * ox + B2 * oy;
+            dz[s] = zA * ox + zB * oy;
+        }
+        const unsigned fullMask = (1u << samples) - 1;
+
+        auto rasterizeRect = [&](int fromX, int toX, int fromY, int toY) {
+            for (int y = fromY; y <= toY; y++) {
+                for (int x = fromX; x <= toX; x++) {
+                    float cx = x + 0.5f, cy = y + 0.5f;
+                    float w1 = A1 * cx + B1 * cy + C1;
+                    float w2 = A2 * cx + B2 * cy + C2;
+                    float z = tri.z3 + w1 * (tri.z1 - tri.z3) + w2 * (tri.z2 - tri.z3);
+
+                    size_t pixel = (size_t)y * width + x;
+                    float* depth = &zBuffer[pixel * samples];
+                    unsigned mask = 0;
+                    for (int s = 0; s < samples; s++) {
+                        float s1 = w1 + dw1[s], s2 = w2 + dw2[s];
+                        if (s1 < 0 || s2 < 0 || s1 + s2 > 1) continue;
+                        float sz = z + dz[s];
+                        if (sz < depth[s] || (depthPrepassDone && sz == depth[s])) {
+                            depth[s] = sz;
+                            mask |= 1u << s;
+                        }
+                    }
+                    if (DepthOnly || mask == 0) continue;
+
+                    LinearColor color = shade(x, y, w1, w2, 1.0f - w1 - w2);
+                    LinearColor* colors = &colorBuffer[pixel * samples];
+                    if (mask == fullMask) {
+                        pixelStates[pixel] = UNIFORM;
+                        colors[0] = color;
+                        continue;
+                    }
+                    if (pixelStates[pixel] != EXPANDED) {
+                        LinearColor fill = pixelStates[pixel] == UNIFORM ? colors[0] : LinearColor();
+                        for (int s = 0; s < samples; s++) colors[s] = fill;
+                        pixelStates[pixel] = EXPANDED;
+                    }
+                    for (int s = 0; s < samples; s++) {
+                        if (mask & (1u << s)) colors[s] = color;
+                    }
+                }
+            }
+        };
+
+        const int block = 8;
+        if ((maxX - minX + 1) * (maxY - minY + 1) <= 2 * block * block) {
+            rasterizeRect(minX, maxX, minY, maxY);
+            return;
+        }
+
+        // Блоки 8x8: отсчёты пикселей блока лежат в квадрате от (bx, by) до (toX + 1, toY + 1).
+        // Если по его углам одна из координат отрицательна везде - блок целиком снаружи
+        const float eps = 1e-5f;
+        for (int by = minY; by <= maxY; by += block) {
+            int toY = std::min(by + block - 1, maxY);
+            for (int bx = minX; bx <= maxX; bx += block) {
+                int toX = std::min(bx + block - 1, maxX);
+                bool out1 = true, out2 = true, out3 = true;
+                for (int corner = 0; corner < 4; corner++) {
+                    float cx = (float)((corner & 1) ? toX + 1 : bx), cy = (float)((corner & 2) ? toY + 1 : by);
+                    float w1 = A1 * cx + B1 * cy + C1, w2 = A2 * cx + B2 * cy + C2;
+                    out1 = out1 && w1 < -eps;
+                    out2 = out2 && w2 < -eps;
+                    out3 = out3 && 1.0f - w1 - w2 < -eps;
+                }
+                if (!out1 && !out2 && !out3) rasterizeRect(bx, toX, by, toY);
+            }
+        }
+    }
+
+    // Обход номеров из subset или, если его нет, всех от 0 до count - 1
+    template <typename Visit>
+    static void forEach(const std::vector<int>* subset, int count, Visit&& visit) {
+        if (subset) {
+            for (int i : *subset) visit(i);
+        } else {
+            for (int i = 0; i < count; i++) visit(i);
+        }
+    }
+
+    // Стадия закраски по режимам. Вершинные величины (освещённость, точки и нормали
+    // в мире) уже посчитаны - для отдельного треугольника или для всей сетки сразу
+
+    void shadeFlat(const ScreenTriangle& tri, const LinearColor& color) {
+        rasterizeScreenTriangle<false>(tri, [&](int, int, float, float, float) {
+            return color;
+        });
+    }
+
+    void shadeTextured(const ScreenTriangle& tri, const Point3D& t1, const Point3D& t2, const Point3D& t3) {
+        // Mip-уровень на весь треугольник: отношение его площади в текселях к площади в пикселях
+        int mipLevel = 0;
+        float pixelArea = std::abs((float)((tri.x2 - tri.x1) * (tri.y3 - tri.y1) - (tri.x3 - tri.x1) * (tri.y2 - tri.y1)));
+        float texelArea = std::abs((t2.x - t1.x) * (t3.y - t1.y) - (t3.x - t1.x) * (t2.y - t1.y)) *
+                          currentTexture->width * currentTexture->height;
+        if (pixelArea > 0 && texelArea > pixelArea) {
+            mipLevel = (int)(0.5f * std::log2(texelArea / pixelArea));
+        }
+        
+        rasterizeScreenTriangle<false>(tri, [&](int, int, float w1, float w2, float w3) {
+            float u = w1 * t1.x + w2 * t2.x + w3 * t3.x;
+            float v = w1 * t1.y + w2 * t2.y + w3 * t3.y;
+            
+            return toLinear(currentTexture->getColor(u, v, mipLevel));
+        });
+    }
+
+    // Модель Ламберта в вершине (Diff = max(0, N*L)); нормаль в мире, не нормированная
+    static float vertexLambert(const Point3D& worldPos, const Point3D& worldNormal, const Light& light) {
+        Point3D lightDir = (light.position - worldPos).normalize();
+        double diff = std::max(0.0, worldNormal.normalize().dot(lightDir));
+        return (float)diff;
+    }
+
+    // Гуро: i1..i3 - освещённость вершин. Для теней нужна точка в мире в каждом пикселе;
+    // освещённость вершин по-прежнему интерполируется, тень её только гасит
+    void shadeGouraud(const ScreenTriangle& tri, float i1, float i2, float i3,
+                      const Point3D& wP1, const Point3D& wP2, const Point3D& wP3,
+                      const Point3D& wN1, const Point3D& wN2, const Point3D& wN3,
+                      const LinearColor& albedo, const Light& light) {
+        LinearColor lightColor = toLinear(light.color);
+
+        rasterizeScreenTriangle<false>(tri, [&](int, int, float w1, float w2, float w3) {
+            // Интерполяция интенсивности (Гуро)
+            float pixelIntensity = w1 * i1 + w2 * i2 + w3 * i3;
+            if (shadowMap && pixelIntensity > 0) {
+                pixelIntensity *= shadowMap->visibility(wP1 * w1 + wP2 * w2 + wP3 * w3,
+                                                        (wN1 * w1 + wN2 * w2 + wN3 * w3).normalize());
+            }
+            
+            // Применение интенсивности к цвету; ограничение и гамма - при сведении кадра
+            return albedo * (lightColor * (pixelIntensity * light.intensity) + LinearColor(ambient, ambient, ambient));
+        });
+    }
+
+    // Фонг с тун-ступеньками: нормали вершин в мире уже нормированы
+    void shadePhongToon(const ScreenTriangle& tri,
+                        const Point3D& wP1, const Point3D& wP2, const Point3D& wP3,
+                        const Point3D& wN1, const Point3D& wN2, const Point3D& wN3,
+                        const LinearColor& albedo, const Light& light) {
+        LinearColor lightColor = toLinear(light.color);
+
+        rasterizeScreenTriangle<false>(tri, [&](int x, int y, float w1, float w2, float w3) {
+            Point3D pixelWorldPos = wP1 * w1 + wP2 * w2 + wP3 * w3;
+            Point3D pixelNormal = wN1 * w1 + wN2 * w2 + wN3 * w3;
+            pixelNormal = pixelNormal.normalize(); // Важно: повторная нормализация
+
+            Point3D lightDir = (light.position - pixelWorldPos).normalize();
+            
+            double lambert = std::max(0.0, pixelNormal.dot(lightDir));
+            if (shadowMap && lambert > 0) lambert *= shadowMap->visibility(pixelWorldPos, pixelNormal);
+            float diff = 0.2f + lambert;
+            //float intensityFactor = diff;
+             float intensityFactor = 1.0f;
+
+            if (diff < 0.4f) {
+                intensityFactor = diff * 0.3f; // Тень
+            } else if (diff < 0.7f) {
+                intensityFactor = diff * 1.0f; // Основной цвет
+            } else {
+                intensityFactor = diff * 1.3f; // Блик (Specular имитация)
+            }
+            
+            // Локальные источники плитки добавляются без ступенек
+            LinearColor incoming = lightColor * (intensityFactor * light.intensity);
+            if (lightGrid) {
+                lightGrid->forEachLight(x, y, [&](const Light& local) {
+                    float factor = localLightFactor(local, pixelWorldPos, pixelNormal);
+                    if (factor > 0) incoming = incoming + toLinear(local.color) * factor;
+                });
+            }
+            
+            // Применяем результат
+            return albedo * incoming;
+        });
+    }
+
+    // Сведение кадра: отсчёты MSAA усредняются в линейном пространстве (однородные
+    // пиксели просто копируются), затем вся строка за один проход проходит тональную
+    // компрессию и гамма-кодирование в RGBA8. Сводится только изменившаяся область
+    void resolve() {
+        resolvedPixels.resize((size_t)width * height * 4);
+        ScreenRect region = resolveRegion.clipped(width, height);
+        int fromX = region.x0, count = region.x1 - region.x0;
+        parallelFor("resolve", region.y0, std::max(region.y0, region.y1), 32, [&](int from, int to) {
+            std::vector<LinearColor> row(samples > 1 ? width : 0);
+            for (int y = from; y < to; y++) {
+                const LinearColor* linear = &colorBuffer[(size_t)y * width];
+                if (samples > 1) {
+                    for (int x = fromX; x < fromX + count; x++) {
+                        size_t pixel = (size_t)y * width + x;
+                        const LinearColor* colors = &colorBuffer[pixel * samples];
+                        if (pixelStates[pixel] == EXPANDED) {
+                            LinearColor sum;
+                            for (int s = 0; s < samples; s++) sum = sum + colors[s];
+                            row[x] = sum * (1.0f / samples);
+                        } else {
+                            row[x] = pixelStates[pixel] == UNIFORM ? colors[0] : LinearColor();
+                        }
                     }
+                    linear = row.data();
                 }
+                tonemapRow(linear + fromX, count, &resolvedPixels[((size_t)y * width + fromX) * 4]);
+            }
+        });
+        frameBuffer.create(width, height, resolvedPixels.data());
+        resolveNeeded = false;
+    }
+    
+public:
+    ZBuffer(int w, int h) : width(w), height(h), samples(1), resolveNeeded(false), clipRect{ 0, 0, w, h },
+                           currentTexture(nullptr), shadowMap(nullptr), lightGrid(nullptr), depthPrepassDone(false) {
+        zBuffer.resize(width * height);
+        colorBuffer.resize(width * height);
+        frameBuffer.create(width, height, sf::Color::Black);
+        clear();
+    }
+    
+    // Число отсчётов на пиксель: 1 (без сглаживания), 4 или 8
+    void setSampleCount(int count) {
+        samples = (count == 4 || count == 8) ? count : 1;
+        zBuffer.assign((size_t)width * height * samples, std::numeric_limits<float>::max());
+        colorBuffer.assign((size_t)width * height * samples, LinearColor());
+        pixelStates.assign(samples > 1 ? (size_t)width * height : 0, EMPTY);
+        clear();
+    }
+    
+    int getSampleCount() const {
+        return samples;
+    }
+    
+    void clear() {
+        // Заполнить буфер кадра фоновым значением; при сглаживании достаточно
+        // пометить пиксели пустыми
+        if (samples > 1) {
+            std::fill(pixelStates.begin(), pixelStates.end(), (sf::Uint8)EMPTY);
+        } else {
+            std::fill(colorBuffer.begin(), colorBuffer.end(), LinearColor());
+        }
+        resolveNeeded = true;
+        resolveRegion = { 0, 0, width, height };
+        
+        // Заполнить z-буфер максимальным значением z
+        std::fill(zBuffer.begin(), zBuffer.end(), std::numeric_limits<float>::max());
+        depthPrepassDone = false;
+    }
+    
+    // Частичная перерисовка: очистка только прямоугольника, остальной кадр сохраняется
+    void clearRect(const ScreenRect& rect) {
+        ScreenRect area = rect.clipped(width, height);
+        if (area.empty()) return;
+        for (int y = area.y0; y < area.y1; y++) {
+            size_t from = (size_t)y * width + area.x0, to = (size_t)y * width + area.x1;
+            if (samples > 1) {
+                std::fill(pixelStates.begin() + from, pixelStates.begin() + to, (sf::Uint8)EMPTY);
+            } else {
+                std::fill(colorBuffer.begin() + from, colorBuffer.begin() + to, LinearColor());
             }
+            std::fill(zBuffer.begin() + from * samples, zBuffer.begin() + to * samples,
+                      std::numeric_limits<float>::max());
         }
+        resolveRegion = resolveNeeded ? resolveRegion.united(area) : area;
+        resolveNeeded = true;
+        depthPrepassDone = false;
+    }
+    
+    // Треугольники растеризуются только внутри rect; resetClipRect - снова весь кадр
+    void setClipRect(const ScreenRect& rect) {
+        clipRect = rect.clipped(width, height);
+    }
+    
+    void resetClipRect() {
+        clipRect = { 0, 0, width, height };
+    }
+    
+    void setTexture(const Texture* texture) {
+        currentTexture = texture;
+    }
+    
+    // Карта теней для режимов Гуро и Фонга; nullptr - без теней
+    void setShadowMap(const ShadowMap* shadows) {
+        shadowMap = shadows;
+    }
+    
+    // Локальные источники по плиткам экрана для режима Фонга; nullptr - только основной
+    void setLightGrid(const LightGrid* grid) {
+        lightGrid = grid;
+    }
+    
+    // Предварительный проход: только глубина, то же ядро и те же значения z,
+    // что и при отрисовке, - иначе равенство глубин не сработает
+    void rasterizeTriangleDepth(const Point3D& p1, const Point3D& p2, const Point3D& p3,
+                                const Matrix4x4& mvp, bool backfaceCulling = true) {
+        ScreenTriangle tri;
+        if (!setupTriangle(p1, p2, p3, mvp, backfaceCulling, tri)) return;
+        rasterizeScreenTriangle<true>(tri, [](int, int, float, float, float) { return LinearColor(); });
+    }
+    
+    void finishDepthPrepass() {
+        depthPrepassDone = true;
+    }
+    
+    // Растеризация треугольника с использованием z-буфера
+    void rasterizeTriangle(const Point3D& p1, const Point3D& p2, const Point3D& p3, 
+                          const sf::Color& color, const Matrix4x4& mvp, bool backfaceCulling = true) {
+        ScreenTriangle tri;
+        if (!setupTriangle(p1, p2, p3, mvp, backfaceCulling, tri)) return;
+        shadeFlat(tri, toLinear(color));
     }
     
     // Растеризация полигона (разбиваем на треугольники)
@@ -116,64 +561,9 @@ public:
         
         if (!currentTexture) return;
         
-        Point3D v1 = mvp.transform(p1);
-        Point3D v2 = mvp.transform(p2);
-        Point3D v3 = mvp.transform(p3);
-        
-        if (v1.w != 0) { v1.x /= v1.w; v1.y /= v1.w; v1.z /= v1.w; }
-        if (v2.w != 0) { v2.x /= v2.w; v2.y /= v2.w; v2.z /= v2.w; }
-        if (v3.w != 0) { v3.x /= v3.w; v3.y /= v3.w; v3.z /= v3.w; }
-        
-        if (backfaceCulling) {
-            Point3D edge1 = v2 - v1;
-            Point3D edge2 = v3 - v1;
-            Point3D normal = edge1.cross(edge2);
-            if (normal.z <= 0) return;
-        }
-        
-        int x1 = (int)((v1.x + 1.0) * width / 2.0);
-        int y1 = (int)((-v1.y + 1.0) * height / 2.0);
-        float z1 = v1.z;
-        
-        int x2 = (int)((v2.x + 1.0) * width / 2.0);
-        int y2 = (int)((-v2.y + 1.0) * height / 2.0);
-        float z2 = v2.z;
-        
-        int x3 = (int)((v3.x + 1.0) * width / 2.0);
-        int y3 = (int)((-v3.y + 1.0) * height / 2.0);
-        float z3 = v3.z;
-        
-        int minX = std::max(0, std::min({x1, x2, x3}));
-        int maxX = std::min(width - 1, std::max({x1, x2, x3}));
-        int minY = std::max(0, std::min({y1, y2, y3}));
-        int maxY = std::min(height - 1, std::max({y1, y2, y3}));
-        
-        for (int y = minY; y <= maxY; y++) {
-            for (int x = minX; x <= maxX; x++) {
-                float denom = (float)((y2 - y3) * (x1 - x3) + (x3 - x2) * (y1 - y3));
-                if (denom == 0) continue;
-                
-                float w1 = ((y2 - y3) * (x - x3) + (x3 - x2) * (y - y3)) / denom;
-                float w2 = ((y3 - y1) * (x - x3) + (x1 - x3) * (y - y3)) / denom;
-                float w3 = 1.0f - w1 - w2;
-                
-                if (w1 >= 0 && w2 >= 0 && w3 >= 0) {
-                    float z = w1 * z1 + w2 * z2 + w3 * z3;
-                    
-                    int idx = y * width + x;
-                    
-                    if (z < zBuffer[idx]) {
-                        zBuffer[idx] = z;
-                        
-                        float u = w1 * t1.x + w2 * t2.x + w3 * t3.x;
-                        float v = w1 * t1.y + w2 * t2.y + w3 * t3.y;
-                        
-                        sf::Color texColor = currentTexture->getColor(u, v);
-                        frameBuffer.setPixel(x, y, texColor);
-                    }
-                }
-            }
-        }
+        ScreenTriangle tri;
+        if (!setupTriangle(p1, p2, p3, mvp, backfaceCulling, tri)) return;
+        shadeTextured(tri, t1, t2, t3);
     }
     
     void rasterizePolygonWithTexture(const Polygon& polygon, 
@@ -194,170 +584,93 @@ public:
         }
     }
 
-    // шейдинг Гуро
-    
-    void rasterizeTriangleGouraud(
-        const Point3D& p1, const Point3D& p2, const Point3D& p3,
-        const Point3D& n1, const Point3D& n2, const Point3D& n3,
-        const sf::Color& color, 
-        const Matrix4x4& mvp, const Matrix4x4& model, 
-        const Light& light) 
-    {
-        // Вспомогательная лямбда для модели Ламберта (Diff = max(0, N*L))
-        auto calculateLighting = [&](const Point3D& vertexPos, const Point3D& normal) -> float {
-            Point3D worldPos = model.transform(vertexPos); // Позиция в мире
-            Point3D worldNormal = model.transform(Point3D(normal.x, normal.y, normal.z, 0)).normalize();
-            
-            Point3D lightDir = (light.position - worldPos).normalize();
-            double diff = std::max(0.0, worldNormal.dot(lightDir));
-            return (float)diff;
-        };
-
-        float i1 = calculateLighting(p1, n1);
-        float i2 = calculateLighting(p2, n2);
-        float i3 = calculateLighting(p3, n3);
+    // Сетка целиком: вершинная стадия выполняется один раз на вершину, а не в каждом
+    // треугольнике, где вершина встречается; затем сборка и закраска треугольников.
+    // viewProjection - projection * view; текстура - текущая (setTexture).
+    // cluster - только грани и вершины этого кластера сетки
+    void drawMesh(const Mesh& mesh, const Material& material, const Matrix4x4& model,
+                  const Matrix4x4& viewProjection, const Light& light, const MeshCluster* cluster = nullptr) {
+        Material::Shading shading = material.shadingFor(mesh);
+        if (shading == Material::TEXTURED && !currentTexture) return;
+        bool cull = material.cullsBackFaces(mesh);
+        Matrix4x4 mvp = viewProjection * model;
 
-        Point3D v1 = mvp.transform(p1);
-        Point3D v2 = mvp.transform(p2);
-        Point3D v3 = mvp.transform(p3);
-        
-        if (v1.w != 0) { v1.x /= v1.w; v1.y /= v1.w; v1.z /= v1.w; }
-        if (v2.w != 0) { v2.x /= v2.w; v2.y /= v2.w; v2.z /= v2.w; }
-        if (v3.w != 0) { v3.x /= v3.w; v3.y /= v3.w; v3.z /= v3.w; }
-
-        // Backface culling
-        if (((v2.x - v1.x) * (v3.y - v1.y) - (v2.y - v1.y) * (v3.x - v1.x)) <= 0) return;
-
-        // Экранные координаты
-        int x1 = (int)((v1.x + 1.0) * width / 2.0);
-        int y1 = (int)((-v1.y + 1.0) * height / 2.0);
-        int x2 = (int)((v2.x + 1.0) * width / 2.0);
-        int y2 = (int)((-v2.y + 1.0) * height / 2.0);
-        int x3 = (int)((v3.x + 1.0) * width / 2.0);
-        int y3 = (int)((-v3.y + 1.0) * height / 2.0);
-
-        int minX = std::max(0, std::min({x1, x2, x3}));
-        int maxX = std::min(width - 1, std::max({x1, x2, x3}));
-        int minY = std::max(0, std::min({y1, y2, y3}));
-        int maxY = std::min(height - 1, std::max({y1, y2, y3}));
-
-        for (int y = minY; y <= maxY; y++) {
-            for (int x = minX; x <= maxX; x++) {
-                float denom = (float)((y2 - y3) * (x1 - x3) + (x3 - x2) * (y1 - y3));
-                if (denom == 0) continue;
-                
-                float w1 = ((y2 - y3) * (x - x3) + (x3 - x2) * (y - y3)) / denom;
-                float w2 = ((y3 - y1) * (x - x3) + (x1 - x3) * (y - y3)) / denom;
-                float w3 = 1.0f - w1 - w2;
-
-                if (w1 >= 0 && w2 >= 0 && w3 >= 0) {
-                    float z = w1 * v1.z + w2 * v2.z + w3 * v3.z;
-                    int idx = y * width + x;
+        int count = mesh.vertexCount();
+        projected.resize(count);
+        bool lit = shading == Material::GOURAUD || shading == Material::PHONG_TOON;
+        Matrix4x4 normalTransform;
+        if (lit) {
+            normalTransform = model.normalMatrix();
+            worldPositions.resize(count);
+            worldNormals.resize(count);
+            intensities.resize(count);
+        }
+        forEach(cluster ? &cluster->vertices : nullptr, count, [&](int v) {
+            projected[v] = projectVertex(mesh.positions[v], mvp);
+            if (!lit) return;
+            const Point3D& n = mesh.normals[v];
+            worldPositions[v] = model.transform(mesh.positions[v]);
+            worldNormals[v] = normalTransform.transform(Point3D(n.x, n.y, n.z, 0));
+            if (shading == Material::GOURAUD) {
+                intensities[v] = vertexLambert(worldPositions[v], worldNormals[v], light);
+            } else {
+                worldNormals[v] = worldNormals[v].normalize();
+            }
+        });
 
-                    if (z < zBuffer[idx]) {
-                        zBuffer[idx] = z;
-                        
-                        // Интерполяция интенсивности (Гуро)
-                        float pixelIntensity = w1 * i1 + w2 * i2 + w3 * i3;
-                        
-                        // Применение интенсивности к цвету
-                        sf::Uint8 r = (sf::Uint8)std::min(255.0f, color.r * pixelIntensity * light.intensity + 10); // +10 ambient
-                        sf::Uint8 g = (sf::Uint8)std::min(255.0f, color.g * pixelIntensity * light.intensity + 10);
-                        sf::Uint8 b = (sf::Uint8)std::min(255.0f, color.b * pixelIntensity * light.intensity + 10);
-                        
-                        frameBuffer.setPixel(x, y, sf::Color(r, g, b));
-                    }
+        ScreenTriangle tri;
+        forEach(cluster ? &cluster->faces : nullptr, mesh.faceCount(), [&](int f) {
+            const int* face = mesh.faceIndices(f);
+            LinearColor color = toLinear(material.faceColor(f));
+            for (int i = 1; i < mesh.faceSize(f) - 1; i++) {
+                int a = face[0], b = face[i], c = face[i + 1];
+                if (!assembleTriangle(projected[a], projected[b], projected[c], cull, tri)) continue;
+                switch (shading) {
+                case Material::GOURAUD:
+                    shadeGouraud(tri, intensities[a], intensities[b], intensities[c],
+                                 worldPositions[a], worldPositions[b], worldPositions[c],
+                                 worldNormals[a], worldNormals[b], worldNormals[c], color, light);
+                    break;
+                case Material::PHONG_TOON:
+                    shadePhongToon(tri, worldPositions[a], worldPositions[b], worldPositions[c],
+                                   worldNormals[a], worldNormals[b], worldNormals[c], color, light);
+                    break;
+                case Material::TEXTURED:
+                    shadeTextured(tri, mesh.texCoords[a], mesh.texCoords[b], mesh.texCoords[c]);
+                    break;
+                default:
+                    shadeFlat(tri, color);
                 }
             }
-        }
+        });
     }
 
-    void rasterizeTrianglePhongToon(
-        const Point3D& p1, const Point3D& p2, const Point3D& p3,
-        const Point3D& n1, const Point3D& n2, const Point3D& n3,
-        const sf::Color& color, 
-        const Matrix4x4& mvp, const Matrix4x4& model, 
-        const Light& light) 
-    {
-        Point3D v1 = mvp.transform(p1);
-        Point3D v2 = mvp.transform(p2);
-        Point3D v3 = mvp.transform(p3);
-        
-        Point3D wP1 = model.transform(p1);
-        Point3D wP2 = model.transform(p2);
-        Point3D wP3 = model.transform(p3);
-
-        Point3D wN1 = model.transform(Point3D(n1.x, n1.y, n1.z, 0)).normalize();
-        Point3D wN2 = model.transform(Point3D(n2.x, n2.y, n2.z, 0)).normalize();
-        Point3D wN3 = model.transform(Point3D(n3.x, n3.y, n3.z, 0)).normalize();
-
-        if (v1.w != 0) { v1.x /= v1.w; v1.y /= v1.w; v1.z /= v1.w; }
-        if (v2.w != 0) { v2.x /= v2.w; v2.y /= v2.w; v2.z /= v2.w; }
-        if (v3.w != 0) { v3.x /= v3.w; v3.y /= v3.w; v3.z /= v3.w; }
-
-        // Backface culling
-        if (((v2.x - v1.x) * (v3.y - v1.y) - (v2.y - v1.y) * (v3.x - v1.x)) <= 0) return;
-
-        int x1 = (int)((v1.x + 1.0) * width / 2.0);
-        int y1 = (int)((-v1.y + 1.0) * height / 2.0);
-        int x2 = (int)((v2.x + 1.0) * width / 2.0);
-        int y2 = (int)((-v2.y + 1.0) * height / 2.0);
-        int x3 = (int)((v3.x + 1.0) * width / 2.0);
-        int y3 = (int)((-v3.y + 1.0) * height / 2.0);
-
-        int minX = std::max(0, std::min({x1, x2, x3}));
-        int maxX = std::min(width - 1, std::max({x1, x2, x3}));
-        int minY = std::max(0, std::min({y1, y2, y3}));
-        int maxY = std::min(height - 1, std::max({y1, y2, y3}));
-
-        for (int y = minY; y <= maxY; y++) {
-            for (int x = minX; x <= maxX; x++) {
-                // Барицентрические координаты
-                float denom = (float)((y2 - y3) * (x1 - x3) + (x3 - x2) * (y1 - y3));
-                if (denom == 0) continue;
-                
-                float w1 = ((y2 - y3) * (x - x3) + (x3 - x2) * (y - y3)) / denom;
-                float w2 = ((y3 - y1) * (x - x3) + (x1 - x3) * (y - y3)) / denom;
-                float w3 = 1.0f - w1 - w2;
-
-                if (w1 >= 0 && w2 >= 0 && w3 >= 0) {
-                    float z = w1 * v1.z + w2 * v2.z + w3 * v3.z;
-                    int idx = y * width + x;
-
-                    if (z < zBuffer[idx]) {
-                        zBuffer[idx] = z;
-
-                        Point3D pixelWorldPos = wP1 * w1 + wP2 * w2 + wP3 * w3;
-                        Point3D pixelNormal = wN1 * w1 + wN2 * w2 + wN3 * w3;
-                        pixelNormal = pixelNormal.normalize(); // Важно: повторная нормализация
-
-                        Point3D lightDir = (light.position - pixelWorldPos).normalize();
-                        
-                        float diff = 0.2f + std::max(0.0, pixelNormal.dot(lightDir));
-                        //float intensityFactor = diff;
-                         float intensityFactor = 1.0f;
-
-                        if (diff < 0.4f) {
-                            intensityFactor = diff * 0.3f; // Тень
-                        } else if (diff < 0.7f) {
-                            intensityFactor = diff * 1.0f; // Основной цвет
-                        } else {
-                            intensityFactor = diff * 1.3f; // Блик (Specular имитация)
-                        }
-                        
-                        // Применяем результат
-                        sf::Uint8 r = (sf::Uint8)std::min(255.0f, color.r * intensityFactor * light.intensity);
-                        sf::Uint8 g = (sf::Uint8)std::min(255.0f, color.g * intensityFactor * light.intensity);
-                        sf::Uint8 b = (sf::Uint8)std::min(255.0f, color.b * intensityFactor * light.intensity);
-
-                        frameBuffer.setPixel(x, y, sf::Color(r, g, b));
-                    }
+    // Сетка целиком (или её кластер), только глубина - для предварительного прохода
+    void drawMeshDepth(const Mesh& mesh, const Matrix4x4& mvp, bool backfaceCulling,
+                       const MeshCluster* cluster = nullptr) {
+        projected.resize(mesh.vertexCount());
+        forEach(cluster ? &cluster->vertices : nullptr, mesh.vertexCount(), [&](int v) {
+            projected[v] = projectVertex(mesh.positions[v], mvp);
+        });
+        ScreenTriangle tri;
+        forEach(cluster ? &cluster->faces : nullptr, mesh.faceCount(), [&](int f) {
+            const int* face = mesh.faceIndices(f);
+            for (int i = 1; i < mesh.faceSize(f) - 1; i++) {
+                if (!assembleTriangle(projected[face[0]], projected[face[i]], projected[face[i + 1]], backfaceCulling, tri)) {
+                    continue;
                 }
+                rasterizeScreenTriangle<true>(tri, [](int, int, float, float, float) { return LinearColor(); });
             }
-        }
+        });
+    }
+    
+    // Глубина по отсчётам: getSampleCount() значений на пиксель
+    const std::vector<float>& getDepthBuffer() const {
+        return zBuffer;
     }
     
-    const sf::Image& getFrameBuffer() const {
+    const sf::Image& getFrameBuffer() {
+        if (resolveNeeded) resolve();
         return frameBuffer;
     }
     
@@ -380,7 +693,7 @@ public:
         
         for (int y = 0; y < height; y++) {
             for (int x = 0; x < width; x++) {
-                float z = zBuffer[y * width + x];
+                float z = zBuffer[((size_t)y * width + x) * samples];
                 
                 if (z == std::numeric_limits<float>::max()) {
                     zbufferImg.setPixel(x, y, sf::Color::Black);
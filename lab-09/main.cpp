@@ -7,11 +7,24 @@
 #include "lib/renderer.h"
 #include "lib/camera.h"
 #include "lib/zbuffer.h"
+#include "lib/asset_loader.h"
+#include "lib/terrain.h"
+#include "lib/marching_cubes.h"
+#include "lib/simplify.h"
+#include "lib/mesh_optimizer.h"
+#include "lib/half_edge.h"
+#include "lib/subdivision.h"
+#include "lib/bvh.h"
+#include "lib/raytracer.h"
+#include "lib/light_grid.h"
+#include "lib/frame_pipeline.h"
+#include <memory>
+#include <random>
 
 void printInstructions() {
     std::cout << "=== Управление ===" << std::endl;
     std::cout << "Фигуры: 1-Гексаэдр (куб), 2-Икосаэдр, 3-Тетраэдр, 4-Октаэдр, 5-Сцена" << std::endl;
-    std::cout << "Режимы: 6-Гуро, 7-Фонг/Тун, 8-Плоское, 9-Текстурирование" << std::endl;
+    std::cout << "Режимы: 6-Гуро, 7-Фонг/Тун, 8-Плоское, 9-Текстурирование, 0-Трассировка лучей" << std::endl;
     std::cout << "Преобразования:" << std::endl;
     std::cout << "  t/T - смещение по X" << std::endl;
     std::cout << "  s/S - масштаб" << std::endl;
@@ -25,8 +38,17 @@ void printInstructions() {
     std::cout << "  O - сохранить текущую модель в OBJ" << std::endl;
     std::cout << "  R - построить модель вращения гриба" << std::endl;
     std::cout << "  F - отобразить функцию" << std::endl;
+    std::cout << "  E - неявная поверхность f(x, y, z) = 0" << std::endl;
+    std::cout << "  G - ландшафт (чанки с уровнями детализации)" << std::endl;
+    std::cout << "  K - поверхность подразделения (Катмулл-Кларк/Loop)" << std::endl;
+    std::cout << "  D - тени от источника света (Гуро и Фонг)" << std::endl;
+    std::cout << "  J - 128 локальных источников (Фонг, плиточное отсечение) / убрать" << std::endl;
+    std::cout << "  Левая кнопка мыши - выбор объекта и грани" << std::endl;
+    std::cout << "  (в сцене преобразования применяются к выбранному объекту)" << std::endl;
     std::cout << "  q/Q - отдалить/приблизить камеру" << std::endl;
     std::cout << "  V - визуализация z-буфера" << std::endl;
+    std::cout << "  F1 - сглаживание MSAA (нет/4x/8x)" << std::endl;
+    std::cout << "  F2 - замеры времени задач планировщика" << std::endl;
     std::cout << "  W - переключение режима отрисовки (линии/z-буфер)" << std::endl;
     std::cout << "  B - переключение текстуры (1.jpg/2.jpg)" << std::endl;
     std::cout << "Стрелки - вращение камеры" << std::endl;
@@ -35,7 +57,9 @@ void printInstructions() {
 }
 
 struct SceneObject {
-    Polyhedron poly;
+    std::shared_ptr<const Mesh> mesh;
+    HalfEdgeMesh topology;
+    MeshBvh bvh;
     Matrix4x4 transform;
     sf::Color color;
 };
@@ -44,32 +68,67 @@ std::vector<SceneObject> createTestScene() {
     std::vector<SceneObject> objects;
     
     SceneObject obj1;
-    obj1.poly = createHexahedron();
+    obj1.mesh = std::make_shared<const Mesh>(buildMesh(createHexahedron()));
     obj1.transform = createTranslationMatrix(-1.5, 0, 0) * createScaleMatrix(0.7, 0.7, 0.7);
+    obj1.topology = HalfEdgeMesh(*obj1.mesh);
+    obj1.bvh = MeshBvh(*obj1.mesh);
     obj1.color = sf::Color::Red;
     objects.push_back(obj1);
     
     SceneObject obj2;
-    obj2.poly = createHexahedron();
+    obj2.mesh = std::make_shared<const Mesh>(buildMesh(createHexahedron()));
     obj2.transform = createTranslationMatrix(0, 0, -1.5) * createScaleMatrix(0.8, 0.8, 0.8);
+    obj2.topology = HalfEdgeMesh(*obj2.mesh);
+    obj2.bvh = MeshBvh(*obj2.mesh);
     obj2.color = sf::Color::Green;
     objects.push_back(obj2);
     
     SceneObject obj3;
-    obj3.poly = createHexahedron();
+    obj3.mesh = std::make_shared<const Mesh>(buildMesh(createHexahedron()));
     obj3.transform = createTranslationMatrix(1.5, 0, 1.0) * createScaleMatrix(0.6, 0.6, 0.6);
+    obj3.topology = HalfEdgeMesh(*obj3.mesh);
+    obj3.bvh = MeshBvh(*obj3.mesh);
     obj3.color = sf::Color::Blue;
     objects.push_back(obj3);
     
     SceneObject obj4;
-    obj4.poly = createIcosahedron();
+    obj4.mesh = std::make_shared<const Mesh>(buildMesh(createIcosahedron()));
     obj4.transform = createTranslationMatrix(0, 1.5, 0.5) * createScaleMatrix(0.5, 0.5, 0.5);
+    obj4.topology = HalfEdgeMesh(*obj4.mesh);
+    obj4.bvh = MeshBvh(*obj4.mesh);
     obj4.color = sf::Color::Yellow;
     objects.push_back(obj4);
     
     return objects;
 }
 
+// Россыпь небольших точечных источников и прожекторов вокруг начала координат
+std::vector<Light> createLightSwarm(int count) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> coord(-2.2, 2.2), unit(0.0, 1.0);
+    std::vector<Light> lights;
+    for (int i = 0; i < count; i++) {
+        Light light;
+        light.position = Point3D(coord(rng), coord(rng), coord(rng));
+        // Насыщенный цвет по случайному оттенку
+        double hue = unit(rng) * 6.0;
+        double f = hue - std::floor(hue);
+        double rgb[6][3] = { {1, f, 0}, {1 - f, 1, 0}, {0, 1, f}, {0, 1 - f, 1}, {f, 0, 1}, {1, 0, 1 - f} };
+        const double* c = rgb[(int)hue % 6];
+        light.color = sf::Color((sf::Uint8)(255 * c[0]), (sf::Uint8)(255 * c[1]), (sf::Uint8)(255 * c[2]));
+        light.intensity = 1.5f;
+        light.range = (float)(0.5 + 0.4 * unit(rng));
+        if (i % 2) {
+            light.type = Light::SPOT;
+            light.range *= 2.0f;
+            light.direction = (Point3D(0, 0, 0) - light.position).normalize();
+            light.direction.w = 0;
+        }
+        lights.push_back(light);
+    }
+    return lights;
+}
+
 int main() {
     const int WIDTH = 800;
     const int HEIGHT = 600;
@@ -77,16 +136,26 @@ int main() {
     sf::RenderWindow window(sf::VideoMode(WIDTH, HEIGHT), "Освещение и Текстурирование");
     window.setFramerateLimit(60);
     
-    Polyhedron currentPolyhedron = createHexahedron();
+    // Сетки кадра z-буфера растеризуются в фоне (FramePipeline), поэтому модель не
+    // меняется на месте: новая версия - новый объект, старый живёт, пока нужен кадру
+    std::shared_ptr<const Mesh> currentMesh = std::make_shared<const Mesh>(buildMesh(createHexahedron()));
     Camera camera(Point3D(0, 1, 5), Point3D(0, 0, 0));
-    ZBuffer zbuffer(WIDTH, HEIGHT);
+    // Растеризация кадра N + 1 идёт параллельно с показом кадра N
+    FramePipeline framePipeline(WIDTH, HEIGHT);
+    sf::Texture frameTexture;
+    RayTracer rayTracer(WIDTH, HEIGHT);
+    bool shadowsEnabled = true;
+    // Меняется при смене модели и при анимации вершин - для кэша карты теней
+    int geometryVersion = 0;
+    // Локальные источники (клавиша J) освещают только в режиме Фонга
+    std::vector<Light> localLights;
 
     Light mainLight;
     mainLight.position = Point3D(5, 5, 5); // Источник света
     mainLight.color = sf::Color::White;
     mainLight.intensity = 1.0f;
 
-    enum RenderMode { GOURAUD, PHONG_TOON, FLAT, TEXTURED, SCENE };
+    enum RenderMode { GOURAUD, PHONG_TOON, FLAT, TEXTURED, SCENE, RAYTRACED };
     RenderMode renderMode = FLAT;
     
     bool perspectiveProjection = true;
@@ -99,29 +168,272 @@ int main() {
     currentObjectTransformation.identity();
     
     std::vector<SceneObject> scene;
+    // Выбранный мышью объект сцены: преобразования клавишами двигают только его
+    int selectedObject = -1;
+    // Объекты, сдвинутые после прошлого кадра, когда больше ничего не менялось:
+    // такой кадр z-буфер перерисовывает только в их экранных рамках
+    std::vector<int> movedObjects;
+    // Дерево объектов сцены для выбора мышью: при смене матриц только пересчёт рамок
+    SceneBvh sceneBvh;
+    // Дерево текущей модели строится при первом щелчке после смены модели
+    std::unique_ptr<MeshBvh> currentBvh;
+    SceneBvh currentBvhScene;
+    int currentBvhVersion = -1;
+
+    // Ландшафт создаётся при первом нажатии G; sceneMode == 2
+    std::unique_ptr<Terrain> terrain;
+    const double terrainScale = 0.05;
+    // Ландшафт лежит в плоскости XY с высотой по Z; в мире высота идёт вдоль Y
+    Matrix4x4 terrainModel;
+    terrainModel.identity();
+    terrainModel.m[0][0] = terrainScale;
+    terrainModel.m[1][1] = 0;
+    terrainModel.m[1][2] = terrainScale;
+    terrainModel.m[2][1] = -terrainScale;
+    terrainModel.m[2][2] = 0;
     
+    // Декодирование jpg и разбор obj идут в фоне, окно отрисовывается сразу
+    AssetLoader assetLoader;
+
     Texture texture1, texture2;
     Texture* currentTexture = &texture1;
-    bool textureLoaded1 = texture1.loadFromFile("assets/textures/1.jpg");
-    bool textureLoaded2 = texture2.loadFromFile("assets/textures/2.jpg");
-    
-    if (!textureLoaded1 && !textureLoaded2) {
-        std::cout << "Предупреждение: не удалось загрузить текстуры!" << std::endl;
-    } else {
-        zbuffer.setTexture(currentTexture);
-        std::cout << "Текстуры загружены: 1.jpg=" << textureLoaded1 
-                  << ", 2.jpg=" << textureLoaded2 << std::endl;
-    }
+    bool textureLoaded1 = false;
+    bool textureLoaded2 = false;
+
+    auto loadTextureAsync = [&](const std::string& filename, Texture& target, bool& loaded) {
+        assetLoader.load<Texture>(
+            [filename] {
+                Texture texture;
+                if (!texture.loadFromFile(filename)) {
+                    std::cout << "Предупреждение: не удалось загрузить текстуру " << filename << std::endl;
+                }
+                return texture;
+            },
+            [&target, &loaded, &framePipeline, filename](Texture& texture) {
+                if (texture.width == 0) return;
+                // Кадр в работе может читать прежнюю текстуру
+                framePipeline.finish();
+                target = std::move(texture);
+                loaded = true;
+                std::cout << "Текстура загружена: " << filename << std::endl;
+            });
+    };
+    // Для плотных моделей в фоне грани переупорядочиваются под кэш вершин и перерисовку
+    // и строится цепочка упрощённых сеток; meshVersion отбрасывает результат,
+    // если модель успели сменить
+    struct PreparedMesh {
+        LodChain lods;
+        std::vector<HalfEdgeMesh> topology;
+        MeshOptimizationStats stats;
+    };
+    std::shared_ptr<const LodChain> currentLods;
+    HalfEdgeMesh currentTopology;
+    std::vector<HalfEdgeMesh> lodTopology;
+    int meshVersion = 0;
+    int shownLod = 0;
+    // Поверхность подразделения текущей модели и её управляющая сетка; при анимации
+    // каждый кадр пересчитываются только положения (prepare = false - без LOD и перестановок)
+    std::unique_ptr<SubdivisionSurface> subdivision;
+    Mesh subdivisionControl;
+    bool subdivisionAnimated = false;
+    sf::Clock subdivisionClock;
+    // Анимация пишет положения поочерёдно в два буфера: пока кадр в работе рисует
+    // один, пересчитывается другой (копия - только если он ещё кем-то удерживается)
+    std::shared_ptr<Mesh> animationBuffers[2];
+    int animationFrame = 0;
+    // Кластеры показанной сетки для сортировки по глубине: строятся заново при смене
+    // модели или уровня детализации, при анимации вершин пересчитываются только сферы
+    std::shared_ptr<std::vector<MeshCluster>> shownClusters;
+    const LodChain* clusteredLods = nullptr;
+    int clusteredLod = -1, clusteredMeshVersion = -1, clusteredGeometryVersion = -1;
+    auto setCurrentMesh = [&](Mesh mesh, bool prepare = true) {
+        currentMesh = std::make_shared<const Mesh>(std::move(mesh));
+        currentTopology = HalfEdgeMesh(*currentMesh);
+        currentLods.reset();
+        lodTopology.clear();
+        shownLod = 0;
+        subdivision.reset();
+        animationBuffers[0].reset();
+        animationBuffers[1].reset();
+        geometryVersion++;
+        int version = ++meshVersion;
+        if (!prepare || currentMesh->faceCount() < 2000) return;
+        auto source = std::make_shared<Mesh>(*currentMesh);
+        assetLoader.load<PreparedMesh>(
+            [source] {
+                PreparedMesh prepared;
+                prepared.stats = optimizeMesh(*source);
+                prepared.lods = buildLodChain(*source);
+                // Уровни независимы: перестановка граней уровня, затем его полурёберная структура
+                std::vector<MeshLod>& levels = prepared.lods.levels;
+                prepared.topology.resize(levels.size());
+                TaskGraph graph;
+                for (size_t i = 0; i < levels.size(); i++) {
+                    auto buildTopology = [&prepared, &levels, i] { prepared.topology[i] = HalfEdgeMesh(levels[i].mesh); };
+                    if (i == 0) {
+                        graph.add("lod topology", buildTopology);
+                    } else {
+                        int optimized = graph.add("lod optimize", [&levels, i] { optimizeMesh(levels[i].mesh); });
+                        graph.add("lod topology", buildTopology, { optimized });
+                    }
+                }
+                graph.run();
+                return prepared;
+            },
+            [&, version](PreparedMesh& prepared) {
+                if (version != meshVersion) return;
+                currentLods = std::make_shared<const LodChain>(std::move(prepared.lods));
+                lodTopology = std::move(prepared.topology);
+                const MeshOptimizationStats& stats = prepared.stats;
+                std::cout << "Порядок граней: ACMR " << stats.acmrBefore << " -> " << stats.acmrAfter
+                          << ", перерисовка " << stats.overdrawBefore << " -> " << stats.overdrawAfter << std::endl;
+                std::cout << "Уровни детализации:";
+                for (const auto& level : currentLods->levels) std::cout << " " << level.mesh.faceCount();
+                std::cout << std::endl;
+            });
+    };
+
+    auto currentProjection = [&]() {
+        if (perspectiveProjection) return createPerspectiveMatrix(45.0, (double)WIDTH / HEIGHT, 0.1, 100.0);
+        return createAxonometricMatrix(-2.0, 2.0, -2.0, 2.0, -10.0, 10.0);
+    };
+
+    // Дерево для выбора мышью и трассировки с актуальными матрицами (nullptr для ландшафта)
+    auto updatedBvh = [&]() -> const SceneBvh* {
+        if (sceneMode == 1) {
+            for (size_t i = 0; i < scene.size(); i++) {
+                sceneBvh.setTransform((int)i, currentObjectTransformation * scene[i].transform);
+            }
+            sceneBvh.refit();
+            return &sceneBvh;
+        }
+        if (sceneMode == 0) {
+            if (currentBvhVersion != meshVersion) {
+                sf::Clock clock;
+                currentBvh = std::make_unique<MeshBvh>(*currentMesh);
+                currentBvhScene = SceneBvh();
+                currentBvhScene.addInstance(currentBvh.get(), currentObjectTransformation);
+                currentBvhScene.build();
+                currentBvhVersion = meshVersion;
+                std::cout << "BVH: " << currentBvh->triangleCount() << " треугольников за "
+                          << clock.getElapsedTime().asMilliseconds() << " мс" << std::endl;
+            } else if (subdivision && subdivisionAnimated) {
+                currentBvh->refit(*currentMesh);
+            }
+            currentBvhScene.setTransform(0, currentObjectTransformation);
+            currentBvhScene.refit();
+            return &currentBvhScene;
+        }
+        return nullptr;
+    };
+
+    // Выбор мышью: луч из камеры через пиксель, ближайшее пересечение по дереву объектов
+    auto pick = [&](int mouseX, int mouseY) {
+        Matrix4x4 inverse = (currentProjection() * camera.getViewMatrix()).inverse();
+        double x = 2.0 * mouseX / WIDTH - 1.0, y = 1.0 - 2.0 * mouseY / HEIGHT;
+        Point3D nearPoint = inverse.transform(Point3D(x, y, -1));
+        Point3D farPoint = inverse.transform(Point3D(x, y, 1));
+        Ray ray;
+        ray.origin = nearPoint;
+        ray.direction = farPoint - nearPoint;
+
+        const SceneBvh* target = updatedBvh();
+        if (!target) {
+            std::cout << "Выбор мышью работает для модели и сцены" << std::endl;
+            return;
+        }
+
+        sf::Clock clock;
+        RayHit hit;
+        bool found = target->intersect(ray, hit);
+        sf::Int64 elapsed = clock.getElapsedTime().asMicroseconds();
+        if (sceneMode == 1) selectedObject = found ? hit.instance : -1;
+        if (!found) {
+            std::cout << "Пусто (" << elapsed << " мкс)" << std::endl;
+            return;
+        }
+        Point3D point = ray.origin + ray.direction * hit.t;
+        if (sceneMode == 1) std::cout << "Объект " << hit.instance << " выбран, ";
+        std::cout << "грань " << hit.face << ", точка (" << point.x << ", " << point.y << ", " << point.z
+                  << "), " << elapsed << " мкс" << std::endl;
+    };
+
+    loadTextureAsync("assets/textures/1.jpg", texture1, textureLoaded1);
+    loadTextureAsync("assets/textures/2.jpg", texture2, textureLoaded2);
 
     printInstructions();
     Point3D viewDirection(0, 0, 1);
+    sf::Clock profileClock;
+
+    // Выгрузка кадра в текстуру окна; размер текстуры меняется только вместе с кадром
+    auto drawFrameImage = [&](const sf::Image& image) {
+        if (frameTexture.getSize() != image.getSize()) frameTexture.create(image.getSize().x, image.getSize().y);
+        frameTexture.update(image);
+        sf::Sprite sprite(frameTexture);
+        window.draw(sprite);
+    };
+
+    // Кадр рисуется, только если что-то изменилось: клавиши, события окна, готовые
+    // загрузки, анимация, подгрузка чанков ландшафта. Иначе на экране остаётся последний
+    // кадр, а поток спит: в waitEvent, если меняться нечему, или короткими паузами,
+    // пока в фоне идут загрузки
+    bool frameDirty = true;
+    bool terrainStreaming = false;
 
     while (window.isOpen()) {
+        // Подмена загруженных в фоне моделей и текстур - только здесь, между кадрами
+        if (assetLoader.processCompleted() > 0) frameDirty = true;
+        if (terrainStreaming) frameDirty = true;
+
+        // Замеры планировщика (F2): по каждому виду задач - число, суммарное и наибольшее время
+        if (JobSystem::instance().isProfiling() && profileClock.getElapsedTime().asSeconds() > 2.0) {
+            double seconds = profileClock.restart().asSeconds();
+            struct Summary { int count = 0; double total = 0, longest = 0; };
+            std::map<std::string, Summary> summaries;
+            for (const TaskTiming& timing : JobSystem::instance().takeTimings()) {
+                Summary& summary = summaries[timing.name];
+                summary.count++;
+                summary.total += timing.durationMs;
+                summary.longest = std::max(summary.longest, timing.durationMs);
+            }
+            std::cout << "Задачи за " << seconds << " с:" << std::endl;
+            for (const auto& entry : summaries) {
+                std::cout << "  " << entry.first << ": " << entry.second.count << " шт., "
+                          << entry.second.total << " мс, наибольшая " << entry.second.longest << " мс" << std::endl;
+            }
+        }
+
+        if (subdivision && subdivisionAnimated) {
+            // Управляющие вершины колеблются вдоль направления от центра; совпадающие
+            // вершины шва смещаются одинаково
+            double time = subdivisionClock.getElapsedTime().asSeconds();
+            Point3D center = subdivisionControl.getCenter();
+            std::vector<Point3D> control = subdivisionControl.positions;
+            for (auto& p : control) {
+                p = center + (p - center) * (1.0 + 0.15 * sin(2.0 * time + 4.0 * p.y));
+            }
+            std::shared_ptr<Mesh>& target = animationBuffers[animationFrame++ % 2];
+            if (!target || target.use_count() > 1) target = std::make_shared<Mesh>(*currentMesh);
+            subdivision->evaluate(control, *target);
+            currentMesh = target;
+            geometryVersion++;
+            frameDirty = true;
+        }
+
+        bool idle = !frameDirty && !framePipeline.hasPendingFrame() && !assetLoader.isBusy() &&
+                    !JobSystem::instance().isProfiling();
         sf::Event event;
-        while (window.pollEvent(event)) {
+        for (bool hasEvent = idle ? window.waitEvent(event) : window.pollEvent(event); hasEvent;
+             hasEvent = window.pollEvent(event)) {
             if (event.type == sf::Event::Closed) {
                 window.close();
             }
+            if (event.type == sf::Event::Resized || event.type == sf::Event::GainedFocus) {
+                frameDirty = true;
+            }
+            if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
+                pick(event.mouseButton.x, event.mouseButton.y);
+            }
             if (event.type == sf::Event::KeyPressed) {
                 Matrix4x4 transformation;
                 transformation.identity();
@@ -130,28 +442,33 @@ int main() {
                     case sf::Keyboard::Escape: window.close(); break;
                     
                     case sf::Keyboard::Num1: 
-                        currentPolyhedron = createHexahedron(); 
+                        setCurrentMesh(buildMesh(createHexahedron())); 
                         sceneMode = 0;
                         std::cout << "Куб" << std::endl;
                         break;
                     case sf::Keyboard::Num2: 
-                        currentPolyhedron = createIcosahedron(); 
+                        setCurrentMesh(buildMesh(createIcosahedron())); 
                         sceneMode = 0;
                         std::cout << "Икосаэдр" << std::endl;
                         break;
                     case sf::Keyboard::Num3:
-                        currentPolyhedron = createTetrahedron();
+                        setCurrentMesh(buildMesh(createTetrahedron()));
                         sceneMode = 0;
                         std::cout << "Тетраэдр" << std::endl;
                         break;
                     case sf::Keyboard::Num4:
-                        currentPolyhedron = createOctahedron();
+                        setCurrentMesh(buildMesh(createOctahedron()));
                         sceneMode = 0;
                         std::cout << "Октаэдр" << std::endl;
                         break;
                     case sf::Keyboard::Num5:
                         scene = createTestScene();
+                        sceneBvh = SceneBvh();
+                        for (const auto& obj : scene) sceneBvh.addInstance(&obj.bvh, obj.transform);
+                        sceneBvh.build();
+                        geometryVersion++;
                         sceneMode = 1;
+                        selectedObject = -1;
                         std::cout << "Сцена с несколькими объектами" << std::endl;
                         break;
 
@@ -175,6 +492,11 @@ int main() {
                         std::cout << "Режим: Текстурирование" << std::endl;
                         useZBuffer = true;
                         break;
+                    case sf::Keyboard::Num0:
+                        renderMode = RAYTRACED;
+                        std::cout << "Режим: Трассировка лучей (тени и отражения; ландшафт - растеризация)" << std::endl;
+                        useZBuffer = true;
+                        break;
                     
                     case sf::Keyboard::T:
                         transformation = event.key.shift ? createTranslationMatrix(-0.5, 0, 0) : createTranslationMatrix(0.5, 0, 0);
@@ -200,7 +522,7 @@ int main() {
                     case sf::Keyboard::N: transformation = createReflectionMatrix('Y'); break;
                     
                     case sf::Keyboard::C: {
-                        Point3D center = currentPolyhedron.getCenter();
+                        Point3D center = currentMesh->getCenter();
                         Matrix4x4 toOrigin = createTranslationMatrix(-center.x, -center.y, -center.z);
                         Matrix4x4 scale = event.key.shift ? createScaleMatrix(0.7, 0.7, 0.7) : createScaleMatrix(1.5, 1.5, 1.5);
                         Matrix4x4 fromOrigin = createTranslationMatrix(center.x, center.y, center.z);
@@ -218,6 +540,39 @@ int main() {
                         std::cout << "Режим отрисовки: " << (useZBuffer ? "Z-Buffer" : "Линии") << std::endl;
                         break;
                     
+                    case sf::Keyboard::D:
+                        shadowsEnabled = !shadowsEnabled;
+                        std::cout << "Тени: " << (shadowsEnabled ? "ВКЛ" : "ВЫКЛ") << std::endl;
+                        break;
+                    
+                    case sf::Keyboard::J:
+                        if (localLights.empty()) {
+                            localLights = createLightSwarm(128);
+                            std::cout << "Локальных источников: " << localLights.size() << " (режим 7)" << std::endl;
+                        } else {
+                            localLights.clear();
+                            std::cout << "Локальные источники убраны" << std::endl;
+                        }
+                        break;
+                    
+                    case sf::Keyboard::F1: {
+                        int samples = framePipeline.getSampleCount();
+                        int next = samples == 1 ? 4 : (samples == 4 ? 8 : 1);
+                        framePipeline.setSampleCount(next);
+                        std::cout << "Сглаживание: " << (next == 1 ? std::string("нет") : std::to_string(next) + "x") << std::endl;
+                        break;
+                    }
+                    
+                    case sf::Keyboard::F2: {
+                        JobSystem& jobs = JobSystem::instance();
+                        jobs.setProfiling(!jobs.isProfiling());
+                        jobs.takeTimings();
+                        profileClock.restart();
+                        std::cout << "Замеры задач (" << jobs.threadCount() << " потоков): "
+                                  << (jobs.isProfiling() ? "ON" : "OFF") << std::endl;
+                        break;
+                    }
+                    
                     case sf::Keyboard::V:
                         showZBufferViz = !showZBufferViz;
                         std::cout << "Z-buffer visualization: " << (showZBufferViz ? "ON" : "OFF") << std::endl;
@@ -231,7 +586,6 @@ int main() {
                             currentTexture = &texture1;
                             std::cout << "Текстура: 1.jpg" << std::endl;
                         }
-                        zbuffer.setTexture(currentTexture);
                         break;
                     
                     case sf::Keyboard::R: {
@@ -257,7 +611,7 @@ int main() {
                                 {0.0, 0.6, 0.0}
                             };
 
-                            currentPolyhedron = generateSurfaceOfRevolution(profile, axis, n);
+                            setCurrentMesh(generateSurfaceOfRevolution(profile, axis, n));
                             sceneMode = 0;
                             break;
                         }
@@ -273,8 +627,13 @@ int main() {
                         std::cin >> x0 >> x1;
                         std::cout << "Введите диапазон Y (y0 y1): ";
                         std::cin >> y0 >> y1;
-                        std::cout << "Введите количество разбиений (например, 50): ";
+                        std::cout << "Введите количество разбиений (например, 50; 0 - адаптивное разбиение): ";
                         std::cin >> steps;
+                        double tolerance = 0;
+                        if (steps <= 0) {
+                            std::cout << "Введите допустимое отклонение по z (например, 0.01): ";
+                            std::cin >> tolerance;
+                        }
 
                         std::cout << "Выберите функцию:\n";
                         std::cout << "1 - z = sin(sqrt(x^2 + y^2))\n";
@@ -282,20 +641,129 @@ int main() {
                         std::cout << "3 - z = x^2 + y^2\n";
                         std::cin >> funcChoice;
 
-                        std::function<double(double,double)> func;
+                        // Каждая ветка передаёт свою лямбду, чтобы функция встраивалась в генератор
+                        auto build = [&](auto func) {
+                            if (steps > 0) {
+                                setCurrentMesh(generateFunctionSurface(func, x0, x1, y0, y1, steps));
+                            } else {
+                                setCurrentMesh(generateAdaptiveFunctionSurface(func, x0, x1, y0, y1, tolerance));
+                                std::cout << "Адаптивная сетка: " << currentMesh->faceCount() << " граней, "
+                                          << currentMesh->vertexCount() << " вершин" << std::endl;
+                            }
+                        };
 
                         switch (funcChoice) {
-                            case 1: func = [](double x, double y){ return sin(sqrt(x*x + y*y)); }; break;
-                            case 2: func = [](double x, double y){ return cos(x) * sin(y); }; break;
-                            case 3: func = [](double x, double y){ return x*x + y*y; }; break;
-                            default: func = [](double x, double y){ return 0.0; };
+                            case 1: build([](double x, double y){ return sin(sqrt(x*x + y*y)); }); break;
+                            case 2: build([](double x, double y){ return cos(x) * sin(y); }); break;
+                            case 3: build([](double x, double y){ return x*x + y*y; }); break;
+                            default: build([](double x, double y){ return 0.0; });
                         }
 
-                        currentPolyhedron = generateFunctionSurface(func, x0, x1, y0, y1, steps);
                         sceneMode = 0;
                         break;
                     }
 
+                    case sf::Keyboard::E: {
+                        int resolution;
+                        int funcChoice;
+
+                        std::cout << "Введите размер сетки (например, 128): ";
+                        std::cin >> resolution;
+
+                        std::cout << "Выберите поверхность:\n";
+                        std::cout << "1 - тор\n";
+                        std::cout << "2 - гироид в шаре\n";
+                        std::cout << "3 - капли (метаболы)\n";
+                        std::cin >> funcChoice;
+
+                        sf::Clock clock;
+                        auto build = [&](auto field) {
+                            setCurrentMesh(generateImplicitSurface(field, Point3D(-1.2, -1.2, -1.2),
+                                                                   Point3D(1.2, 1.2, 1.2), resolution));
+                        };
+
+                        switch (funcChoice) {
+                            case 1: build([](double x, double y, double z) {
+                                double q = sqrt(x*x + z*z) - 0.7;
+                                return sqrt(q*q + y*y) - 0.3;
+                            }); break;
+                            case 2: build([](double x, double y, double z) {
+                                double gyroid = sin(6*x)*cos(6*y) + sin(6*y)*cos(6*z) + sin(6*z)*cos(6*x);
+                                return std::max(std::abs(gyroid) - 0.3, sqrt(x*x + y*y + z*z) - 1.0);
+                            }); break;
+                            default: build([](double x, double y, double z) {
+                                const double centers[3][3] = { {0.4, 0, 0}, {-0.4, 0.2, 0}, {0, -0.3, 0.4} };
+                                double sum = 0;
+                                for (const auto& c : centers) {
+                                    double dx = x - c[0], dy = y - c[1], dz = z - c[2];
+                                    sum += 0.1 / (dx*dx + dy*dy + dz*dz + 1e-6);
+                                }
+                                return 1.0 - sum;
+                            });
+                        }
+                        std::cout << "Поверхность построена за " << clock.getElapsedTime().asMilliseconds() << " мс: "
+                                  << currentMesh->faceCount() << " треугольников" << std::endl;
+                        sceneMode = 0;
+                        break;
+                    }
+
+                    case sf::Keyboard::K: {
+                        // Подразделяется всегда исходная управляющая сетка, а не уже подразделённая
+                        Mesh control = subdivision ? subdivisionControl : *currentMesh;
+                        int levels;
+                        int animate;
+                        std::cout << "Уровень подразделения (0 - исходная сетка): ";
+                        std::cin >> levels;
+                        if (levels <= 0) {
+                            setCurrentMesh(control);
+                            sceneMode = 0;
+                            break;
+                        }
+                        std::cout << "Анимировать управляющую сетку? (1 - да, 0 - нет): ";
+                        std::cin >> animate;
+
+                        SubdivisionScheme scheme = SubdivisionSurface::defaultScheme(control);
+                        sf::Clock clock;
+                        auto surface = std::make_unique<SubdivisionSurface>(control, levels, scheme);
+                        int buildTime = clock.restart().asMilliseconds();
+                        Mesh refined = surface->evaluate(control.positions);
+                        std::cout << (scheme == SubdivisionScheme::Loop ? "Loop" : "Катмулл-Кларк")
+                                  << ", уровень " << surface->levels() << ": " << refined.faceCount() << " граней, "
+                                  << surface->stencilEntryCount() << " весов в шаблонах; построение " << buildTime
+                                  << " мс, пересчёт " << clock.getElapsedTime().asMilliseconds() << " мс" << std::endl;
+
+                        setCurrentMesh(std::move(refined), !animate);
+                        subdivision = std::move(surface);
+                        subdivisionControl = std::move(control);
+                        subdivisionAnimated = animate != 0;
+                        subdivisionClock.restart();
+                        sceneMode = 0;
+                        break;
+                    }
+
+                    case sf::Keyboard::G: {
+                        if (!terrain) {
+                            sf::Image heightmap;
+                            if (heightmap.loadFromFile("assets/textures/heightmap.png")) {
+                                terrain = std::make_unique<Terrain>(
+                                    Terrain::heightmapFunction(heightmap, -200, 200, -200, 200, 40.0),
+                                    -200, 200, -200, 200);
+                            } else {
+                                terrain = std::make_unique<Terrain>(
+                                    [](double x, double y) {
+                                        return 6.0 * sin(0.05 * x) * cos(0.043 * y) +
+                                               2.5 * sin(0.17 * x + 1.0) * sin(0.13 * y) +
+                                               0.6 * sin(0.9 * x) * cos(0.7 * y + 0.5);
+                                    },
+                                    -200, 200, -200, 200);
+                            }
+                        }
+                        sceneMode = 2;
+                        camera.radius = std::max(camera.radius, 8.0f);
+                        camera.updatePosition();
+                        break;
+                    }
+
                     case sf::Keyboard::Up: camera.rotateAroundTarget(0, 5.0f); break;
                     case sf::Keyboard::Down: camera.rotateAroundTarget(0, -5.0f); break;
                     case sf::Keyboard::Left: camera.rotateAroundTarget(-5.0f, 0); break;
@@ -311,15 +779,20 @@ int main() {
                         std::string path;
                         std::cout << "Введите имя файла OBJ для загрузки: ";
                         std::cin >> path;
-                        currentPolyhedron = loadOBJ(path);
-                        sceneMode = 0;
+                        assetLoader.load<Mesh>(
+                            [path] { return buildMesh(loadOBJ(path)); },
+                            [&](Mesh& loaded) {
+                                if (loaded.faceCount() == 0) return;
+                                setCurrentMesh(std::move(loaded));
+                                sceneMode = 0;
+                            });
                         break;
                     }
                     case sf::Keyboard::O: {
                         std::string path;
                         std::cout << "Введите имя файла OBJ для сохранения: ";
                         std::cin >> path;
-                        saveOBJ(currentPolyhedron, path);
+                        saveOBJ(*currentMesh, path);
                         break;
                     }
                     
@@ -329,139 +802,162 @@ int main() {
 
                     default: break;
                 }
-                currentObjectTransformation = transformation * currentObjectTransformation;
+
+                bool transforms = false;
+                for (int r = 0; r < 4; r++) {
+                    for (int c = 0; c < 4; c++) transforms |= transformation.m[r][c] != (r == c ? 1.0 : 0.0);
+                }
+                if (transforms && sceneMode == 1 && selectedObject >= 0 && selectedObject < (int)scene.size()) {
+                    scene[selectedObject].transform = transformation * scene[selectedObject].transform;
+                    movedObjects.push_back(selectedObject);
+                } else {
+                    currentObjectTransformation = transformation * currentObjectTransformation;
+                    frameDirty = true;
+                }
             }
         }
 
+        // Сдвиг объекта в кадре, где изменилось что-то ещё, - обычный полный кадр
+        if (frameDirty) movedObjects.clear();
+        if (!frameDirty && movedObjects.empty()) {
+            // Кадр, запущенный конвейером последним, ещё не показан
+            if (framePipeline.hasPendingFrame()) {
+                window.clear(sf::Color::Black);
+                drawFrameImage(framePipeline.latest());
+                window.display();
+            } else if (!idle) {
+                sf::sleep(sf::milliseconds(10));
+            }
+            continue;
+        }
+        frameDirty = false;
+        std::vector<int> frameMovedObjects;
+        frameMovedObjects.swap(movedObjects);
+
         window.clear(sf::Color::Black);
 
         Matrix4x4 viewMatrix, projMatrix;
 
         viewMatrix = camera.getViewMatrix();
         
-        if (perspectiveProjection) {
-            projMatrix = createPerspectiveMatrix(45.0, (double)WIDTH / HEIGHT, 0.1, 100.0);
-        } else {
-            projMatrix = createAxonometricMatrix(-2.0, 2.0, -2.0, 2.0, -10.0, 10.0);
+        projMatrix = currentProjection();
+
+        // Уровни детализации чанков выбираются по положению камеры в координатах ландшафта
+        const sf::Color lodColors[] = {
+            sf::Color::Red, {255, 128, 0}, sf::Color::Yellow, sf::Color::Green,
+            sf::Color::Cyan, sf::Color::Blue, sf::Color::Magenta
+        };
+        if (sceneMode == 2 && terrain) {
+            Point3D viewer(camera.position.x / terrainScale, -camera.position.z / terrainScale,
+                           camera.position.y / terrainScale);
+            terrain->update(viewer, HEIGHT / (2.0 * tan(22.5 * M_PI / 180.0)));
         }
+        terrainStreaming = sceneMode == 2 && terrain && terrain->pendingChunks() > 0;
 
-        if (useZBuffer) {
-            zbuffer.clear();
-            
-            std::map<Point3D, Point3D> vertexNormals;
-            if (sceneMode == 0 && (renderMode == GOURAUD || renderMode == PHONG_TOON)) {
-                vertexNormals = calculateSmoothNormals(currentPolyhedron);
+        // Уровень детализации текущей модели по её экранной погрешности
+        bool hasLods = currentLods && !currentLods->levels.empty();
+        if (hasLods && perspectiveProjection) {
+            int lod = selectLod(*currentLods, viewMatrix * currentObjectTransformation,
+                                HEIGHT / (2.0 * tan(22.5 * M_PI / 180.0)));
+            if (lod != shownLod) {
+                shownLod = lod;
+                std::cout << "LOD " << lod << ": " << currentLods->levels[lod].mesh.faceCount() << " граней" << std::endl;
             }
+        } else {
+            shownLod = 0;
+        }
+        // Уровень удерживает всю цепочку: кадр в работе переживёт её замену
+        std::shared_ptr<const Mesh> shownMesh =
+            hasLods ? std::shared_ptr<const Mesh>(currentLods, &currentLods->levels[shownLod].mesh) : currentMesh;
+        const HalfEdgeMesh& shownTopology = lodTopology.empty() ? currentTopology : lodTopology[shownLod];
 
+        const SceneBvh* tracedBvh = nullptr;
+        if (useZBuffer && renderMode == RAYTRACED && !showZBufferViz) tracedBvh = updatedBvh();
+        // Остальные режимы рисуют сразу; готовые кадры конвейера к ним не относятся
+        if (tracedBvh || !useZBuffer) framePipeline.finish();
+
+        if (tracedBvh) {
+            // Порядок объектов совпадает с порядком экземпляров в дереве
+            std::vector<TracedObject> traced;
             if (sceneMode == 1) {
-                for (auto& obj : scene) {
-                    Matrix4x4 modelMatrix = currentObjectTransformation * obj.transform;
-                    Matrix4x4 mvp = projMatrix * viewMatrix * modelMatrix;
-                    
-                    std::map<Point3D, Point3D> objNormals;
-                    if (renderMode == GOURAUD || renderMode == PHONG_TOON) {
-                        objNormals = calculateSmoothNormals(obj.poly);
-                    }
+                for (const auto& obj : scene) {
+                    TracedObject object;
+                    object.mesh = obj.mesh.get();
+                    object.model = currentObjectTransformation * obj.transform;
+                    object.palette = { obj.color };
+                    traced.push_back(object);
+                }
+            } else {
+                TracedObject object;
+                object.mesh = currentMesh.get();
+                object.model = currentObjectTransformation;
+                object.palette = { sf::Color::Red, sf::Color::Green, sf::Color::Blue,
+                                   sf::Color::Yellow, sf::Color::Cyan, sf::Color::Magenta };
+                if (textureLoaded1 || textureLoaded2) object.texture = currentTexture;
+                traced.push_back(object);
+            }
 
-                    for (const auto& polygon : obj.poly.polygons) {
-                        if (polygon.points.size() < 3) continue;
-
-                        for (size_t i = 1; i < polygon.points.size() - 1; i++) {
-                            Point3D p1 = polygon.points[0];
-                            Point3D p2 = polygon.points[i];
-                            Point3D p3 = polygon.points[i + 1];
-
-                            if (renderMode == GOURAUD) {
-                                zbuffer.rasterizeTriangleGouraud(
-                                    p1, p2, p3,
-                                    objNormals[p1], objNormals[p2], objNormals[p3],
-                                    obj.color, mvp, modelMatrix, mainLight
-                                );
-                            } 
-                            else if (renderMode == PHONG_TOON) {
-                                zbuffer.rasterizeTrianglePhongToon(
-                                    p1, p2, p3,
-                                    objNormals[p1], objNormals[p2], objNormals[p3],
-                                    obj.color, mvp, modelMatrix, mainLight
-                                );
-                            } 
-                            else if (renderMode == TEXTURED) {
-                                if (polygon.texCoords.size() >= 3) {
-                                    zbuffer.rasterizeTriangleWithTexture(
-                                        p1, p2, p3,
-                                        polygon.texCoords[0],
-                                        polygon.texCoords[i],
-                                        polygon.texCoords[i + 1],
-                                        mvp, backfaceCulling
-                                    );
-                                } else {
-                                    zbuffer.rasterizeTriangle(p1, p2, p3, obj.color, mvp, backfaceCulling);
-                                }
-                            }
-                            else {
-                                zbuffer.rasterizeTriangle(p1, p2, p3, obj.color, mvp, backfaceCulling);
-                            }
-                        }
-                    }
+            sf::Clock traceClock;
+            const sf::Image& frameImage = rayTracer.render(*tracedBvh, traced, (projMatrix * viewMatrix).inverse(), mainLight);
+            static sf::Clock reportClock;
+            if (reportClock.getElapsedTime().asSeconds() > 2.0) {
+                reportClock.restart();
+                std::cout << "Трассировка: " << traceClock.getElapsedTime().asMilliseconds() << " мс на кадр" << std::endl;
+            }
+            drawFrameImage(frameImage);
+        } else if (useZBuffer) {
+            // Описание кадра - копия состояния; растеризуется оно в фоне, а на экран
+            // сейчас попадает предыдущий готовый кадр
+            FrameDescription frame;
+            frame.view = viewMatrix;
+            frame.projection = projMatrix;
+            frame.light = mainLight;
+            frame.geometryVersion = geometryVersion;
+            frame.showDepth = showZBufferViz;
+            // Тени - в режимах с освещением; ландшафт их не отбрасывает
+            frame.shadows = shadowsEnabled && sceneMode != 2 && (renderMode == GOURAUD || renderMode == PHONG_TOON);
+            if (renderMode == PHONG_TOON) frame.localLights = localLights;
+            if (sceneMode == 1) frame.movedObjects = frameMovedObjects;
+
+            // Нормали уже лежат в сетке (из vn или посчитаны при загрузке); сетка без
+            // нормалей или без текстурных координат закрашивается цветом
+            Material material;
+            material.shading = renderMode == GOURAUD ? Material::GOURAUD
+                             : renderMode == PHONG_TOON ? Material::PHONG_TOON
+                             : renderMode == TEXTURED ? Material::TEXTURED : Material::FLAT;
+            material.texture = currentTexture;
+            material.backfaceCulling = backfaceCulling;
+
+            if (sceneMode == 2 && terrain) {
+                for (const auto& chunk : terrain->visibleChunks()) {
+                    material.palette = { lodColors[chunk.depth % 7] };
+                    frame.objects.push_back({ chunk.mesh, nullptr, material, terrainModel, false });
+                }
+            } else if (sceneMode == 1) {
+                for (const auto& obj : scene) {
+                    material.palette = { obj.color };
+                    frame.objects.push_back({ obj.mesh, nullptr, material, currentObjectTransformation * obj.transform });
                 }
             } else {
-                Matrix4x4 modelMatrix = currentObjectTransformation;
-                Matrix4x4 mvp = projMatrix * viewMatrix * modelMatrix;
-                
-                sf::Color colors[] = { sf::Color::Red, sf::Color::Green, sf::Color::Blue, 
-                                      sf::Color::Yellow, sf::Color::Cyan, sf::Color::Magenta };
-                int colorIdx = 0;
-
-                for (const auto& polygon : currentPolyhedron.polygons) {
-                    if (polygon.points.size() < 3) continue;
-
-                    sf::Color faceColor = colors[colorIdx % 6];
-                    colorIdx++;
-
-                    for (size_t i = 1; i < polygon.points.size() - 1; i++) {
-                        Point3D p1 = polygon.points[0];
-                        Point3D p2 = polygon.points[i];
-                        Point3D p3 = polygon.points[i + 1];
-
-                        if (renderMode == GOURAUD) {
-                            zbuffer.rasterizeTriangleGouraud(
-                                p1, p2, p3,
-                                vertexNormals[p1], vertexNormals[p2], vertexNormals[p3],
-                                faceColor, mvp, modelMatrix, mainLight
-                            );
-                        } 
-                        else if (renderMode == PHONG_TOON) {
-                            zbuffer.rasterizeTrianglePhongToon(
-                                p1, p2, p3,
-                                vertexNormals[p1], vertexNormals[p2], vertexNormals[p3],
-                                faceColor, mvp, modelMatrix, mainLight
-                            );
-                        } 
-                        else if (renderMode == TEXTURED) {
-                            if (polygon.texCoords.size() >= 3) {
-                                zbuffer.rasterizeTriangleWithTexture(
-                                    p1, p2, p3,
-                                    polygon.texCoords[0],
-                                    polygon.texCoords[i],
-                                    polygon.texCoords[i + 1],
-                                    mvp, backfaceCulling
-                                );
-                            } else {
-                                zbuffer.rasterizeTriangle(p1, p2, p3, faceColor, mvp, backfaceCulling);
-                            }
-                        }
-                        else {
-                            zbuffer.rasterizeTriangle(p1, p2, p3, faceColor, mvp, backfaceCulling);
-                        }
+                material.palette = { sf::Color::Red, sf::Color::Green, sf::Color::Blue,
+                                     sf::Color::Yellow, sf::Color::Cyan, sf::Color::Magenta };
+                if (meshVersion != clusteredMeshVersion || currentLods.get() != clusteredLods || shownLod != clusteredLod) {
+                    shownClusters = std::make_shared<std::vector<MeshCluster>>(buildMeshClusters(*shownMesh));
+                    clusteredLods = currentLods.get();
+                    clusteredLod = shownLod;
+                    clusteredMeshVersion = meshVersion;
+                } else if (geometryVersion != clusteredGeometryVersion) {
+                    // Прежние сферы может ещё читать кадр в работе
+                    if (shownClusters.use_count() > 1) {
+                        shownClusters = std::make_shared<std::vector<MeshCluster>>(*shownClusters);
                     }
+                    refitMeshClusters(*shownMesh, *shownClusters);
                 }
+                clusteredGeometryVersion = geometryVersion;
+                frame.objects.push_back({ shownMesh, shownClusters, material, currentObjectTransformation });
             }
-            
-            const sf::Image& frameImage = showZBufferViz ? zbuffer.getZBufferVisualization() : zbuffer.getFrameBuffer();
-            sf::Texture texture;
-            texture.loadFromImage(frameImage);
-            sf::Sprite sprite(texture);
-            window.draw(sprite);
+
+            drawFrameImage(framePipeline.advance(std::move(frame)));
             
         } else {
             {
@@ -481,92 +977,90 @@ int main() {
                     window.draw(line, 2, sf::Lines);
                 }
             }
+
+            // Каркас: вершины переводятся в систему камеры один раз, рёбра берутся из полурёберной
+            // структуры - общее ребро двух лицевых граней рисуется один раз
+            auto drawWireframe = [&](const Mesh& mesh, const HalfEdgeMesh& topology, const Matrix4x4& modelMatrix,
+                                     bool sortByDepth, const std::function<sf::Color(int)>& edgeColor) {
+                Matrix4x4 modelView = viewMatrix * modelMatrix;
+                std::vector<Point3D> viewPositions(mesh.vertexCount());
+                std::vector<sf::Vector2f> screenPositions(mesh.vertexCount());
+                for (int v = 0; v < mesh.vertexCount(); v++) {
+                    viewPositions[v] = modelView.transform(mesh.positions[v]);
+                    screenPositions[v] = project(viewPositions[v], projMatrix, WIDTH, HEIGHT);
+                }
+
+                auto faceCenter = [&](int f) {
+                    Point3D center(0, 0, 0);
+                    const int* face = mesh.faceIndices(f);
+                    for (int i = 0; i < mesh.faceSize(f); i++) center = center + viewPositions[face[i]];
+                    return center * (1.0 / mesh.faceSize(f));
+                };
+
+                std::vector<char> frontFacing(mesh.faceCount(), 0);
+                for (int f = 0; f < mesh.faceCount(); f++) {
+                    if (mesh.faceSize(f) < 3) continue;
+                    const int* face = mesh.faceIndices(f);
+                    Point3D a = viewPositions[face[1]] - viewPositions[face[0]];
+                    Point3D b = viewPositions[face[2]] - viewPositions[face[0]];
+                    Point3D normal = a.cross(b).normalize();
+                    Point3D viewDir = (Point3D(0,0,0) - faceCenter(f)).normalize();
+                    frontFacing[f] = normal.dot(viewDir) > 0;
+                }
+
+                std::vector<int> order(mesh.faceCount());
+                for (int f = 0; f < mesh.faceCount(); f++) order[f] = f;
+                if (sortByDepth) {
+                    std::vector<double> depth(mesh.faceCount());
+                    for (int f = 0; f < mesh.faceCount(); f++) {
+                        if (mesh.faceSize(f) > 0) depth[f] = faceCenter(f).z;
+                    }
+                    std::sort(order.begin(), order.end(), [&](int a, int b) { return depth[a] < depth[b]; });
+                }
+
+                int drawn = 0;
+                sf::VertexArray lines(sf::Lines);
+                for (int f : order) {
+                    if (!frontFacing[f]) continue;
+                    sf::Color color = edgeColor(drawn++);
+                    int first = topology.faceHalfEdge(f);
+                    for (int h = first; h < first + topology.faceSize(f); h++) {
+                        int twin = topology.twin(h);
+                        if (twin >= 0 && frontFacing[topology.face(twin)] && !topology.isEdgeRepresentative(h)) continue;
+                        lines.append(sf::Vertex(screenPositions[topology.origin(h)], color));
+                        lines.append(sf::Vertex(screenPositions[topology.target(h)], color));
+                    }
+                }
+                window.draw(lines);
+            };
             
-            if (sceneMode == 1) {
+            if (sceneMode == 2 && terrain) {
+                for (const auto& chunk : terrain->visibleChunks()) {
+                    drawWireframe(*chunk.mesh, *chunk.topology, terrainModel, false,
+                                  [&](int) { return lodColors[chunk.depth % 7]; });
+                }
+            } else if (sceneMode == 1) {
                 for (auto& obj : scene) {
-                    Polyhedron transformed = obj.poly;
-                    Matrix4x4 modelMatrix = currentObjectTransformation * obj.transform;
-                    transformed.transform(modelMatrix);
-                    transformed.transform(viewMatrix);
-
-                    for (const Polygon& polygon : transformed.polygons) {
-                        if (polygon.points.empty()) continue;
-
-                        Point3D normal = polygon.getNormal();
-                        Point3D center(0,0,0);
-                        for(const auto& p : polygon.points) center = center + p;
-                        center = center * (1.0 / polygon.points.size());
-                        Point3D viewDir = (Point3D(0,0,0) - center).normalize();
-                        double dotVal = normal.dot(viewDir);
-                        if (dotVal <= 0) continue;
-
-                        sf::VertexArray lines(sf::LineStrip);
-                        for (const Point3D& point : polygon.points) {
-                            sf::Vector2f screenPos = project(point, projMatrix, WIDTH, HEIGHT);
-                            lines.append(sf::Vertex(screenPos, obj.color));
-                        }
-                        if (!polygon.points.empty()) {
-                            sf::Vector2f screenPos = project(polygon.points[0], projMatrix, WIDTH, HEIGHT);
-                            lines.append(sf::Vertex(screenPos, obj.color));
-                        }
-                        window.draw(lines);
-                    }
+                    drawWireframe(*obj.mesh, obj.topology, currentObjectTransformation * obj.transform, false,
+                                  [&](int) { return obj.color; });
                 }
             } else {
-                Polyhedron transformed = currentPolyhedron;
-                transformed.transform(currentObjectTransformation);
-                transformed.transform(viewMatrix);
-
-                std::sort(transformed.polygons.begin(), transformed.polygons.end(), 
-                    [](const Polygon& a, const Polygon& b) {
-                        double zA = 0, zB = 0;
-                        for(const auto& p : a.points) zA += p.z;
-                        for(const auto& p : b.points) zB += p.z;
-                        return (zA / a.points.size()) < (zB / b.points.size());
-                    });
-
                 sf::Color colors[] = {
                     sf::Color::Red, sf::Color::Green, sf::Color::Blue,
                     sf::Color::Yellow, sf::Color::Magenta, sf::Color::Cyan,
                     {128, 128, 255}, {255, 128, 0}, {128, 255, 128}
                 };
-
-                int colorIndex = 0;
-                for (const Polygon& polygon : transformed.polygons) {
-                    if (polygon.points.empty()) continue;
-
-                    Point3D normal = polygon.getNormal();
-                    
-                    Point3D center(0,0,0);
-                    for(const auto& p : polygon.points) center = center + p;
-                    center = center * (1.0 / polygon.points.size());
-                    
-                    Point3D viewDir = (Point3D(0,0,0) - center).normalize();
-
-                    double dotVal = normal.dot(viewDir);
-
-                    if (dotVal <= 0) continue;
-
-                    sf::VertexArray lines(sf::LineStrip);
-                    
-                    for (const Point3D& point : polygon.points) {
-                        sf::Vector2f screenPos = project(point, projMatrix, WIDTH, HEIGHT);
-                        lines.append(sf::Vertex(screenPos, colors[colorIndex % 9]));
-                    }
-                    if (!polygon.points.empty()) {
-                        sf::Vector2f screenPos = project(polygon.points[0], projMatrix, WIDTH, HEIGHT);
-                        lines.append(sf::Vertex(screenPos, colors[colorIndex % 9]));
-                    }
-                    
-                    window.draw(lines);
-                    colorIndex++;
-                }
+                drawWireframe(*shownMesh, shownTopology, currentObjectTransformation, true,
+                              [&](int index) { return colors[index % 9]; });
             }
         }
 
         window.display();
     }
-    
+
+    // Кадр в работе ссылается на текстуры без владения, а они объявлены после
+    // конвейера и разрушаются раньше него: кадр нужно дождаться здесь
+    framePipeline.finish();
 
     return 0;
 }
\ No newline at end of file
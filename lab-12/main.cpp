@@ -7,6 +7,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "lib/texture_cache.h"
 
 enum Assignment {
     ASSIGNMENT_1 = 1, // Градиентный тетраэдр
@@ -323,6 +324,23 @@ std::vector<CubeVertexWithColor> createCubeVerticesWithColor() {
 
 // Загрузка текстуры из файла
 GLuint loadTexture(const std::string& filename) {
+    // Декодированные пиксели и mip-уровни берутся из дискового кэша (jpg декодируется один раз)
+    CachedTexture cached;
+    if (cached.load(filename)) {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, cached.levelCount() - 1);
+        for (int level = 0; level < cached.levelCount(); level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, cached.width(level), cached.height(level), 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, cached.levelData(level));
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
     sf::Image image;
     if (!image.loadFromFile(filename)) {
         std::cerr << "Не удалось загрузить текстуру: " << filename << std::endl;
@@ -0,0 +1,128 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Фоновая загрузка ресурсов.
+// Разбор файлов и декодирование выполняются в рабочих потоках, готовый результат
+// попадает в очередь завершённых задач. Главный поток раз в кадр вызывает
+// processCompleted() и только там подменяет данные, которыми пользуется отрисовка.
+class AssetLoader {
+public:
+    explicit AssetLoader(unsigned workerCount = 0) {
+        if (workerCount == 0) {
+            unsigned hw = std::thread::hardware_concurrency();
+            workerCount = hw > 1 ? hw - 1 : 1;
+        }
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~AssetLoader() {
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            stopping = true;
+        }
+        jobsCondition.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // work выполняется в рабочем потоке, onReady - в главном (внутри processCompleted).
+    // Если work выбросил исключение, вместо onReady там же вызывается onFailed
+    template <typename T>
+    void load(std::function<T()> work, std::function<void(T&)> onReady, std::function<void()> onFailed = nullptr) {
+        pending++;
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        jobs.push_back([this, work, onReady, onFailed] {
+            std::shared_ptr<T> result;
+            try {
+                result = std::make_shared<T>(work());
+            } catch (const std::exception& e) {
+                std::cerr << "Ошибка фоновой загрузки: " << e.what() << std::endl;
+                failed(onFailed);
+                return;
+            } catch (...) {
+                std::cerr << "Ошибка фоновой загрузки" << std::endl;
+                failed(onFailed);
+                return;
+            }
+            std::lock_guard<std::mutex> lock(completedMutex);
+            completed.push_back([result, onReady] { onReady(*result); });
+        });
+        jobsCondition.notify_one();
+    }
+
+    // Выполняет обработчики готовых загрузок; maxCount < 0 - все накопившиеся.
+    // Ограничение числа за кадр не даёт нескольким выгрузкам попасть в один кадр
+    int processCompleted(int maxCount = -1) {
+        int processed = 0;
+        while (maxCount < 0 || processed < maxCount) {
+            std::function<void()> callback;
+            {
+                std::lock_guard<std::mutex> lock(completedMutex);
+                if (completed.empty()) break;
+                callback = std::move(completed.front());
+                completed.pop_front();
+            }
+            callback();
+            pending--;
+            processed++;
+        }
+        return processed;
+    }
+
+    // Есть ли загрузки, результат которых ещё не обработан главным потоком
+    bool isBusy() const {
+        return pending > 0;
+    }
+
+private:
+    void failed(const std::function<void()>& onFailed) {
+        if (!onFailed) {
+            pending--;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(completedMutex);
+        completed.push_back(onFailed);
+    }
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(jobsMutex);
+                jobsCondition.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::deque<std::function<void()>> completed;
+    std::mutex jobsMutex;
+    std::mutex completedMutex;
+    std::condition_variable jobsCondition;
+    std::atomic<int> pending{0};
+    bool stopping = false;
+};
+
+#endif
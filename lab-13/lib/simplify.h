@@ -0,0 +1,371 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// Упрощение сетки стягиванием рёбер по квадратичной метрике ошибки (QEM).
+// Версия для индексированных буферов OpenGL: упрощённые уровни ссылаются на те же
+// вершины, что и исходная модель, поэтому все уровни живут в одном VBO, а в
+// индексный буфер кладутся подряд.
+//
+// Стягивается полуребро v -> u: вершина v исчезает, u остаётся на месте, новых
+// вершин не появляется. Вершины с одинаковыми координатами (шов развёртки или
+// нормалей) считаются одной точкой топологии; точки шва не удаляются, так что швы
+// uv сохраняются точно. Точка границы может сдвинуться только вдоль границы, а
+// к её квадрике добавлены плоскости, перпендикулярные граничным рёбрам.
+class MeshSimplifier {
+public:
+    // triangles - тройки индексов вершин positions
+    MeshSimplifier(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& triangles)
+        : positions(positions) {
+        buildTopology(triangles);
+        buildQuadrics();
+        for (int g = 0; g < (int)groupPosition.size(); g++) {
+            pushEdges(g);
+        }
+    }
+
+    // Стягивает рёбра, пока треугольников больше targetTriangles и ошибка очередного
+    // стягивания не больше errorLimit. Возвращает false, если цель не достигнута
+    bool simplifyTo(int targetTriangles, double errorLimit = 1e30) {
+        while (liveTriangles > targetTriangles) {
+            if (heap.empty()) return false;
+            Candidate c = heap.top();
+            if (c.error > errorLimit * errorLimit) return false;
+            heap.pop();
+            if (removedGroup[c.from] || removedGroup[c.to]) continue;
+            if (c.fromVersion != version[c.from] || c.toVersion != version[c.to]) continue;
+            int keepVertex;
+            if (!canCollapse(c.from, c.to, keepVertex)) continue;
+            collapse(c.from, c.to, keepVertex);
+            maxError = std::max(maxError, c.error);
+        }
+        return true;
+    }
+
+    int triangleCount() const { return liveTriangles; }
+
+    // Наибольшее отклонение от исходной поверхности среди выполненных стягиваний
+    // (корень из средней квадратичной ошибки по плоскостям квадрики)
+    double error() const { return std::sqrt(std::max(0.0, maxError)); }
+
+    // Индексы оставшихся треугольников (по исходным вершинам)
+    std::vector<uint32_t> triangles() const {
+        std::vector<uint32_t> result;
+        result.reserve((size_t)liveTriangles * 3);
+        for (size_t t = 0; t < triangleRemoved.size(); t++) {
+            if (triangleRemoved[t]) continue;
+            result.insert(result.end(), corners.begin() + t * 3, corners.begin() + t * 3 + 3);
+        }
+        return result;
+    }
+
+private:
+    // Симметричная матрица 4x4 квадрики: 10 коэффициентов и суммарный вес плоскостей
+    struct Quadric {
+        double a[10] = {};
+        double weight = 0;
+
+        void addPlane(const glm::vec3& n, double d, double w) {
+            double p[4] = { n.x, n.y, n.z, d };
+            int k = 0;
+            for (int i = 0; i < 4; i++) {
+                for (int j = i; j < 4; j++) {
+                    a[k++] += w * p[i] * p[j];
+                }
+            }
+            weight += w;
+        }
+
+        void add(const Quadric& q) {
+            for (int i = 0; i < 10; i++) a[i] += q.a[i];
+            weight += q.weight;
+        }
+
+        double evaluate(const glm::vec3& p) const {
+            double v[4] = { p.x, p.y, p.z, 1.0 };
+            double sum = 0;
+            int k = 0;
+            for (int i = 0; i < 4; i++) {
+                for (int j = i; j < 4; j++) {
+                    sum += (i == j ? 1.0 : 2.0) * a[k++] * v[i] * v[j];
+                }
+            }
+            return sum;
+        }
+    };
+
+    struct Candidate {
+        double error;
+        int from, to;
+        int fromVersion, toVersion;
+        bool operator<(const Candidate& other) const { return error > other.error; }
+    };
+
+    void buildTopology(const std::vector<uint32_t>& triangles) {
+        struct PointHash {
+            size_t operator()(const glm::vec3& p) const {
+                std::hash<float> h;
+                return h(p.x) ^ (h(p.y) * 31) ^ (h(p.z) * 131);
+            }
+        };
+        struct PointEqual {
+            bool operator()(const glm::vec3& a, const glm::vec3& b) const {
+                return a.x == b.x && a.y == b.y && a.z == b.z;
+            }
+        };
+
+        std::unordered_map<glm::vec3, int, PointHash, PointEqual> groupOf;
+        vertexGroup.resize(positions.size());
+        for (size_t v = 0; v < positions.size(); v++) {
+            auto inserted = groupOf.emplace(positions[v], (int)groupPosition.size());
+            if (inserted.second) {
+                groupPosition.push_back(positions[v]);
+                seam.push_back(false);
+            } else {
+                // Одна точка, несколько вершин - шов атрибутов
+                seam[inserted.first->second] = true;
+            }
+            vertexGroup[v] = inserted.first->second;
+        }
+
+        int groupCount = (int)groupPosition.size();
+        groupTriangles.resize(groupCount);
+        removedGroup.assign(groupCount, false);
+        version.assign(groupCount, 0);
+        boundary.assign(groupCount, false);
+
+        for (size_t t = 0; t + 2 < triangles.size(); t += 3) {
+            int a = (int)triangles[t], b = (int)triangles[t + 1], c = (int)triangles[t + 2];
+            if (vertexGroup[a] == vertexGroup[b] || vertexGroup[b] == vertexGroup[c] ||
+                vertexGroup[a] == vertexGroup[c]) continue;
+            int index = (int)triangleRemoved.size();
+            corners.insert(corners.end(), { a, b, c });
+            triangleRemoved.push_back(false);
+            for (int v : { a, b, c }) groupTriangles[vertexGroup[v]].push_back(index);
+        }
+        liveTriangles = (int)triangleRemoved.size();
+    }
+
+    int groupAt(int triangle, int corner) const { return vertexGroup[corners[triangle * 3 + corner]]; }
+
+    glm::vec3 triangleNormal(int t, int movedGroup = -1, const glm::vec3& movedTo = glm::vec3(0.0f)) const {
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; k++) {
+            int g = groupAt(t, k);
+            p[k] = g == movedGroup ? movedTo : groupPosition[g];
+        }
+        return glm::cross(p[1] - p[0], p[2] - p[0]);
+    }
+
+    void buildQuadrics() {
+        quadric.assign(groupPosition.size(), Quadric());
+        std::unordered_map<long long, int> edgeUse;
+        auto edgeKey = [&](int a, int b) { return (long long)std::min(a, b) * (long long)groupPosition.size() + std::max(a, b); };
+
+        for (int t = 0; t < (int)triangleRemoved.size(); t++) {
+            glm::vec3 n = triangleNormal(t);
+            double area = glm::length(n) * 0.5;
+            if (area <= 0) continue;
+            n = n * (float)(0.5 / area);
+            double d = -glm::dot(n, groupPosition[groupAt(t, 0)]);
+            for (int k = 0; k < 3; k++) {
+                quadric[groupAt(t, k)].addPlane(n, d, area);
+                edgeUse[edgeKey(groupAt(t, k), groupAt(t, (k + 1) % 3))]++;
+            }
+        }
+
+        // Граничные рёбра: плоскость через ребро перпендикулярно грани с большим весом
+        for (int t = 0; t < (int)triangleRemoved.size(); t++) {
+            glm::vec3 n = triangleNormal(t);
+            if (glm::length(n) <= 0) continue;
+            n = glm::normalize(n);
+            for (int k = 0; k < 3; k++) {
+                int a = groupAt(t, k), b = groupAt(t, (k + 1) % 3);
+                if (edgeUse[edgeKey(a, b)] != 1) continue;
+                boundary[a] = boundary[b] = true;
+                glm::vec3 edge = groupPosition[b] - groupPosition[a];
+                double length = glm::length(edge);
+                if (length <= 0) continue;
+                glm::vec3 side = glm::normalize(glm::cross(edge, n));
+                double w = 10.0 * length * length;
+                quadric[a].addPlane(side, -glm::dot(side, groupPosition[a]), w);
+                quadric[b].addPlane(side, -glm::dot(side, groupPosition[a]), w);
+            }
+        }
+    }
+
+    template <typename Visit>
+    void forEachNeighbor(int g, Visit visit) const {
+        for (int t : groupTriangles[g]) {
+            if (triangleRemoved[t]) continue;
+            for (int k = 0; k < 3; k++) {
+                int other = groupAt(t, k);
+                if (other != g) visit(other);
+            }
+        }
+    }
+
+    double collapseError(int from, int to) const {
+        Quadric q = quadric[from];
+        q.add(quadric[to]);
+        return q.weight > 0 ? q.evaluate(groupPosition[to]) / q.weight : 0.0;
+    }
+
+    void pushEdges(int g) {
+        std::vector<int> neighbors;
+        forEachNeighbor(g, [&](int n) { neighbors.push_back(n); });
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+        for (int n : neighbors) {
+            if (!seam[g]) heap.push({ collapseError(g, n), g, n, version[g], version[n] });
+            if (!seam[n]) heap.push({ collapseError(n, g), n, g, version[n], version[g] });
+        }
+    }
+
+    bool canCollapse(int from, int to, int& keepVertex) const {
+        if (seam[from]) return false;
+
+        // Треугольники на ребре и вершина u, которой заменятся углы v
+        int sharedTriangles = 0;
+        keepVertex = -1;
+        for (int t : groupTriangles[from]) {
+            if (triangleRemoved[t]) continue;
+            for (int k = 0; k < 3; k++) {
+                if (groupAt(t, k) != to) continue;
+                sharedTriangles++;
+                int vertex = corners[t * 3 + k];
+                if (keepVertex >= 0 && keepVertex != vertex) return false;
+                keepVertex = vertex;
+            }
+        }
+        if (sharedTriangles == 0) return false;
+        // Граничная точка сдвигается только вдоль границы
+        if (boundary[from] && sharedTriangles != 1) return false;
+
+        // Условие связности: общих соседей столько же, сколько треугольников на ребре
+        std::vector<int> fromNeighbors, toNeighbors;
+        forEachNeighbor(from, [&](int n) { fromNeighbors.push_back(n); });
+        forEachNeighbor(to, [&](int n) { toNeighbors.push_back(n); });
+        std::sort(fromNeighbors.begin(), fromNeighbors.end());
+        fromNeighbors.erase(std::unique(fromNeighbors.begin(), fromNeighbors.end()), fromNeighbors.end());
+        std::sort(toNeighbors.begin(), toNeighbors.end());
+        toNeighbors.erase(std::unique(toNeighbors.begin(), toNeighbors.end()), toNeighbors.end());
+        std::vector<int> common;
+        std::set_intersection(fromNeighbors.begin(), fromNeighbors.end(),
+                              toNeighbors.begin(), toNeighbors.end(), std::back_inserter(common));
+        if ((int)common.size() != sharedTriangles) return false;
+
+        // Оставшиеся треугольники вокруг v не должны перевернуться или выродиться
+        for (int t : groupTriangles[from]) {
+            if (triangleRemoved[t]) continue;
+            bool hasTo = groupAt(t, 0) == to || groupAt(t, 1) == to || groupAt(t, 2) == to;
+            if (hasTo) continue;
+            glm::vec3 before = triangleNormal(t);
+            glm::vec3 after = triangleNormal(t, from, groupPosition[to]);
+            double beforeLength = glm::length(before), afterLength = glm::length(after);
+            if (afterLength <= 1e-12 * (1.0 + beforeLength)) return false;
+            if (glm::dot(before, after) <= 0.2 * beforeLength * afterLength) return false;
+        }
+        return true;
+    }
+
+    void collapse(int from, int to, int keepVertex) {
+        for (int t : groupTriangles[from]) {
+            if (triangleRemoved[t]) continue;
+            bool hasTo = groupAt(t, 0) == to || groupAt(t, 1) == to || groupAt(t, 2) == to;
+            if (hasTo) {
+                triangleRemoved[t] = true;
+                liveTriangles--;
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                if (groupAt(t, k) == from) corners[t * 3 + k] = keepVertex;
+            }
+            groupTriangles[to].push_back(t);
+        }
+        groupTriangles[from].clear();
+        removedGroup[from] = true;
+        quadric[to].add(quadric[from]);
+        boundary[to] = boundary[to] || boundary[from];
+
+        // Убираем удалённые треугольники из списка u, иначе списки только растут
+        auto& list = groupTriangles[to];
+        list.erase(std::remove_if(list.begin(), list.end(), [&](int t) { return triangleRemoved[t]; }), list.end());
+
+        version[to]++;
+        pushEdges(to);
+    }
+
+    std::vector<glm::vec3> positions;
+    std::vector<int> vertexGroup;
+    std::vector<glm::vec3> groupPosition;
+    std::vector<std::vector<int>> groupTriangles;
+    std::vector<bool> seam;
+    std::vector<bool> boundary;
+    std::vector<bool> removedGroup;
+    std::vector<int> version;
+    std::vector<Quadric> quadric;
+
+    std::vector<int> corners;
+    std::vector<bool> triangleRemoved;
+    int liveTriangles = 0;
+
+    std::priority_queue<Candidate> heap;
+    double maxError = 0;
+};
+
+// Диапазон индексного буфера одного уровня детализации и его погрешность
+// в единицах модели
+struct LodRange {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+// Дописывает в indices упрощённые уровни (каждый примерно в reduction раз меньше
+// предыдущего) и возвращает диапазоны всех уровней; нулевой - исходные индексы.
+// Упрощение останавливается, когда погрешность доходит до maxRelativeError от радиуса
+inline std::vector<LodRange> BuildLodIndices(const std::vector<glm::vec3>& positions, std::vector<uint32_t>& indices,
+                                             float radius, int maxLevels = 5, float reduction = 0.5f,
+                                             int minTriangles = 32, float maxRelativeError = 0.05f) {
+    std::vector<LodRange> lods;
+    lods.push_back({ 0, (uint32_t)indices.size(), 0.0f });
+
+    MeshSimplifier simplifier(positions, indices);
+    int target = simplifier.triangleCount();
+    for (int level = 1; level < maxLevels; level++) {
+        int previous = simplifier.triangleCount();
+        target = (int)(target * reduction);
+        if (target < minTriangles) break;
+        simplifier.simplifyTo(target, radius * maxRelativeError);
+        if (simplifier.triangleCount() > previous * 0.9) break;
+
+        std::vector<uint32_t> levelIndices = simplifier.triangles();
+        lods.push_back({ (uint32_t)indices.size(), (uint32_t)levelIndices.size(), (float)simplifier.error() });
+        indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+    }
+    return lods;
+}
+
+// Самый грубый уровень, погрешность которого на экране не больше pixelError.
+// scale - масштаб модели, distance - расстояние от камеры,
+// pixelsPerUnit - пикселей на единицу длины на расстоянии 1
+inline int SelectLod(const std::vector<LodRange>& lods, float distance, float scale,
+                     float pixelsPerUnit, float pixelError = 1.0f) {
+    distance = std::max(distance, 1e-3f);
+    for (int level = (int)lods.size() - 1; level > 0; level--) {
+        if (lods[level].error * scale * pixelsPerUnit / distance <= pixelError) return level;
+    }
+    return 0;
+}
+
+#endif
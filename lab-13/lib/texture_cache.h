@@ -0,0 +1,280 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Кэш декодированных текстур.
+// Для каждого исходного jpg/png на диске хранится файл с готовыми пикселями RGBA8
+// и полной цепочкой mip-уровней. Файл отображается в память (mmap) целиком,
+// так что повторный запуск не декодирует jpg и не строит mip-уровни. Если кэш
+// записать нельзя (каталог только для чтения), те же данные остаются в памяти:
+// кэш ускоряет загрузку, но никогда не мешает ей.
+//
+// Формат файла (все поля little-endian, как в памяти):
+//   TextureCacheHeader
+//   TextureCacheLevel[levelCount]
+//   пиксели уровней подряд, каждый уровень выровнен на 16 байт
+// Строки хранятся перевёрнутыми по вертикали: первая строка - низ изображения,
+// как ожидает glTexImage2D.
+
+struct TextureCacheHeader {
+    char magic[8];       // "TEXCACHE"
+    uint32_t version;
+    uint32_t levelCount;
+    uint64_t sourceHash; // FNV-1a исходного файла
+    uint64_t sourceSize;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct TextureCacheLevel {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;     // смещение пикселей уровня от начала файла
+};
+
+class CachedTexture {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    CachedTexture() = default;
+    ~CachedTexture() { release(); }
+
+    CachedTexture(const CachedTexture&) = delete;
+    CachedTexture& operator=(const CachedTexture&) = delete;
+
+    CachedTexture(CachedTexture&& other) noexcept { *this = std::move(other); }
+    CachedTexture& operator=(CachedTexture&& other) noexcept {
+        if (this != &other) {
+            release();
+            mapped = other.mapped;
+            mappedSize = other.mappedSize;
+            memory = std::move(other.memory);
+            other.mapped = nullptr;
+            other.mappedSize = 0;
+        }
+        return *this;
+    }
+
+    // Загружает текстуру через кэш: при совпадении хэша исходника файл кэша
+    // просто отображается в память, иначе jpg декодируется и кэш пересобирается
+    bool load(const std::string& sourceFile, const std::string& cacheDir = ".texcache") {
+        release();
+
+        std::vector<char> source;
+        if (!readFile(sourceFile, source)) {
+            std::cerr << "Не удалось прочитать текстуру: " << sourceFile << std::endl;
+            return false;
+        }
+        uint64_t hash = hashBytes(source.data(), source.size());
+        std::string cacheFile = cachePath(sourceFile, cacheDir);
+
+        if (mapFile(cacheFile) && isValid(hash, source.size())) {
+            return true;
+        }
+        release();
+
+        sf::Image image;
+        if (!image.loadFromFile(sourceFile)) {
+            std::cerr << "Не удалось декодировать текстуру: " << sourceFile << std::endl;
+            return false;
+        }
+        image.flipVertically();
+
+        std::vector<char> contents = buildCache(image, hash, source.size());
+        if (contents.empty()) {
+            std::cerr << "Пустая текстура: " << sourceFile << std::endl;
+            return false;
+        }
+        if (writeCache(cacheFile, contents) && mapFile(cacheFile) && isValid(hash, source.size())) {
+            return true;
+        }
+        release();
+
+        // Кэш недоступен - декодированные пиксели и mip-уровни остаются в памяти
+        std::cerr << "Не удалось записать кэш текстуры: " << cacheFile << ", текстура загружена без кэша" << std::endl;
+        memory = std::move(contents);
+        mapped = memory.data();
+        mappedSize = memory.size();
+        return true;
+    }
+
+    bool isLoaded() const { return mapped != nullptr; }
+    int levelCount() const { return isLoaded() ? (int)header().levelCount : 0; }
+    int width(int level = 0) const { return isLoaded() ? (int)levels()[level].width : 0; }
+    int height(int level = 0) const { return isLoaded() ? (int)levels()[level].height : 0; }
+
+    // Пиксели уровня в формате RGBA8, строки снизу вверх
+    const uint8_t* levelData(int level) const {
+        return static_cast<const uint8_t*>(mapped) + levels()[level].offset;
+    }
+
+    static uint64_t hashBytes(const char* data, size_t size) {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= (uint8_t)data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+private:
+    const TextureCacheHeader& header() const {
+        return *static_cast<const TextureCacheHeader*>(mapped);
+    }
+
+    const TextureCacheLevel* levels() const {
+        return reinterpret_cast<const TextureCacheLevel*>(
+            static_cast<const char*>(mapped) + sizeof(TextureCacheHeader));
+    }
+
+    bool isValid(uint64_t hash, uint64_t size) const {
+        if (mappedSize < sizeof(TextureCacheHeader)) return false;
+        const TextureCacheHeader& h = header();
+        if (std::memcmp(h.magic, "TEXCACHE", 8) != 0 || h.version != VERSION) return false;
+        if (h.sourceHash != hash || h.sourceSize != size || h.levelCount == 0) return false;
+        size_t tableEnd = sizeof(TextureCacheHeader) + h.levelCount * sizeof(TextureCacheLevel);
+        if (mappedSize < tableEnd) return false;
+        const TextureCacheLevel& last = levels()[h.levelCount - 1];
+        return last.offset + (uint64_t)last.width * last.height * 4 <= mappedSize;
+    }
+
+    static std::string cachePath(const std::string& sourceFile, const std::string& cacheDir) {
+        std::string name = sourceFile;
+        std::replace(name.begin(), name.end(), '/', '_');
+        std::replace(name.begin(), name.end(), '\\', '_');
+        return cacheDir + "/" + name + ".mip";
+    }
+
+    static bool readFile(const std::string& filename, std::vector<char>& data) {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) return false;
+        data.resize((size_t)file.tellg());
+        file.seekg(0);
+        return (bool)file.read(data.data(), data.size());
+    }
+
+    // Уменьшение вдвое усреднением блока 2x2 (для нечётных размеров - с повтором края)
+    static std::vector<uint8_t> downsample(const std::vector<uint8_t>& src, int w, int h, int nw, int nh) {
+        std::vector<uint8_t> dst((size_t)nw * nh * 4);
+        for (int y = 0; y < nh; y++) {
+            int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+            for (int x = 0; x < nw; x++) {
+                int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                for (int c = 0; c < 4; c++) {
+                    int sum = src[((size_t)y0 * w + x0) * 4 + c] + src[((size_t)y0 * w + x1) * 4 + c] +
+                              src[((size_t)y1 * w + x0) * 4 + c] + src[((size_t)y1 * w + x1) * 4 + c];
+                    dst[((size_t)y * nw + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+                }
+            }
+        }
+        return dst;
+    }
+
+    // Содержимое файла кэша: заголовок, таблица уровней и пиксели; пусто для пустого изображения
+    static std::vector<char> buildCache(const sf::Image& image, uint64_t hash, uint64_t size) {
+        int w = image.getSize().x;
+        int h = image.getSize().y;
+        if (w == 0 || h == 0) return {};
+
+        std::vector<std::vector<uint8_t>> chain;
+        chain.emplace_back(image.getPixelsPtr(), image.getPixelsPtr() + (size_t)w * h * 4);
+        std::vector<TextureCacheLevel> levelTable;
+        levelTable.push_back({(uint32_t)w, (uint32_t)h, 0});
+        while (w > 1 || h > 1) {
+            int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+            chain.push_back(downsample(chain.back(), w, h, nw, nh));
+            levelTable.push_back({(uint32_t)nw, (uint32_t)nh, 0});
+            w = nw;
+            h = nh;
+        }
+
+        TextureCacheHeader header;
+        std::memcpy(header.magic, "TEXCACHE", 8);
+        header.version = VERSION;
+        header.levelCount = (uint32_t)levelTable.size();
+        header.sourceHash = hash;
+        header.sourceSize = size;
+        header.width = levelTable[0].width;
+        header.height = levelTable[0].height;
+
+        uint64_t offset = sizeof(TextureCacheHeader) + levelTable.size() * sizeof(TextureCacheLevel);
+        for (auto& level : levelTable) {
+            offset = (offset + 15) & ~uint64_t(15);
+            level.offset = offset;
+            offset += (uint64_t)level.width * level.height * 4;
+        }
+
+        std::vector<char> contents((size_t)offset, 0);
+        std::memcpy(contents.data(), &header, sizeof(header));
+        std::memcpy(contents.data() + sizeof(header), levelTable.data(), levelTable.size() * sizeof(TextureCacheLevel));
+        for (size_t i = 0; i < chain.size(); i++) {
+            std::memcpy(contents.data() + levelTable[i].offset, chain[i].data(), chain[i].size());
+        }
+        return contents;
+    }
+
+    static bool writeCache(const std::string& cacheFile, const std::vector<char>& contents) {
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(cacheFile).parent_path(), error);
+
+        // Пишем во временный файл и переименовываем - параллельный запуск не увидит половину кэша
+        std::string tmpFile = cacheFile + ".tmp" + std::to_string(::getpid());
+        bool written;
+        {
+            std::ofstream file(tmpFile, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) return false;
+            file.write(contents.data(), contents.size());
+            written = (bool)file;
+        }
+        if (written) std::filesystem::rename(tmpFile, cacheFile, error);
+        if (!written || error) {
+            std::filesystem::remove(tmpFile, error);
+            return false;
+        }
+        return true;
+    }
+
+    bool mapFile(const std::string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* data = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+        mapped = data;
+        mappedSize = (size_t)st.st_size;
+        return true;
+    }
+
+    void release() {
+        if (mapped && memory.empty()) ::munmap(mapped, mappedSize);
+        memory.clear();
+        memory.shrink_to_fit();
+        mapped = nullptr;
+        mappedSize = 0;
+    }
+
+    // Файл кэша, отображённый в память, или (если кэш не записался) memory
+    void* mapped = nullptr;
+    size_t mappedSize = 0;
+    std::vector<char> memory;
+};
+
+#endif
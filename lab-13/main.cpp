@@ -8,6 +8,14 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "lib/asset_loader.h"
+#include "lib/texture_cache.h"
+#include "lib/simplify.h"
+#include "lib/mesh_optimizer.h"
+#include <algorithm>
+#include <map>
+#include <random>
+#include <tuple>
 
 // ID шейдерной программы
 GLuint Program;
@@ -19,11 +27,15 @@ GLint Attrib_instanceMatrix; // Атрибут для матрицы инста
 GLuint VAO_Center;
 GLuint VBO_Center;
 GLuint TexCoordVBO_Center;
+GLuint NormalVBO_Center;
+GLuint EBO_Center;
 GLuint Texture_Center;
 // ID буферов для орбитальных моделей
 GLuint VBO_Orbit;
 GLuint VAO_Orbit;
 GLuint TexCoordVBO_Orbit;
+GLuint NormalVBO_Orbit;
+GLuint EBO_Orbit;
 GLuint Texture_Orbit;
 GLuint InstanceVBO_Orbit; // Буфер для данных инстансов
 
@@ -49,10 +61,21 @@ struct TexCoord {
     GLfloat u, v;
 };
 
-// Структура для хранения загруженной модели
+// Структура для нормали
+struct Normal {
+    GLfloat x, y, z;
+};
+
+// Структура для хранения загруженной модели.
+// Углы граней с одинаковыми (v, vt, vn) склеены в одну вершину; indices содержит
+// подряд все уровни детализации, lods - их диапазоны (lods[0] - исходная модель)
 struct ModelData {
     std::vector<Vertex> vertices;
     std::vector<TexCoord> texcoords;
+    std::vector<Normal> normals;
+    std::vector<GLuint> indices;
+    std::vector<LodRange> lods;
+    float radius = 0.0f; // радиус описанной сферы вокруг начала координат модели
     int vertexCount;
 };
 
@@ -71,18 +94,27 @@ ModelData orbitModel;
 
 std::vector<Planet> planets;
 std::vector<glm::mat4> instanceMatrices; // Массив матриц для инстансов
+// Нагрузочная сцена (клавиша 3): сотни объектов вместо пяти планет
+bool stressScene = false;
 
 bool centerLoaded = false;
 bool orbitLoaded = false;
+bool centerLoading = false;
+bool orbitLoading = false;
+
+// Разбор obj и декодирование jpg идут в фоновом потоке, в главном - только выгрузка в GPU
+AssetLoader assetLoader(1);
 
 // Исходный код вершинного шейдера с поддержкой инстансинга
 const char* VertexShaderSource = R"(
 #version 330 core
 layout (location = 0) in vec3 coord;
 layout (location = 1) in vec2 texcoord;
-layout (location = 2) in mat4 instanceMatrix; // Для планет
+layout (location = 2) in mat4 instanceMatrix; // Для планет (занимает 2-5)
+layout (location = 6) in vec3 normal;
 
 out vec2 v_texcoord;
+out vec3 v_normal;
 
 uniform mat4 u_view;
 uniform mat4 u_projection;
@@ -98,6 +130,7 @@ void main() {
     }
     gl_Position = u_projection * u_view * finalModel * vec4(coord, 1.0);
     v_texcoord = texcoord;
+    v_normal = mat3(finalModel) * normal;
 }
 )";
 
@@ -105,12 +138,18 @@ void main() {
 const char* FragShaderSource = R"(
 #version 330 core
 in vec2 v_texcoord;
+in vec3 v_normal;
 out vec4 color;
 
 uniform sampler2D u_texture;
 
+const vec3 lightDir = normalize(vec3(0.4, 1.0, 0.6));
+
 void main() {
-    color = texture(u_texture, v_texcoord);
+    // Модель Ламберта с небольшой фоновой составляющей
+    float diffuse = max(dot(normalize(v_normal), lightDir), 0.0);
+    vec4 texColor = texture(u_texture, v_texcoord);
+    color = vec4(texColor.rgb * (0.3 + 0.7 * diffuse), texColor.a);
 }
 )";
 
@@ -131,9 +170,11 @@ bool LoadOBJ(const char* filename, ModelData& model) {
 
     std::vector<Vertex> temp_vertices; 
     std::vector<TexCoord> temp_texcoords;
+    std::vector<Normal> temp_normals;
     
     std::vector<int> vertex_indices;
     std::vector<int> texcoord_indices;
+    std::vector<int> normal_indices;
 
     std::string line;
     int face_count = 0;
@@ -154,15 +195,21 @@ bool LoadOBJ(const char* filename, ModelData& model) {
             iss >> tc.u >> tc.v;
             temp_texcoords.push_back(tc);
         }
+        else if (prefix == "vn") {
+            Normal n;
+            iss >> n.x >> n.y >> n.z;
+            temp_normals.push_back(n);
+        }
         else if (prefix == "f") {
             std::vector<int> face_v_indices;
             std::vector<int> face_vt_indices;
+            std::vector<int> face_vn_indices;
             
             std::string vertex_data;
             while (iss >> vertex_data) {
                 std::istringstream vertex_stream(vertex_data);
                 std::string index_str;
-                int v_idx = -1, vt_idx = -1;
+                int v_idx = -1, vt_idx = -1, vn_idx = -1;
                 
                 if (std::getline(vertex_stream, index_str, '/')) {
                     if (!index_str.empty()) {
@@ -174,21 +221,30 @@ bool LoadOBJ(const char* filename, ModelData& model) {
                         vt_idx = std::stoi(index_str) - 1;
                     }
                 }
+                if (std::getline(vertex_stream, index_str, '/')) {
+                    if (!index_str.empty()) {
+                        vn_idx = std::stoi(index_str) - 1;
+                    }
+                }
                 
                 face_v_indices.push_back(v_idx);
                 face_vt_indices.push_back(vt_idx);
+                face_vn_indices.push_back(vn_idx);
             }
             
             // Триангуляция грани
             for (size_t i = 1; i < face_v_indices.size() - 1; i++) {
                 vertex_indices.push_back(face_v_indices[0]);
                 texcoord_indices.push_back(face_vt_indices[0]);
+                normal_indices.push_back(face_vn_indices[0]);
                 
                 vertex_indices.push_back(face_v_indices[i]);
                 texcoord_indices.push_back(face_vt_indices[i]);
+                normal_indices.push_back(face_vn_indices[i]);
                 
                 vertex_indices.push_back(face_v_indices[i + 1]);
                 texcoord_indices.push_back(face_vt_indices[i + 1]);
+                normal_indices.push_back(face_vn_indices[i + 1]);
             }
             face_count++;
         }
@@ -198,15 +254,63 @@ bool LoadOBJ(const char* filename, ModelData& model) {
     std::cout << "Parsed OBJ file:" << std::endl;
     std::cout << "  Vertices: " << temp_vertices.size() << std::endl;
     std::cout << "  Texcoords: " << temp_texcoords.size() << std::endl;
+    std::cout << "  Normals: " << temp_normals.size() << std::endl;
     std::cout << "  Faces: " << face_count << std::endl;
 
     // Сборка финальных массивов
     model.vertices.clear();
     model.texcoords.clear();
+    model.normals.clear();
+
+    // Нормали из файла используются, если они заданы у каждой вершины каждой грани.
+    // Иначе считаем сглаженные нормали по индексам вершин (углы с общим "v" усредняются)
+    bool fileNormals = !temp_normals.empty();
+    for (int vn_idx : normal_indices) {
+        if (vn_idx < 0 || vn_idx >= (int)temp_normals.size()) {
+            fileNormals = false;
+            break;
+        }
+    }
+
+    std::vector<Normal> smooth_normals;
+    if (!fileNormals) {
+        smooth_normals.assign(temp_vertices.size(), Normal{0.0f, 0.0f, 0.0f});
+        for (size_t i = 0; i + 2 < vertex_indices.size(); i += 3) {
+            int a = vertex_indices[i], b = vertex_indices[i + 1], c = vertex_indices[i + 2];
+            if (a < 0 || b < 0 || c < 0 || a >= (int)temp_vertices.size() ||
+                b >= (int)temp_vertices.size() || c >= (int)temp_vertices.size()) continue;
+            glm::vec3 pa(temp_vertices[a].x, temp_vertices[a].y, temp_vertices[a].z);
+            glm::vec3 pb(temp_vertices[b].x, temp_vertices[b].y, temp_vertices[b].z);
+            glm::vec3 pc(temp_vertices[c].x, temp_vertices[c].y, temp_vertices[c].z);
+            // Ненормированное векторное произведение - вес пропорционален площади грани
+            glm::vec3 n = glm::cross(pb - pa, pc - pa);
+            for (int idx : {a, b, c}) {
+                smooth_normals[idx].x += n.x;
+                smooth_normals[idx].y += n.y;
+                smooth_normals[idx].z += n.z;
+            }
+        }
+        for (auto& n : smooth_normals) {
+            float len = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+            if (len > 0.0f) { n.x /= len; n.y /= len; n.z /= len; }
+        }
+    }
     
+    model.indices.clear();
+    model.lods.clear();
+    std::map<std::tuple<int, int, int>, GLuint> welded;
     for (size_t i = 0; i < vertex_indices.size(); i++) {
         int v_idx = vertex_indices[i];
         if (v_idx >= 0 && v_idx < temp_vertices.size()) {
+            // Угол с уже встречавшейся тройкой индексов ссылается на ту же вершину
+            std::tuple<int, int, int> key(v_idx, texcoord_indices[i], fileNormals ? normal_indices[i] : -1);
+            auto found = welded.find(key);
+            if (found != welded.end()) {
+                model.indices.push_back(found->second);
+                continue;
+            }
+            welded[key] = (GLuint)model.vertices.size();
+            model.indices.push_back((GLuint)model.vertices.size());
             model.vertices.push_back(temp_vertices[v_idx]);
             
             int vt_idx = texcoord_indices[i];
@@ -218,12 +322,15 @@ bool LoadOBJ(const char* filename, ModelData& model) {
                 tc.v = (temp_vertices[v_idx].y + 1.0f) * 0.5f;
                 model.texcoords.push_back(tc);
             }
+
+            model.normals.push_back(fileNormals ? temp_normals[normal_indices[i]] : smooth_normals[v_idx]);
         }
     }
     
     model.vertexCount = model.vertices.size();
     
-    std::cout << "Final vertex count: " << model.vertexCount << std::endl;
+    std::cout << "Final vertex count: " << model.vertexCount
+              << (fileNormals ? " (normals from file)" : " (generated normals)") << std::endl;
     
     if (model.vertexCount == 0) {
         std::cerr << "WARNING: No vertices loaded!" << std::endl;
@@ -233,27 +340,75 @@ bool LoadOBJ(const char* filename, ModelData& model) {
     return true;
 }
 
-// Функция загрузки текстуры 
-GLuint LoadTexture(const char* filename) {
-    sf::Image image;
-    if (!image.loadFromFile(filename)) {
-        std::cerr << "Failed to load texture: " << filename << std::endl;
+// Цепочка упрощённых уровней и порядок индексов: строятся в фоновом потоке вместе с разбором obj
+void BuildModelLods(ModelData& model) {
+    std::vector<glm::vec3> positions;
+    positions.reserve(model.vertices.size());
+    model.radius = 0.0f;
+    for (const auto& v : model.vertices) {
+        positions.push_back(glm::vec3(v.x, v.y, v.z));
+        model.radius = std::max(model.radius, glm::length(positions.back()));
     }
-    
-    image.flipVertically();
-    
+    model.lods = BuildLodIndices(positions, model.indices, model.radius);
+
+    // Треугольники каждого уровня - под кэш вершин и перерисовку, вершины - под выборку
+    MeshOptimizationStats stats;
+    std::vector<int> remap = OptimizeLodIndices(positions, model.indices, model.lods, stats);
+    ApplyVertexRemap(model.vertices, remap);
+    ApplyVertexRemap(model.texcoords, remap);
+    ApplyVertexRemap(model.normals, remap);
+    std::cout << "Triangle order: ACMR " << stats.acmrBefore << " -> " << stats.acmrAfter
+              << ", overdraw " << stats.overdrawBefore << " -> " << stats.overdrawAfter << std::endl;
+
+    std::cout << "LOD levels:";
+    for (const auto& lod : model.lods) std::cout << " " << lod.indexCount / 3;
+    std::cout << " triangles" << std::endl;
+}
+
+// Модель и текстура, подготовленные в фоновом потоке
+struct LoadedAsset {
+    ModelData model;
+    CachedTexture texture; // RGBA8 с mip-уровнями, уже перевёрнутая для OpenGL
+    bool modelLoaded = false;
+    std::string textureFile;
+};
+
+// Выполняется в рабочем потоке: никаких вызовов OpenGL
+LoadedAsset LoadAsset(const std::string& objFile, const std::string& textureFile) {
+    LoadedAsset asset;
+    asset.textureFile = textureFile;
+    asset.modelLoaded = LoadOBJ(objFile.c_str(), asset.model);
+    if (asset.modelLoaded) BuildModelLods(asset.model);
+    // При повторных запусках jpg не декодируется: пиксели берутся из кэша через mmap
+    if (!asset.texture.load(textureFile)) {
+        std::cerr << "Failed to load texture: " << textureFile << std::endl;
+    }
+    return asset;
+}
+
+// Выгрузка декодированной текстуры в GPU (главный поток)
+GLuint UploadTexture(const CachedTexture& cached, const std::string& filename) {
     GLuint texture;
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
     
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.getSize().x, image.getSize().y, 0, 
-                 GL_RGBA, GL_UNSIGNED_BYTE, image.getPixelsPtr());
-    glGenerateMipmap(GL_TEXTURE_2D);
+    if (cached.isLoaded()) {
+        // Вся mip-цепочка уже есть в кэше - glGenerateMipmap не нужен
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, cached.levelCount() - 1);
+        for (int level = 0; level < cached.levelCount(); level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, cached.width(level), cached.height(level), 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, cached.levelData(level));
+        }
+    } else {
+        const GLubyte white[4] = {255, 255, 255, 255};
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    }
     
     std::cout << "Loaded texture: " << filename << std::endl;
     
@@ -315,22 +470,48 @@ void InitSolarSystem() {
     planets.clear();
     instanceMatrices.clear();
     
-    // Разные размеры объектов
-    float customSizes[] = {0.05f, 0.09f, 0.10f, 0.15f, 0.20f};
-    // Разные радиусы орбит (как в настоящей солнечной системе)
-    float orbitRadii[] = {8.0f, 12.0f, 16.0f, 20.0f, 24.0f};
-    // Разные скорости вращения по орбите (ближе - быстрее)
-    float orbitSpeeds[] = {1.2f, 1.0f, 0.8f, 0.6f, 0.4f};
-    // Разные скорости вращения вокруг своей оси
-    float rotationSpeeds[] = {2.0f, 1.5f, 1.8f, 1.2f, 1.0f};
+    if (!stressScene) {
+        // Разные размеры объектов
+        float customSizes[] = {0.05f, 0.09f, 0.10f, 0.15f, 0.20f};
+        // Разные радиусы орбит (как в настоящей солнечной системе)
+        float orbitRadii[] = {8.0f, 12.0f, 16.0f, 20.0f, 24.0f};
+        // Разные скорости вращения по орбите (ближе - быстрее)
+        float orbitSpeeds[] = {1.2f, 1.0f, 0.8f, 0.6f, 0.4f};
+        // Разные скорости вращения вокруг своей оси
+        float rotationSpeeds[] = {2.0f, 1.5f, 1.8f, 1.2f, 1.0f};
+        
+        for(int i = 0; i < 5; i++) {
+            Planet p;
+            p.orbitRadius = orbitRadii[i];        // Каждая планета на своей орбите
+            p.orbitSpeed = orbitSpeeds[i];        // Разные скорости обращения
+            p.rotationSpeed = rotationSpeeds[i];  // Разные скорости вращения
+            p.size = customSizes[i];              // Разные размеры
+            p.orbitAngle = (M_PI * 2 / 5) * i;    // Начальное положение на орбите
+            p.rotationAngle = 0.0f;
+            planets.push_back(p);
+            
+            // Создаем начальную матрицу для каждого инстанса
+            instanceMatrices.push_back(glm::mat4(1.0f));
+        }
+        
+        std::cout << "Solar system initialized with " << planets.size() << " orbiting objects" << std::endl;
+        std::cout << "Orbit radii: 5.0, 8.0, 11.0, 14.0, 17.0 units" << std::endl;
+        return;
+    }
+    
+    // Сотни объектов на орбитах: дальние занимают на экране несколько пикселей,
+    // поэтому рисуются упрощёнными уровнями детализации
+    const int planetCount = 500;
+    std::mt19937 random(2024);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
     
-    for(int i = 0; i < 5; i++) {
+    for(int i = 0; i < planetCount; i++) {
         Planet p;
-        p.orbitRadius = orbitRadii[i];        // Каждая планета на своей орбите
-        p.orbitSpeed = orbitSpeeds[i];        // Разные скорости обращения
-        p.rotationSpeed = rotationSpeeds[i];  // Разные скорости вращения
-        p.size = customSizes[i];              // Разные размеры
-        p.orbitAngle = (M_PI * 2 / 5) * i;    // Начальное положение на орбите
+        p.orbitRadius = 8.0f + 60.0f * unit(random);              // Орбиты от 8 до 68
+        p.orbitSpeed = 3.0f / std::sqrt(p.orbitRadius);           // Ближе - быстрее
+        p.rotationSpeed = 1.0f + unit(random);                    // Разные скорости вращения
+        p.size = 0.05f + 0.15f * unit(random);                    // Разные размеры
+        p.orbitAngle = (float)(M_PI * 2) * unit(random);          // Начальное положение на орбите
         p.rotationAngle = 0.0f;
         planets.push_back(p);
         
@@ -339,12 +520,19 @@ void InitSolarSystem() {
     }
     
     std::cout << "Solar system initialized with " << planets.size() << " orbiting objects" << std::endl;
-    std::cout << "Orbit radii: 5.0, 8.0, 11.0, 14.0, 17.0 units" << std::endl;
+    std::cout << "Orbit radii: 8.0 - 68.0 units" << std::endl;
 }
 
-void LoadCenterModel(const char* objFile, const char* textureFile) {
-    std::cout << "Loading center model..." << std::endl;
-    if (LoadOBJ(objFile, centerModel)) {
+void UploadCenterModel(LoadedAsset& asset) {
+    if (asset.modelLoaded) {
+        // Повторная загрузка: прежняя модель заменяется только теперь, когда новая готова
+        if (centerLoaded) {
+            GLuint buffers[] = { VBO_Center, TexCoordVBO_Center, NormalVBO_Center, EBO_Center };
+            glDeleteBuffers(4, buffers);
+            glDeleteVertexArrays(1, &VAO_Center);
+            glDeleteTextures(1, &Texture_Center);
+        }
+        centerModel = std::move(asset.model);
         glGenVertexArrays(1, &VAO_Center);
         glBindVertexArray(VAO_Center);
 
@@ -360,16 +548,33 @@ void LoadCenterModel(const char* objFile, const char* textureFile) {
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
         glEnableVertexAttribArray(1);
 
-        Texture_Center = LoadTexture(textureFile);
+        glGenBuffers(1, &NormalVBO_Center);
+        glBindBuffer(GL_ARRAY_BUFFER, NormalVBO_Center);
+        glBufferData(GL_ARRAY_BUFFER, centerModel.normals.size() * sizeof(Normal), centerModel.normals.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(6);
+
+        // Индексы всех уровней детализации (привязка сохраняется в VAO)
+        glGenBuffers(1, &EBO_Center);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_Center);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, centerModel.indices.size() * sizeof(GLuint), centerModel.indices.data(), GL_STATIC_DRAW);
+
+        Texture_Center = UploadTexture(asset.texture, asset.textureFile);
         glBindVertexArray(0); 
         centerLoaded = true;
         std::cout << "Center model loaded successfully!" << std::endl;
     }
 }
 
-void LoadOrbitModel(const char* objFile, const char* textureFile) {
-    std::cout << "Loading orbit model..." << std::endl;
-    if (LoadOBJ(objFile, orbitModel)) {
+void UploadOrbitModel(LoadedAsset& asset) {
+    if (asset.modelLoaded) {
+        if (orbitLoaded) {
+            GLuint buffers[] = { VBO_Orbit, TexCoordVBO_Orbit, NormalVBO_Orbit, EBO_Orbit, InstanceVBO_Orbit };
+            glDeleteBuffers(5, buffers);
+            glDeleteVertexArrays(1, &VAO_Orbit);
+            glDeleteTextures(1, &Texture_Orbit);
+        }
+        orbitModel = std::move(asset.model);
         glGenVertexArrays(1, &VAO_Orbit);
         glBindVertexArray(VAO_Orbit);
 
@@ -387,11 +592,23 @@ void LoadOrbitModel(const char* objFile, const char* textureFile) {
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
         glEnableVertexAttribArray(1);
 
+        // Нормали
+        glGenBuffers(1, &NormalVBO_Orbit);
+        glBindBuffer(GL_ARRAY_BUFFER, NormalVBO_Orbit);
+        glBufferData(GL_ARRAY_BUFFER, orbitModel.normals.size() * sizeof(Normal), orbitModel.normals.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(6);
+
+        // Индексы всех уровней детализации
+        glGenBuffers(1, &EBO_Orbit);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_Orbit);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, orbitModel.indices.size() * sizeof(GLuint), orbitModel.indices.data(), GL_STATIC_DRAW);
+
         // Буфер для матриц инстансов (Location 2, 3, 4, 5)
         glGenBuffers(1, &InstanceVBO_Orbit);
         glBindBuffer(GL_ARRAY_BUFFER, InstanceVBO_Orbit);
         // Резервируем место под матрицы
-        glBufferData(GL_ARRAY_BUFFER, 5 * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, planets.size() * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
 
         for (int i = 0; i < 4; i++) {
             glEnableVertexAttribArray(2 + i);
@@ -399,7 +616,7 @@ void LoadOrbitModel(const char* objFile, const char* textureFile) {
             glVertexAttribDivisor(2 + i, 1); 
         }
 
-        Texture_Orbit = LoadTexture(textureFile);
+        Texture_Orbit = UploadTexture(asset.texture, asset.textureFile);
         
         glBindVertexArray(0);
         orbitLoaded = true;
@@ -408,6 +625,35 @@ void LoadOrbitModel(const char* objFile, const char* textureFile) {
     }
 }
 
+// Повторное нажатие перезагружает модель; пока идёт загрузка, нажатия игнорируются
+void LoadCenterModel(const char* objFile, const char* textureFile) {
+    if (centerLoading) return;
+    centerLoading = true;
+    std::cout << "Loading center model..." << std::endl;
+    std::string obj = objFile, tex = textureFile;
+    assetLoader.load<LoadedAsset>(
+        [obj, tex] { return LoadAsset(obj, tex); },
+        [](LoadedAsset& asset) {
+            UploadCenterModel(asset);
+            centerLoading = false;
+        },
+        [] { centerLoading = false; });
+}
+
+void LoadOrbitModel(const char* objFile, const char* textureFile) {
+    if (orbitLoading) return;
+    orbitLoading = true;
+    std::cout << "Loading orbit model..." << std::endl;
+    std::string obj = objFile, tex = textureFile;
+    assetLoader.load<LoadedAsset>(
+        [obj, tex] { return LoadAsset(obj, tex); },
+        [](LoadedAsset& asset) {
+            UploadOrbitModel(asset);
+            orbitLoading = false;
+        },
+        [] { orbitLoading = false; });
+}
+
 void UpdatePlanets(float deltaTime) {
     for (size_t i = 0; i < planets.size(); i++) {
         // Обновляем угол на орбите
@@ -430,6 +676,9 @@ void UpdatePlanets(float deltaTime) {
     }
 }
 
+// Пикселей на единицу длины на расстоянии 1 для текущей высоты окна и угла обзора 45°
+float pixelsPerUnit = 600.0f / (2.0f * std::tan(glm::radians(22.5f)));
+
 void DrawCenterModel(float aspect) {
     if (!centerLoaded) return;
     
@@ -456,11 +705,15 @@ void DrawCenterModel(float aspect) {
     glBindTexture(GL_TEXTURE_2D, Texture_Center);
     glUniform1i(glGetUniformLocation(Program, "u_texture"), 0);
     
+    // Уровень детализации по расстоянию до камеры (модель в начале координат)
+    float distance = glm::length(cameraPos) - centerModel.radius * 0.10f;
+    const LodRange& lod = centerModel.lods[SelectLod(centerModel.lods, distance, 0.10f, pixelsPerUnit)];
+    
     // ИСПОЛЬЗУЕМ VAO
     glBindVertexArray(VAO_Center);
     
-    // КЛАССИЧЕСКИЙ ВЫЗОВ 
-    glDrawArrays(GL_TRIANGLES, 0, centerModel.vertexCount);
+    // КЛАССИЧЕСКИЙ ВЫЗОВ (по индексам выбранного уровня)
+    glDrawElements(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, (void*)(lod.firstIndex * sizeof(GLuint)));
     
     glBindVertexArray(0);
     glUseProgram(0);
@@ -486,15 +739,47 @@ void DrawOrbitingModels(float aspect) {
     glBindTexture(GL_TEXTURE_2D, Texture_Orbit);
     glUniform1i(glGetUniformLocation(Program, "u_texture"), 0);
     
-    // 4. Обновляем данные в InstanceVBO (новые позиции планет)
+    // 4. Раскладываем инстансы по уровням детализации (сортировка подсчётом):
+    // матрицы одного уровня лежат в буфере подряд
+    int lodCount = (int)orbitModel.lods.size();
+    std::vector<int> instanceLod(planets.size());
+    std::vector<int> lodStart(lodCount + 1, 0);
+    for (size_t i = 0; i < planets.size(); i++) {
+        glm::vec3 position(instanceMatrices[i][3].x, instanceMatrices[i][3].y, instanceMatrices[i][3].z);
+        float scale = planets[i].size;
+        float distance = glm::length(position - cameraPos) - orbitModel.radius * scale;
+        instanceLod[i] = SelectLod(orbitModel.lods, distance, scale, pixelsPerUnit);
+        lodStart[instanceLod[i] + 1]++;
+    }
+    for (int l = 0; l < lodCount; l++) lodStart[l + 1] += lodStart[l];
+    static std::vector<glm::mat4> sortedMatrices;
+    sortedMatrices.resize(planets.size());
+    std::vector<int> fill(lodStart.begin(), lodStart.end() - 1);
+    for (size_t i = 0; i < planets.size(); i++) {
+        sortedMatrices[fill[instanceLod[i]]++] = instanceMatrices[i];
+    }
+
+    // 5. Обновляем данные в InstanceVBO (новые позиции планет); число инстансов
+    // меняется при переключении сцены, поэтому буфер задаётся целиком
     glBindBuffer(GL_ARRAY_BUFFER, InstanceVBO_Orbit);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, instanceMatrices.size() * sizeof(glm::mat4), instanceMatrices.data());
+    glBufferData(GL_ARRAY_BUFFER, sortedMatrices.size() * sizeof(glm::mat4), sortedMatrices.data(), GL_DYNAMIC_DRAW);
     
     // ИСПОЛЬЗУЕМ VAO
     glBindVertexArray(VAO_Orbit);
     
-    // 8. ОДИН ВЫЗОВ для отрисовки всех планет сразу
-    glDrawArraysInstanced(GL_TRIANGLES, 0, orbitModel.vertexCount, planets.size());
+    // 6. По ОДНОМУ ВЫЗОВУ на уровень детализации: атрибут матрицы смещается
+    // на начало группы инстансов этого уровня
+    for (int l = 0; l < lodCount; l++) {
+        int count = lodStart[l + 1] - lodStart[l];
+        if (count == 0) continue;
+        for (int i = 0; i < 4; i++) {
+            glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                  (void*)(lodStart[l] * sizeof(glm::mat4) + sizeof(glm::vec4) * i));
+        }
+        const LodRange& lod = orbitModel.lods[l];
+        glDrawElementsInstanced(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT,
+                                (void*)(lod.firstIndex * sizeof(GLuint)), count);
+    }
     
     glBindVertexArray(0);
     glUseProgram(0);
@@ -506,8 +791,12 @@ void ReleaseVBO() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     if (VBO_Center != 0) glDeleteBuffers(1, &VBO_Center);
     if (TexCoordVBO_Center != 0) glDeleteBuffers(1, &TexCoordVBO_Center);
+    if (NormalVBO_Center != 0) glDeleteBuffers(1, &NormalVBO_Center);
+    if (EBO_Center != 0) glDeleteBuffers(1, &EBO_Center);
     if (VBO_Orbit != 0) glDeleteBuffers(1, &VBO_Orbit);
     if (TexCoordVBO_Orbit != 0) glDeleteBuffers(1, &TexCoordVBO_Orbit);
+    if (NormalVBO_Orbit != 0) glDeleteBuffers(1, &NormalVBO_Orbit);
+    if (EBO_Orbit != 0) glDeleteBuffers(1, &EBO_Orbit);
     if (InstanceVBO_Orbit != 0) glDeleteBuffers(1, &InstanceVBO_Orbit);
 }
 
@@ -538,8 +827,10 @@ void print_options() {
     std::cout << "5. A/D - Влево/Вправо (Камера)" << std::endl;
     std::cout << "6. LShift/Space - Вниз/Вверх (Камера)" << std::endl;
     std::cout << "7. Мышь - Поворот камеры" << std::endl;
+    std::cout << "8. 3 - нагрузочная сцена (500 объектов) / пять планет" << std::endl;
     std::cout << "\nИСПОЛЬЗУЕТСЯ ИНСТАНЦИРОВАННЫЙ РЕНДЕРИНГ!" << std::endl;
-    std::cout << "Все орбитальные объекты отрисовываются за ОДИН вызов glDrawArraysInstanced()\n" << std::endl;
+    std::cout << "Орбитальные объекты отрисовываются вызовами glDrawElementsInstanced(),"
+              << " по одному на уровень детализации\n" << std::endl;
 }
 
 int main() {
@@ -562,6 +853,9 @@ int main() {
 
     while (window.isOpen()) {
         float deltaTime = clock.restart().asSeconds();
+
+        // Не больше одной выгрузки в GPU за кадр
+        assetLoader.processCompleted(1);
         
         sf::Event event;
         while (window.pollEvent(event)) {
@@ -570,6 +864,7 @@ int main() {
             }
             if (event.type == sf::Event::Resized) { 
                 glViewport(0, 0, event.size.width, event.size.height); 
+                pixelsPerUnit = event.size.height / (2.0f * std::tan(glm::radians(22.5f)));
             }
             if (event.type == sf::Event::KeyPressed) {
                 switch (event.key.code) {
@@ -582,6 +877,10 @@ int main() {
                     case sf::Keyboard::Num2:
                         LoadOrbitModel("lolipop.obj", "lolipop_texture.jpg");
                         break;
+                    case sf::Keyboard::Num3:
+                        stressScene = !stressScene;
+                        InitSolarSystem();
+                        break;
                 }
             }
             